@@ -14,6 +14,23 @@
 //          with rup_write, then rup_close.                                 //
 //  Client: rup_open, rup_write and rup_read to get response                //
 //          then rup_close.                                                 //
+//  Messages: rup_writemsg and rup_readmsg move buffers of any size up to   //
+//          RUP_MAXMSG in place of struct pkt.                              //
+//  Reactor: rup_open, rup_bind, rup_poll and rup_setcallback, then loop    //
+//          on rup_process to serve every peer from one thread.             //
+//  Multi-core: rup_serve runs a reactor per cpu on one port, each with     //
+//          its own rup_setreuseport socket.  Link with -lpthread.          //
+//  Coroutines: rup_coro.h wraps polled sockets for C++20 tasks that        //
+//          co_await reads and writes on a small pool of threads.           //
+//  Connections: rup_connect trades connection IDs with a server, and       //
+//          resumes one it saw recently without waiting for the answer.     //
+//  Streams: rup_setstream before writing and rup_readstream keep several   //
+//          ordered streams to a peer apart, so a loss on one does not      //
+//          hold up the others.                                             //
+//  Testing: rup_setimpair puts a seeded lossy, slow or reordering link     //
+//          under a socket's sends.                                         //
+//  Metrics: rup_getstats and rup_getpeerstats report datagrams, bytes,     //
+//          retransmits, drops and RTT and completion time histograms.      //
 //////////////////////////////////////////////////////////////////////////////
 
 #ifndef __RUP_H
@@ -27,6 +44,13 @@
 #include <iostream>
 using namespace std;
 
+// Same layout as the POSIX struct iovec taken by rup_writev and rup_readv
+struct iovec
+{
+	void* iov_base;
+	size_t iov_len;
+};
+
 #else
 
 // Linux includes
@@ -41,6 +65,14 @@ using namespace std;
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <netinet/udp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <poll.h>
+#include <signal.h>
 #endif
 
 // Defines
@@ -54,6 +86,95 @@ using namespace std;
 #define SERVERCHATPORT 10001
 #define CLIENTCHATPORT 10002
 #define ADDRESSSIZE 16
+#define RUP_MAXWINDOW 64
+#define RUP_MAXSOCKS 64
+#define RUP_MAXRETRIES 12
+#define RUP_MAXMSG (16 * 1024 * 1024)
+#define RUP_SERVE_TICK 100
+
+// Checksum engines
+#define RUP_CKSUM_NONE 0
+#define RUP_CKSUM_POPCOUNT 1
+#define RUP_CKSUM_CRC32C 2
+#define RUP_CKSUM_CRC32C_SOFT 3
+
+// Heap use of the calling thread, see rup_getallocs.  Steady state traffic
+//   only reuses buffers, so _allocs stops growing once the pools are warm.
+struct rup_allocinfo
+{
+  long long _allocs;
+  long long _frees;
+  long long _reuses;
+};
+
+// Congestion controllers, see rup_setcongestion
+#define RUP_CC_NONE 0
+#define RUP_CC_NEWRENO 1
+#define RUP_CC_DELAY 2
+
+// Segmentation offloads
+#define RUP_OFFLOAD_GSO 1
+#define RUP_OFFLOAD_GRO 2
+
+// I/O backends, see rup_openio
+#define RUP_IO_CLASSIC 0
+#define RUP_IO_URING 1
+
+// Delivery classes, see rup_setdelivery
+#define RUP_DELIVER_ORDERED 0
+#define RUP_DELIVER_UNORDERED 1
+#define RUP_DELIVER_PARTIAL 2
+#define RUP_DELIVER_UNRELIABLE 3
+
+// Counters of one delivery class of a socket, see rup_getdelivery.  The
+//   first four count frames sent, the last two pkts and messages received.
+struct rup_deliveryinfo
+{
+  long long _sent;
+  long long _retransmits;
+  long long _acked;
+  long long _expired;
+  long long _delivered;
+  long long _early;
+};
+
+// Streams to each peer, see rup_setstream and rup_readstream
+#define RUP_MAXSTREAMS 16
+#define RUP_ANYSTREAM -1
+
+// Simulated link under the frames a socket sends, see rup_setimpair.
+//   Odds are in percent.  Lost frames come in runs of _burst frames on
+//   average, 1 or less for independent losses.  A reordered frame waits
+//   until up to _reorderDepth later frames have passed it.  _rate is in
+//   bytes per second, 0 for no limit, and _queue the frames the link
+//   holds before it drops, 0 for the default.
+struct rup_impair
+{
+  unsigned long long _seed;
+  double _loss;
+  double _burst;
+  double _dup;
+  double _reorder;
+  int _reorderDepth;
+  double _corrupt;
+  long long _delay_us;
+  long long _jitter_us;
+  long long _rate;
+  int _queue;
+};
+
+// What a simulated link did to the frames offered to it, and the frames
+//   it is holding now
+struct rup_impairinfo
+{
+  long long _frames;
+  long long _lost;
+  long long _duplicated;
+  long long _reordered;
+  long long _corrupted;
+  long long _overflow;
+  long long _held;
+};
 
 // FIXME: This needs to be changed to a buffer with an identifier and length for
 //        this to be more generic
@@ -70,6 +191,80 @@ struct pkt
   char _ackvar;
 };
 
+// Round trip estimator of one peer, all times in microseconds, the frames
+//   its congestion controller lets the socket have in flight and the frames
+//   the peer last said it can take
+struct rup_rttinfo
+{
+  long long _srtt;
+  long long _rttvar;
+  long long _rto;
+  int _samples;
+  int _cwnd;
+  int _ssthresh;
+  int _rwnd;
+};
+
+// Connection with one peer, see rup_connect and rup_getconn: the IDs each
+//   side gave it, 0 until set up, and the parameters the peer announced
+struct rup_conninfo
+{
+  unsigned int _cid;
+  unsigned int _peerCid;
+  int _window;
+  int _mtu;
+  int _cksum;
+  int _resumed;
+};
+
+// The calls whose frames are counted apart in _retransmits of
+//   struct rup_stats: pkts from rup_write, fragments of rup_writemsg and
+//   rup_writev, HELLOs of rup_connect and the FWDs that skip frames
+//   given up on
+#define RUP_PRIM_WRITE 0
+#define RUP_PRIM_WRITEMSG 1
+#define RUP_PRIM_CONNECT 2
+#define RUP_PRIM_FORWARD 3
+#define RUP_PRIMS 4
+
+// Log-linear histogram of times in microseconds, see rup_histpercentile.
+//   Below 32 every value has a bucket of its own, above that each power
+//   of two is split in 16, so a bucket is within 1/16 of the values it
+//   holds.  Times of more than 2^36 go in the last bucket.
+#define RUP_HISTBUCKETS 528
+struct rup_histogram
+{
+  long long _count;
+  long long _sum;
+  long long _min;
+  long long _max;
+  long long _buckets[RUP_HISTBUCKETS];
+};
+
+// Traffic of a socket or one peer, see rup_getstats.  Datagrams and bytes
+//   count everything on the wire, ACKs and handshakes too.  _foreign are
+//   frames of another version or malformed, and answers from an address
+//   the socket has no peer for.  _badChecksum are those damaged on the
+//   way, _timeouts the retransmit timer firing and _failures peers given
+//   up on.  _rtt holds the round trips timed and _complete the time from a
+//   write to the ACK of its last frame.  A peer idle for a minute is
+//   forgotten and its counters stay with the socket.
+struct rup_stats
+{
+  long long _sent;
+  long long _sentBytes;
+  long long _received;
+  long long _receivedBytes;
+  long long _retransmits[RUP_PRIMS];
+  long long _duplicates;
+  long long _foreign;
+  long long _badChecksum;
+  long long _timeouts;
+  long long _failures;
+  struct rup_histogram _rtt;
+  struct rup_histogram _complete;
+};
+
 //
 // rup_open
 //
@@ -80,6 +275,31 @@ struct pkt
 // Output: int sock - Return a descriptor to be used in all other RUP calls.
 int rup_open();
 
+//
+// rup_openio
+//
+// Description: Open a socket like rup_open, doing its I/O with the given
+//               backend.  RUP_IO_URING keeps a multishot receive posted
+//               over a ring of provided buffers and submits the sends of
+//               each flush together, waits included, so steady traffic
+//               needs no system call to read.  It falls back to
+//               RUP_IO_CLASSIC when the kernel (Linux 6.0 and later) or
+//               the platform cannot provide it, see rup_getio.  GRO is
+//               not used with RUP_IO_URING.
+//
+// Input: int io - RUP_IO_CLASSIC or RUP_IO_URING.
+// Output: int sock - Return a descriptor to be used in all other RUP calls.
+int rup_openio(int io);
+
+//
+// rup_getio
+//
+// Description: Tell which I/O backend a socket ended up with.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Output: int - RUP_IO_CLASSIC or RUP_IO_URING.
+int rup_getio(int rfd);
+
 //
 // rup_bind
 //
@@ -90,10 +310,32 @@ int rup_open();
 // Output: int - Returns 0 on success and -1 on failure.
 int rup_bind(int rfd, int portno);
 
+//
+// rup_connect
+//
+// Description: Set up a connection to a server.  Both sides pick a compact
+//               ID for it that their frames then carry, so the server finds
+//               the connection with one hash lookup and follows a client
+//               whose address changes.  The window, largest frame and
+//               checksum engine of each side are traded, and the round
+//               trip of the handshake seeds the RTT estimator.  The server
+//               hands back a resume token: connecting again within
+//               RUP_RESUME_SECS reuses what was learnt and returns without
+//               waiting, so the first writes go right behind the HELLO.
+//               Peers written to without rup_connect are still found by
+//               address.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct sockaddr_in* to - The server's ip address and port number.
+// Output: int - Returns 0 on success and -1 if the server never answered.
+int rup_connect(int rfd, struct sockaddr_in* to);
+
 //
 // rup_close
 //
-// Description: close a socket using the incoming file descriptor.
+// Description: close a socket using the incoming file descriptor.  Pkts still
+//               in flight are flushed first, and retransmits of pkts that were
+//               just acknowledged are answered for a short linger period.
 //
 // Input: int rfd - A valid RUP file descriptor.
 // Output: NA
@@ -102,7 +344,10 @@ void rup_close(int rfd);
 //
 // rup_write
 //
-// Description: Write data to a remote ip address and port number.
+// Description: Write data to a remote ip address and port number.  With the
+//               default window of 1 this returns as soon as the receiver's ACK
+//               arrives, or fails once RUP_MAXRETRIES retransmits have gone
+//               unanswered.
 //
 // Input: int rfd - A valid RUP file descriptor.
 // Input: void* buf - A pointer to the data being sent.
@@ -126,6 +371,539 @@ int rup_write(int rfd, void* buf, int cc, struct sockaddr_in* to);
 //
 int rup_read(int rfd, void* buf, int cc, struct sockaddr_in* from);
 
+//
+// rup_writemsg
+//
+// Description: Send a message of any size up to RUP_MAXMSG.  It goes out as
+//               MTU sized fragments, as many in flight at once as the window
+//               allows, and the receiver hands it back whole from
+//               rup_readmsg.  With the default window of 1 this returns once
+//               the last fragment is acknowledged; set a larger window with
+//               rup_setwindow to pipeline the fragments.  A non-blocking
+//               socket fails the call unless the whole message fits in the
+//               window at once.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: void* buf - The message.
+// Input: int len - The message byte count.
+// Input: struct sockaddr_in* to - The receiver's address.
+// Output: int - Returns 1 on success and 0 on failure.
+int rup_writemsg(int rfd, void* buf, int len, struct sockaddr_in* to);
+
+//
+// rup_writev
+//
+// Description: Send the bytes of an iovec array as one message, exactly as
+//               rup_writemsg sends one buffer.  The pieces are gathered
+//               straight into the frames, with no struct pkt in between,
+//               and may hold any binary data.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: const struct iovec* iov - The message's pieces.
+// Input: int iovcnt - The number of pieces.
+// Input: struct sockaddr_in* to - The receiver's address.
+// Output: int - Returns 1 on success and 0 on failure.
+int rup_writev(int rfd, const struct iovec* iov, int iovcnt, struct sockaddr_in* to);
+
+//
+// rup_readmsg
+//
+// Description: Read the next message sent with rup_writemsg or rup_writev.
+//               Messages are reassembled into buffers the socket reuses,
+//               and the ones from each sender come back in the order they
+//               were sent.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: void* buf - Filled with the message, up to cap bytes.
+// Input: int cap - The byte count of buf.
+// Input: struct sockaddr_in* from - Set to the sender's address if not NULL.
+// Output: int len - The message byte count, which is more than cap when the
+//           message was cut short, or -1 if the socket is non-blocking and
+//           no message is waiting.
+int rup_readmsg(int rfd, void* buf, int cap, struct sockaddr_in* from);
+
+//
+// rup_readv
+//
+// Description: Read the next message as rup_readmsg does, scattering it
+//               across an iovec array.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: const struct iovec* iov - The buffers to fill, in order.
+// Input: int iovcnt - The number of buffers.
+// Input: struct sockaddr_in* from - Set to the sender's address if not NULL.
+// Output: int len - The message byte count, which is more than the buffers
+//           hold when the message was cut short, or -1 if the socket is
+//           non-blocking and no message is waiting.
+int rup_readv(int rfd, const struct iovec* iov, int iovcnt, struct sockaddr_in* from);
+
+//
+// rup_readstream
+//
+// Description: Read the next message of one stream, or of any stream,
+//               into one buffer.  Messages of the other streams wait for
+//               their own reads.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int* stream - The stream to read, or RUP_ANYSTREAM, set to the
+//          stream the message came on.
+// Input: void* buf - Filled with the message, up to cap bytes.
+// Input: int cap - The byte count of buf.
+// Input: struct sockaddr_in* from - Set to the sender's address if not NULL.
+// Output: int len - The message byte count, which is more than cap when the
+//           message was cut short, or -1 if the socket is non-blocking and
+//           no message is waiting.
+int rup_readstream(int rfd, int* stream, void* buf, int cap, struct sockaddr_in* from);
+
+//
+// rup_setwindow
+//
+// Description: Set how many pkts rup_write may have in flight to one receiver
+//               before it blocks waiting for ACKs.  A window of 1 keeps the
+//               stop-and-wait handshake.  A larger window makes rup_write
+//               return as soon as the pkt is queued and sent; the receiver
+//               buffers out of order pkts and rup_read hands them back in order.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int window - Number of unacknowledged pkts allowed, 1 to RUP_MAXWINDOW.
+// Output: int - Returns 0 on success and -1 on failure.
+int rup_setwindow(int rfd, int window);
+
+//
+// rup_setcongestion
+//
+// Description: Choose the congestion controller that limits how many of a
+//               socket's window slots each peer may have in flight.  Frames
+//               beyond it wait in the window until ACKs make room.
+//               RUP_CC_NEWRENO is the default and halves the window on loss.
+//               RUP_CC_DELAY sizes it from how far the RTT rises above its
+//               minimum, keeping queues short.  RUP_CC_NONE only applies
+//               the socket's window.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int cc - RUP_CC_NONE, RUP_CC_NEWRENO or RUP_CC_DELAY.
+// Output: int - Returns 0 on success and -1 on failure.
+int rup_setcongestion(int rfd, int cc);
+
+//
+// rup_setpacing
+//
+// Description: Spread new frames evenly over the round trip at a little
+//               more than the congestion window per RTT, instead of sending
+//               them back to back.  Off by default.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int on - Nonzero to pace, 0 to send as soon as the window allows.
+// Output: int - Returns 0 on success.
+int rup_setpacing(int rfd, int on);
+
+//
+// rup_setrcvbuf
+//
+// Description: Set how many frames, pkts or message fragments, the socket
+//               holds for the application before it stops offering its
+//               peers room to send more.  Every ACK advertises the room
+//               left and senders never send past it, so a slow reader
+//               bounds the memory it uses instead of losing data to
+//               retransmits.  The default is 1024.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int frames - The buffer size in frames, at least 1.
+// Output: int - Returns 0 on success and -1 on failure.
+int rup_setrcvbuf(int rfd, int frames);
+
+//
+// rup_setmaxpeers
+//
+// Description: Set how many remote addresses the socket keeps state for,
+//               each with its own windows.  A frame from a new address
+//               past the cap takes the place of the peer quiet the longest
+//               that is owed nothing, or is dropped if every peer is busy,
+//               so a flood of addresses cannot grow the socket's memory
+//               without bound.  Peers the application writes to are not
+//               capped.  The default is 4096.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int peers - The most peers, at least 1.
+// Output: int - Returns 0 on success and -1 on failure.
+int rup_setmaxpeers(int rfd, int peers);
+
+//
+// rup_setdelivery
+//
+// Description: Choose how the pkts and messages written from now on reach
+//               their receiver, so each write can pick its own class.
+//               RUP_DELIVER_ORDERED, the default, retransmits every frame
+//               until it is acknowledged and hands each sender's pkts out
+//               in order.  RUP_DELIVER_UNORDERED retransmits the same way
+//               but a pkt, or a message of one fragment, is handed out as
+//               soon as it arrives instead of waiting behind a lost frame.
+//               RUP_DELIVER_PARTIAL stops retransmitting a frame after
+//               tries transmissions or budget_ms since it was written, and
+//               the receiver skips it.  RUP_DELIVER_UNRELIABLE sends a pkt,
+//               or a message of one fragment, once and outside the window:
+//               it is never acknowledged, never waits for the window and is
+//               dropped by a receiver whose buffer is full.  Longer
+//               messages go as RUP_DELIVER_PARTIAL with one try.  Receivers
+//               need no setting.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int mode - One of the RUP_DELIVER_* classes.
+// Input: int tries - Transmissions of a RUP_DELIVER_PARTIAL frame, 0 for
+//          no limit.
+// Input: int budget_ms - Lifetime of a RUP_DELIVER_PARTIAL frame in
+//          milliseconds, 0 for no limit.
+// Output: int - Returns 0 on success and -1 on failure.
+int rup_setdelivery(int rfd, int mode, int tries, int budget_ms);
+
+//
+// rup_getdelivery
+//
+// Description: Report the counters of one delivery class of a socket:
+//               frames sent the first time, sent again, acknowledged and
+//               given up on, and pkts and messages handed to the
+//               application, _early of them ahead of a lost frame.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int mode - One of the RUP_DELIVER_* classes.
+// Input: struct rup_deliveryinfo* info - Filled in with the counters.
+// Output: int - Returns 0 on success and -1 on failure.
+int rup_getdelivery(int rfd, int mode, struct rup_deliveryinfo* info);
+
+//
+// rup_setstream
+//
+// Description: Choose the stream the pkts and messages written from now on
+//               go on.  Every stream to a peer shares its window and its
+//               congestion control, but each is handed out in its own
+//               order: a frame lost on one stream holds up only that
+//               stream.  Stream 0 is the default and the only one an
+//               earlier receiver understands.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int stream - The stream, 0 to RUP_MAXSTREAMS - 1.
+// Output: int - Returns 0 on success and -1 on failure.
+int rup_setstream(int rfd, int stream);
+
+//
+// rup_flush
+//
+// Description: Block until every pkt queued by a windowed rup_write has been
+//               acknowledged by its receiver, or its receiver has been given
+//               up on after RUP_MAXRETRIES unanswered retransmits.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Output: int ret - Returns 1 on success and 0 on failure.
+int rup_flush(int rfd);
+
+//
+// rup_pending
+//
+// Description: Count the frames sent to a peer, or to every peer, that are
+//               still waiting for an ACK.  A non-blocking caller can wait
+//               for this to reach 0 instead of blocking in rup_flush.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct sockaddr_in* peer - The remote ip address and port number,
+//          NULL for every peer.
+// Output: int count - The frames in flight.
+int rup_pending(int rfd, struct sockaddr_in* peer);
+
+//
+// rup_linger
+//
+// Description: Report how long rup_close would still answer retransmits
+//               from senders whose last ACK may have been lost, if it were
+//               called now.  With nothing pending and no time left
+//               rup_close returns at once.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Output: long long - Microseconds left, 0 when rup_close would not wait.
+long long rup_linger(int rfd);
+
+//
+// rup_setdelack
+//
+// Description: Let the receiver hold its ACK for in order pkts, either until
+//               a pkt of its own can carry it back, every pkts have arrived
+//               or delay_us microseconds have passed.  Pkts that show loss
+//               are still acknowledged at once.  Off by default.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int delay_us - Longest hold in microseconds, 0 to ACK every pkt.
+// Input: int every - ACK at least once for this many pkts, 1 to RUP_MAXWINDOW.
+// Output: int - Returns 0 on success and -1 on failure.
+int rup_setdelack(int rfd, int delay_us, int every);
+
+//
+// rup_getrtt
+//
+// Description: Report the smoothed RTT, RTT variance and current retransmit
+//               timeout kept for a peer.  Retransmit timers start at 100ms and
+//               follow the measured RTT (RFC 6298, Karn's rule) with
+//               exponential backoff on every timeout.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct sockaddr_in* peer - The remote ip address and port number.
+// Input: struct rup_rttinfo* info - Filled in with the peer's estimator.
+// Output: int - Returns 0 on success and -1 if the peer is unknown.
+int rup_getrtt(int rfd, struct sockaddr_in* peer, struct rup_rttinfo* info);
+
+//
+// rup_getconn
+//
+// Description: Report the connection set up with a peer by rup_connect, or
+//               by the peer connecting to this socket.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct sockaddr_in* peer - The remote ip address and port number.
+// Input: struct rup_conninfo* info - Filled in with the connection.
+// Output: int - Returns 0 on success and -1 if the peer is unknown.
+int rup_getconn(int rfd, struct sockaddr_in* peer, struct rup_conninfo* info);
+
+//
+// rup_getstats
+//
+// Description: Report the traffic of a socket: every peer's counters and
+//               histograms added up, with the frames dropped before a peer
+//               was found.  Counters are kept by the thread driving the
+//               socket without locks, so call it from that thread.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rup_stats* stats - Filled in with the counters.
+// Output: int - Returns 0 on success.
+int rup_getstats(int rfd, struct rup_stats* stats);
+
+//
+// rup_getpeerstats
+//
+// Description: Report the traffic to and from one peer of a socket.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct sockaddr_in* peer - The remote ip address and port number.
+// Input: struct rup_stats* stats - Filled in with the peer's counters.
+// Output: int - Returns 0 on success and -1 if the peer is unknown.
+int rup_getpeerstats(int rfd, struct sockaddr_in* peer, struct rup_stats* stats);
+
+//
+// rup_histpercentile
+//
+// Description: Read a percentile off a histogram of struct rup_stats.  The
+//               answer is the top of the bucket it falls in, kept within
+//               the smallest and largest values recorded.
+//
+// Input: struct rup_histogram* h - The histogram.
+// Input: double pct - The percentile, 50 for the median, 100 for the most.
+// Output: long long - The time in microseconds, 0 if nothing was recorded.
+long long rup_histpercentile(struct rup_histogram* h, double pct);
+
+//
+// rup_setchecksum
+//
+// Description: Choose the checksum engine used for the frames a socket sends.
+//               Receivers check each frame with the engine named in its
+//               header.  CRC32C is the default and uses the SSE4.2 crc32
+//               instruction when the cpu has it.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int type - RUP_CKSUM_NONE, RUP_CKSUM_POPCOUNT or RUP_CKSUM_CRC32C.
+// Output: int - Returns 0 on success and -1 on failure.
+int rup_setchecksum(int rfd, int type);
+
+//
+// rup_checksum
+//
+// Description: Run one of the checksum engines over a buffer.
+//
+// Input: int type - RUP_CKSUM_NONE, RUP_CKSUM_POPCOUNT, RUP_CKSUM_CRC32C,
+//          or RUP_CKSUM_CRC32C_SOFT to force the table driven CRC32C.
+// Input: const void* buf - The buffer.
+// Input: int len - The byte count of the buffer.
+// Output: unsigned int - The checksum.
+unsigned int rup_checksum(int type, const void* buf, int len);
+
+// Callback rup_process hands each in order pkt of a socket to
+typedef void (*rup_callback)(int rfd, struct pkt* p, struct sockaddr_in* from, void* arg);
+
+//
+// rup_setnonblock
+//
+// Description: Turn non-blocking mode on or off.  In non-blocking mode
+//               rup_read returns 0 when no pkt is waiting and rup_write
+//               returns 0 when the peer's window is full; neither waits
+//               for an ACK.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int on - Nonzero for non-blocking mode.
+// Output: int - Returns 0 on success.
+int rup_setnonblock(int rfd, int on);
+
+//
+// rup_setcallback
+//
+// Description: Have rup_process hand the pkts arriving on a socket to a
+//               callback instead of queueing them for rup_read.  The
+//               callback may rup_write but must not rup_close the socket.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: rup_callback cb - The callback, NULL to queue pkts again.
+// Input: void* arg - Passed through to the callback.
+// Output: int - Returns 0 on success.
+int rup_setcallback(int rfd, rup_callback cb, void* arg);
+
+//
+// rup_setoffload
+//
+// Description: Ask the kernel to segment runs of equal sized frames sent to
+//               one peer (GSO) and to coalesce the datagrams it receives
+//               (GRO).  Each is only turned on if the kernel supports it,
+//               and GSO falls back to one datagram per frame if a send
+//               cannot be segmented.  With GSO a windowed rup_write may
+//               leave its pkt queued until the window or the send queue
+//               fills, or the next call that waits.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int flags - RUP_OFFLOAD_GSO and/or RUP_OFFLOAD_GRO, 0 for neither.
+// Output: int - Returns the offloads now in use.
+int rup_setoffload(int rfd, int flags);
+
+//
+// rup_setbatch
+//
+// Description: Send and read up to RUP_BATCH datagrams per system call with
+//               sendmmsg and recvmmsg, or one per call to compare the two.
+//               On by default.  Offloads still apply to the one datagram a
+//               call carries.  Winsock always sends and reads one.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int on - Nonzero to batch, 0 for one datagram per system call.
+// Output: int - Returns 0 on success.
+int rup_setbatch(int rfd, int on);
+
+//
+// rup_setimpair
+//
+// Description: Put a simulated network link under the frames a socket
+//               sends, to measure how RUP copes with a bad network on one
+//               machine.  Each frame may be lost, alone or in bursts,
+//               damaged by one flipped bit, duplicated, reordered behind
+//               later frames, delayed with jitter (which can reorder too)
+//               or queued behind a rate limit, dropping at the tail when
+//               the queue is full.  The same seed and the same frames give
+//               the same impairments.  Set a link on both ends to impair
+//               both directions.  A new link, or NULL, first sends what
+//               the old one held.  Replaces the rup_layer2_simulation of
+//               the first versions.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rup_impair* cfg - The link, NULL for none.
+// Output: int - Returns 0 on success and -1 on failure.
+int rup_setimpair(int rfd, struct rup_impair* cfg);
+
+//
+// rup_getimpair
+//
+// Description: Report what a socket's simulated link has done so far.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rup_impairinfo* info - Filled in with the counters.
+// Output: int - Returns 0 on success and -1 if the socket has no link.
+int rup_getimpair(int rfd, struct rup_impairinfo* info);
+
+//
+// rup_poll
+//
+// Description: Register a socket with the calling thread's reactor,
+//               driven by rup_process on that thread, and put it in
+//               non-blocking mode.  One thread calling rup_process can
+//               then serve every peer of every socket it registered.  Each
+//               thread has a reactor of its own, and a registered socket
+//               must be closed on the thread that registered it.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Output: int - Returns 0 on success and -1 on failure.
+int rup_poll(int rfd);
+
+//
+// rup_process
+//
+// Description: Run the calling thread's reactor once.  Waits until one of
+//               its sockets has datagrams, a timer is due or timeout_ms
+//               has passed, then reads what arrived, sends due ACKs and
+//               retransmits, and hands each in order pkt to its socket's
+//               callback.
+//
+// Input: int timeout_ms - Longest wait in milliseconds, -1 for no limit
+//          and 0 to only do the work already pending.
+// Output: int count - Returns the number of pkts handed to callbacks plus
+//           those queued for rup_read, or -1 if nothing is registered.
+int rup_process(int timeout_ms);
+
+//
+// rup_setreuseport
+//
+// Description: Let several sockets bind the same port, the kernel then
+//               spreads the remote addresses over them so each socket
+//               only ever sees its own share of peers.  Call before
+//               rup_bind on every socket sharing the port.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int on - 1 to share the port, 0 for the default.
+// Output: int - Returns 0 on success and -1 on failure.
+int rup_setreuseport(int rfd, int on);
+
+//
+// rup_setaffinity
+//
+// Description: Pin the calling thread to one cpu.
+//
+// Input: int cpu - The cpu number, taken modulo the cpus online.
+// Output: int - Returns 0 on success and -1 on failure.
+int rup_setaffinity(int cpu);
+
+//
+// rup_cpus
+//
+// Description: Count the cpus online.
+//
+// Input: NA
+// Output: int - The number of cpus, at least 1.
+int rup_cpus();
+
+//
+// rup_serve
+//
+// Description: Serve a port from several cores.  Opens one socket per
+//               worker, all bound to portno with rup_setreuseport, and
+//               runs each in its own thread pinned to its own cpu with its
+//               own reactor, handing in order pkts to cb as rup_process
+//               does.  The kernel keeps each remote address on one socket,
+//               so every peer's session lives on one thread and workers
+//               share no state.  Returns once rup_stop has been called and
+//               every worker has closed its socket.  To set other options
+//               on the sockets, build the same loop from rup_setreuseport,
+//               rup_setaffinity, rup_poll and rup_process instead.
+//
+// Input: int portno - A port number to serve.
+// Input: int workers - The number of worker threads, 0 for one per cpu.
+// Input: rup_callback cb - Called on the worker's thread for each pkt.
+// Input: void* arg - Passed through to the callback.
+// Output: int - Returns 0 on success and -1 on failure.
+int rup_serve(int portno, int workers, rup_callback cb, void* arg);
+
+//
+// rup_stop
+//
+// Description: Make every rup_serve worker close its socket and return
+//               within RUP_SERVE_TICK milliseconds.  Safe to call from a
+//               callback or a signal handler.  A stop made before rup_serve
+//               is called makes it return at once, the stop is cleared when
+//               the last running rup_serve returns.
+//
+// Input: NA
+// Output: NA
+void rup_stop();
+
 //
 // createPkt
 //
@@ -143,6 +921,27 @@ int rup_read(int rfd, void* buf, int cc, struct sockaddr_in* from);
 // Output: struct pkt* - The pkt pointer of the newly created pkt is returned.
 struct pkt* createPkt(int cpId, char* cpCommand, struct sockaddr_in* cpClient, char* cpCName, char* cpCPassword, char* cpMsgbuf, char cpAckvar);
 
+//
+// freePkt
+//
+// Description: Hand back a pkt from createPkt so the thread's next
+//               createPkt can reuse it instead of allocating.  Deleting the
+//               pkt instead is still allowed.
+//
+// Input: struct pkt* p - The pkt, NULL is ignored.
+// Output: NA
+void freePkt(struct pkt* p);
+
+//
+// rup_getallocs
+//
+// Description: Report the heap use of RUP calls made by the calling thread:
+//               buffers allocated and freed, and those reused from a pool.
+//
+// Input: struct rup_allocinfo* info - Filled in with the counters.
+// Output: int - Returns 0 on success.
+int rup_getallocs(struct rup_allocinfo* info);
+
 //
 // performChecksum
 //
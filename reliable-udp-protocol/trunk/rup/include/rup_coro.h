@@ -0,0 +1,889 @@
+/* Filename:    rup_coro.h
+ * Description: C++20 coroutine layer for RUP.  Tasks run on schedulers,
+ *              each one thread driving its own rup_process reactor, and
+ *              co_await reads and writes that suspend the task instead of
+ *              blocking the thread.
+ */
+
+//////////////////////////////////////////////////////////////////////////////
+// Usage //                                                                 //
+///////////                                                                 //
+//  Write each transfer as a function returning rup::Task, open a           //
+//          rup::Socket inside it and co_await its read, write, readmsg,    //
+//          writemsg, flush and close.  Hand the tasks to a rup::Pool,      //
+//          one scheduler per cpu, then join it.  A socket belongs to the   //
+//          scheduler whose task opened it, and only tasks running there    //
+//          may use it.  Compile with -std=c++20 and link with -lpthread.   //
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __RUP_CORO_H
+#define __RUP_CORO_H
+
+#include "rup.h"
+
+#if defined(__cplusplus) && (__cplusplus >= 202002L) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define RUP_CORO
+#endif
+#endif
+
+#ifdef RUP_CORO
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Longest a scheduler sleeps in rup_process before it looks for tasks
+//   handed to it by other threads, in milliseconds
+#define RUP_CORO_TICK 10
+
+namespace rup
+{
+
+class Scheduler;
+class Socket;
+
+//
+// Task
+//
+// Description: A coroutine started with Scheduler::spawn or Pool::spawn.
+//               It runs on that scheduler's thread until it finishes, and
+//               nothing waits for its result.  A task never spawned is
+//               destroyed with its Task.
+//
+class Task
+{
+public:
+  struct promise_type
+  {
+    Scheduler* _sched = nullptr;
+
+    Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+    ~promise_type();
+  };
+
+  Task(Task&& t) noexcept : _h(std::exchange(t._h, nullptr)) {}
+  Task(const Task&) = delete;
+  Task& operator=(const Task&) = delete;
+  ~Task() { if(_h) _h.destroy(); }
+
+private:
+  friend class Scheduler;
+
+  explicit Task(std::coroutine_handle<promise_type> h) : _h(h) {}
+
+  std::coroutine_handle<promise_type> _h;
+};
+
+//
+// Scheduler
+//
+// Description: One thread running ready tasks and the thread's reactor in
+//               turn.  rup_process waits for datagrams and timers, and
+//               after each pass every suspended read, write and close is
+//               tried again on its socket.  Destroying a scheduler stops it.
+//
+class Scheduler
+{
+public:
+  explicit Scheduler(int cpu = -1);
+  ~Scheduler();
+  Scheduler(const Scheduler&) = delete;
+  Scheduler& operator=(const Scheduler&) = delete;
+
+  void spawn(Task t);
+  void join();
+  void stop();
+  static Scheduler* current();
+
+private:
+  friend class Socket;
+  friend struct Task::promise_type;
+  friend struct Sleep;
+
+  struct Timer
+  {
+    long long _at;
+    unsigned long long _seq;
+    std::coroutine_handle<> _h;
+
+    bool operator>(const Timer& t) const { return (_at != t._at) ? (_at > t._at) : (_seq > t._seq); }
+  };
+
+  void run();
+  void wake(std::coroutine_handle<> h) { _ready.push_back(h); }
+  void addTimer(long long at, std::coroutine_handle<> h) { _timers.push(Timer{at, _timerSeq++, h}); }
+  static long long now();
+  static Scheduler*& tls();
+
+  std::mutex _lock;
+  std::condition_variable _cond;
+  std::vector<std::coroutine_handle<>> _inbox;
+  bool _joining = false;
+  bool _stopping = false;
+  bool _teardown = false;
+  std::deque<std::coroutine_handle<>> _ready;
+  std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> _timers;
+  unsigned long long _timerSeq = 0;
+  std::vector<Socket*> _socks;
+  std::unordered_set<void*> _tasks;
+  int _cpu;
+  std::thread _thread;
+};
+
+//
+// Pool
+//
+// Description: A fixed set of schedulers, one per thread, each pinned to
+//               its own cpu.  Tasks are spread over them round robin.
+//
+class Pool
+{
+public:
+  explicit Pool(int threads = 0);
+
+  void spawn(Task t) { _scheds[_next++ % _scheds.size()]->spawn(std::move(t)); }
+  Scheduler& operator[](int i) { return *_scheds[i]; }
+  int size() const { return (int)_scheds.size(); }
+  void join() { for(auto& s : _scheds) s->join(); }
+  void stop() { for(auto& s : _scheds) s->stop(); }
+
+private:
+  std::vector<std::unique_ptr<Scheduler>> _scheds;
+  std::atomic<unsigned> _next{0};
+};
+
+// A pkt read with Socket::read, _ok is 0 if the socket was closed first
+struct Packet
+{
+  struct pkt _pkt;
+  struct sockaddr_in _from;
+  int _ok;
+};
+
+// Something a task waits on, tried again after each reactor pass
+struct Waiter
+{
+  std::coroutine_handle<> _h;
+
+  virtual ~Waiter() {}
+  virtual bool poll() = 0;
+  virtual void cancel() = 0;
+};
+
+//
+// Sleep
+//
+// Description: Awaitable returned by rup::sleep.
+//
+struct Sleep
+{
+  long long _us;
+
+  bool await_ready() const noexcept { return _us <= 0; }
+  void await_suspend(std::coroutine_handle<> h) { Scheduler::current()->addTimer(Scheduler::now() + _us, h); }
+  void await_resume() const noexcept {}
+};
+
+//
+// sleep
+//
+// Description: Suspend the calling task for a while without holding up its
+//               scheduler.
+//
+// Input: long long us - The time in microseconds.
+// Output: Sleep - Awaitable.
+inline Sleep sleep(long long us) { return Sleep{us}; }
+
+//
+// Socket
+//
+// Description: A RUP socket registered with the reactor of the scheduler
+//               whose task opens it.  Every call returns at once with an
+//               awaitable, and co_await suspends the task until the call
+//               can complete.  Reads and writes to one peer complete in
+//               the order they were awaited.  Closing the socket, or
+//               destroying it, fails the calls other tasks still await.
+//
+class Socket
+{
+public:
+  class Read;
+  class ReadPacket;
+  class ReadMsg;
+  class Write;
+  class Drain;
+
+  explicit Socket(int io = RUP_IO_CLASSIC);
+  ~Socket();
+  Socket(const Socket&) = delete;
+  Socket& operator=(const Socket&) = delete;
+
+  int fd() const { return _rfd; }
+  int bind(int portno) { return rup_bind(_rfd, portno); }
+
+  ReadPacket read();
+  Read read(struct pkt* buf, struct sockaddr_in* from);
+  Write write(const struct pkt& buf, const struct sockaddr_in& peer);
+  Write write(const void* buf, int cc, const struct sockaddr_in& peer);
+  ReadMsg readmsg(void* buf, int cap, struct sockaddr_in* from);
+  Write writemsg(const void* buf, int len, const struct sockaddr_in& peer);
+  Drain flush();
+  Drain close();
+
+private:
+  friend class Scheduler;
+
+  void service();
+  int waitMs(int timeout);
+  void closeNow();
+
+  int _rfd;
+  Scheduler* _sched;
+  std::deque<Waiter*> _reads;
+  std::deque<Waiter*> _msgReads;
+  std::deque<Waiter*> _writes;
+  std::deque<Waiter*> _drains;
+};
+
+//
+// Socket::Read
+//
+// Description: Awaitable for a pkt read into the caller's buffer, resumes
+//               with 1 once a pkt arrived and 0 if the socket was closed.
+//
+class Socket::Read : public Waiter
+{
+public:
+  Read(Socket* s, void* buf, int cc, struct sockaddr_in* from) : _s(s), _buf(buf), _cc(cc), _from(from), _ret(0) {}
+  Read(const Read&) = delete;
+
+  bool await_ready() { return (_s->_rfd < 0) || (_s->_reads.empty() && poll()); }
+  void await_suspend(std::coroutine_handle<> h) { _h = h; _s->_reads.push_back(this); }
+  int await_resume() const { return _ret; }
+
+  bool poll() override { _ret = (_s->_rfd >= 0) ? rup_read(_s->_rfd, _buf, _cc, _from) : 0; return _ret == 1; }
+  void cancel() override { _ret = 0; }
+
+protected:
+  Socket* _s;
+  void* _buf;
+  int _cc;
+  struct sockaddr_in* _from;
+  int _ret;
+};
+
+//
+// Socket::ReadPacket
+//
+// Description: Awaitable for a pkt read into a Packet of its own.
+//
+class Socket::ReadPacket : public Socket::Read
+{
+public:
+  explicit ReadPacket(Socket* s) : Read(s, &_p._pkt, sizeof(struct pkt), &_p._from) {}
+
+  Packet await_resume() { _p._ok = _ret; return _p; }
+
+private:
+  Packet _p;
+};
+
+//
+// Socket::ReadMsg
+//
+// Description: Awaitable for rup_readmsg, resumes with the message byte
+//               count and -1 if the socket was closed.
+//
+class Socket::ReadMsg : public Waiter
+{
+public:
+  ReadMsg(Socket* s, void* buf, int cap, struct sockaddr_in* from) : _s(s), _buf(buf), _cap(cap), _from(from), _ret(-1) {}
+  ReadMsg(const ReadMsg&) = delete;
+
+  bool await_ready() { return (_s->_rfd < 0) || (_s->_msgReads.empty() && poll()); }
+  void await_suspend(std::coroutine_handle<> h) { _h = h; _s->_msgReads.push_back(this); }
+  int await_resume() const { return _ret; }
+
+  bool poll() override { _ret = (_s->_rfd >= 0) ? rup_readmsg(_s->_rfd, _buf, _cap, _from) : -1; return _ret >= 0; }
+  void cancel() override { _ret = -1; }
+
+private:
+  Socket* _s;
+  void* _buf;
+  int _cap;
+  struct sockaddr_in* _from;
+  int _ret;
+};
+
+//
+// Socket::Write
+//
+// Description: Awaitable for a pkt or message write, resumes with 1 once
+//               it is in the peer's window and 0 if it can never be sent.
+//               A message larger than the window fails once the peer has
+//               nothing else in flight.
+//
+class Socket::Write : public Waiter
+{
+public:
+  Write(Socket* s, const void* buf, int len, const struct sockaddr_in& peer, int msg) : _s(s), _buf(buf), _len(len), _peer(peer), _msg(msg), _ret(0) {}
+  Write(const Write&) = delete;
+
+  bool await_ready()
+  {
+    if((_s->_rfd < 0) || (_len < 0) || (_len > (_msg ? RUP_MAXMSG : (int)sizeof(struct pkt))) || ((!_msg) && (_len == 0)))
+    {
+      return true;
+    }
+    return _s->_writes.empty() && poll();
+  }
+  void await_suspend(std::coroutine_handle<> h) { _h = h; _s->_writes.push_back(this); }
+  int await_resume() const { return _ret; }
+
+  bool poll() override;
+  void cancel() override { _ret = 0; }
+
+  const struct sockaddr_in& peer() const { return _peer; }
+
+private:
+  Socket* _s;
+  const void* _buf;
+  int _len;
+  struct sockaddr_in _peer;
+  int _msg;
+  int _ret;
+};
+
+//
+// Socket::Drain
+//
+// Description: Awaitable for flush and close.  Flush resumes once every
+//               frame sent has been acknowledged or its receiver given up
+//               on, close once the socket has also stopped lingering, and
+//               then closes it.
+//
+class Socket::Drain : public Waiter
+{
+public:
+  Drain(Socket* s, int closing) : _s(s), _closing(closing) {}
+  Drain(const Drain&) = delete;
+
+  bool await_ready() { return (_s->_rfd < 0) || poll(); }
+  void await_suspend(std::coroutine_handle<> h) { _h = h; _s->_drains.push_back(this); }
+  void await_resume() const noexcept {}
+
+  bool poll() override;
+  void cancel() override {}
+
+private:
+  Socket* _s;
+  int _closing;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Inline definitions                                                       //
+//////////////////////////////////////////////////////////////////////////////
+
+//
+// Task::promise_type::~promise_type
+//
+// Description: Forget a finished task so its scheduler can tell when none
+//               are left.
+//
+inline Task::promise_type::~promise_type()
+{
+  if(_sched != nullptr)
+  {
+    _sched->_tasks.erase(std::coroutine_handle<promise_type>::from_promise(*this).address());
+  }
+}
+
+inline Scheduler::Scheduler(int cpu) : _cpu(cpu)
+{
+  _thread = std::thread([this] { run(); });
+}
+
+inline Scheduler::~Scheduler()
+{
+  stop();
+}
+
+//
+// Scheduler::spawn
+//
+// Description: Start a task on this scheduler.  May be called from any
+//               thread.
+//
+// Input: Task t - The task.
+// Output: NA
+inline void Scheduler::spawn(Task t)
+{
+  // Variable declarations
+  std::coroutine_handle<Task::promise_type> h;
+
+  // Variable assignments
+  h = std::exchange(t._h, nullptr);
+  h.promise()._sched = this;
+
+  if(current() == this)
+  {
+    _tasks.insert(h.address());
+    _ready.push_back(h);
+    return;
+  }
+
+  std::lock_guard<std::mutex> g(_lock);
+  _inbox.push_back(h);
+  _cond.notify_one();
+}
+
+//
+// Scheduler::join
+//
+// Description: Wait until every task spawned here has finished, then end
+//               the thread.
+//
+// Input: NA
+// Output: NA
+inline void Scheduler::join()
+{
+  {
+    std::lock_guard<std::mutex> g(_lock);
+    _joining = true;
+    _cond.notify_one();
+  }
+  if(_thread.joinable())
+  {
+    _thread.join();
+  }
+}
+
+//
+// Scheduler::stop
+//
+// Description: End the thread within RUP_CORO_TICK milliseconds.  Tasks
+//               still suspended are destroyed on it, closing their sockets
+//               as rup_close does.
+//
+// Input: NA
+// Output: NA
+inline void Scheduler::stop()
+{
+  {
+    std::lock_guard<std::mutex> g(_lock);
+    _stopping = true;
+    _cond.notify_one();
+  }
+  if(_thread.joinable())
+  {
+    _thread.join();
+  }
+}
+
+inline Scheduler*& Scheduler::tls()
+{
+  static thread_local Scheduler* cur = nullptr;
+  return cur;
+}
+
+//
+// Scheduler::current
+//
+// Description: Find the scheduler running the calling thread.
+//
+// Input: NA
+// Output: Scheduler* - The scheduler, nullptr outside of one.
+inline Scheduler* Scheduler::current()
+{
+  return tls();
+}
+
+inline long long Scheduler::now()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//
+// Scheduler::run
+//
+// Description: The scheduler's thread.  Runs every ready task, then waits
+//               in rup_process, or for the next task when it has no
+//               sockets, no longer than the first timer.
+//
+// Input: NA
+// Output: NA
+inline void Scheduler::run()
+{
+  // Variable declarations
+  int timeout;
+  long long t;
+  std::vector<Socket*> socks;
+  std::vector<void*> left;
+  std::coroutine_handle<> h;
+
+  // Variable assignments
+  tls() = this;
+
+  if(_cpu >= 0)
+  {
+    rup_setaffinity(_cpu);
+  }
+
+  for(;;)
+  {
+    {
+      std::lock_guard<std::mutex> g(_lock);
+      for(auto& n : _inbox)
+      {
+        _tasks.insert(n.address());
+        _ready.push_back(n);
+      }
+      _inbox.clear();
+      if(_stopping || (_joining && _tasks.empty()))
+      {
+        break;
+      }
+    }
+
+    while(!_ready.empty())
+    {
+      h = _ready.front();
+      _ready.pop_front();
+      h.resume();
+    }
+
+    timeout = RUP_CORO_TICK;
+    if(!_timers.empty())
+    {
+      t = (_timers.top()._at - now() + 999) / 1000;
+      timeout = (t < timeout) ? ((t > 0) ? (int)t : 0) : timeout;
+    }
+    for(auto s : _socks)
+    {
+      timeout = s->waitMs(timeout);
+    }
+
+    // Without a socket rup_process has nothing to wait on
+    if(_socks.empty())
+    {
+      std::unique_lock<std::mutex> g(_lock);
+      _cond.wait_for(g, std::chrono::milliseconds(timeout), [this] { return (!_inbox.empty()) || _stopping || (_joining && _tasks.empty()); });
+    }
+    else
+    {
+      rup_process(timeout);
+    }
+
+    t = now();
+    while((!_timers.empty()) && (_timers.top()._at <= t))
+    {
+      _ready.push_back(_timers.top()._h);
+      _timers.pop();
+    }
+
+    // A close in one socket's service leaves the others in place
+    socks = _socks;
+    for(auto s : socks)
+    {
+      s->service();
+    }
+  }
+
+  // Destroy what never finished, its sockets close with it
+  _teardown = true;
+  left.assign(_tasks.begin(), _tasks.end());
+  for(auto p : left)
+  {
+    std::coroutine_handle<>::from_address(p).destroy();
+  }
+  tls() = nullptr;
+}
+
+inline Pool::Pool(int threads)
+{
+  // Variable declarations
+  int i;
+
+  // Variable assignments
+  threads = (threads > 0) ? threads : rup_cpus();
+
+  for(i = 0;i < threads;++i)
+  {
+    _scheds.emplace_back(new Scheduler(i));
+  }
+}
+
+//
+// Socket::Socket
+//
+// Description: Open a socket and register it with the calling task's
+//               scheduler.  Must be called from a task.
+//
+// Input: int io - RUP_IO_CLASSIC or RUP_IO_URING, as for rup_openio.
+inline Socket::Socket(int io)
+{
+  _sched = Scheduler::current();
+  if(_sched == nullptr)
+  {
+    printf("rup::Socket must be opened by a task\n");
+    exit(0);
+  }
+
+  _rfd = rup_openio(io);
+  rup_poll(_rfd);
+  _sched->_socks.push_back(this);
+}
+
+inline Socket::~Socket()
+{
+  if(_rfd >= 0)
+  {
+    closeNow();
+  }
+}
+
+inline Socket::ReadPacket Socket::read()
+{
+  return ReadPacket(this);
+}
+
+inline Socket::Read Socket::read(struct pkt* buf, struct sockaddr_in* from)
+{
+  return Read(this, buf, sizeof(struct pkt), from);
+}
+
+inline Socket::Write Socket::write(const struct pkt& buf, const struct sockaddr_in& peer)
+{
+  return Write(this, &buf, sizeof(struct pkt), peer, 0);
+}
+
+inline Socket::Write Socket::write(const void* buf, int cc, const struct sockaddr_in& peer)
+{
+  return Write(this, buf, cc, peer, 0);
+}
+
+inline Socket::ReadMsg Socket::readmsg(void* buf, int cap, struct sockaddr_in* from)
+{
+  return ReadMsg(this, buf, cap, from);
+}
+
+inline Socket::Write Socket::writemsg(const void* buf, int len, const struct sockaddr_in& peer)
+{
+  return Write(this, buf, len, peer, 1);
+}
+
+inline Socket::Drain Socket::flush()
+{
+  return Drain(this, 0);
+}
+
+inline Socket::Drain Socket::close()
+{
+  return Drain(this, 1);
+}
+
+//
+// Socket::service
+//
+// Description: Try the calls waiting on this socket again after a reactor
+//               pass and resume those that completed.  A write to a peer
+//               whose window is full holds back the later writes to that
+//               peer only.
+//
+// Input: NA
+// Output: NA
+inline void Socket::service()
+{
+  // Variable declarations
+  std::deque<Waiter*> keep, waiting;
+  std::vector<struct sockaddr_in> full;
+  Write* w;
+  int blocked;
+
+  while((!_reads.empty()) && _reads.front()->poll())
+  {
+    _sched->wake(_reads.front()->_h);
+    _reads.pop_front();
+  }
+  while((!_msgReads.empty()) && _msgReads.front()->poll())
+  {
+    _sched->wake(_msgReads.front()->_h);
+    _msgReads.pop_front();
+  }
+
+  for(auto x : _writes)
+  {
+    w = static_cast<Write*>(x);
+    blocked = 0;
+    for(auto& a : full)
+    {
+      if((a.sin_addr.s_addr == w->peer().sin_addr.s_addr) && (a.sin_port == w->peer().sin_port))
+      {
+        blocked = 1;
+        break;
+      }
+    }
+    if(blocked)
+    {
+      keep.push_back(w);
+    }
+    else if(w->poll())
+    {
+      _sched->wake(w->_h);
+    }
+    else
+    {
+      full.push_back(w->peer());
+      keep.push_back(w);
+    }
+  }
+  _writes.swap(keep);
+
+  // A finished close ends the socket, and the other drains with it
+  keep.clear();
+  waiting.swap(_drains);
+  for(auto x : waiting)
+  {
+    if(_rfd < 0)
+    {
+      _sched->wake(x->_h);
+    }
+    else if(x->poll())
+    {
+      _sched->wake(x->_h);
+    }
+    else
+    {
+      keep.push_back(x);
+    }
+  }
+  _drains.swap(keep);
+}
+
+//
+// Socket::waitMs
+//
+// Description: Shorten the scheduler's wait so a lingering close is
+//               finished on time, ACKs wake it for everything else.
+//
+// Input: int timeout - The wait so far in milliseconds.
+// Output: int - The wait in milliseconds.
+inline int Socket::waitMs(int timeout)
+{
+  // Variable declarations
+  long long t;
+
+  if(_drains.empty() || (rup_pending(_rfd, NULL) != 0))
+  {
+    return timeout;
+  }
+  t = (rup_linger(_rfd) + 999) / 1000;
+  return (t < timeout) ? (int)t : timeout;
+}
+
+//
+// Socket::closeNow
+//
+// Description: Close the socket now, waiting as rup_close does, and fail
+//               the calls other tasks still await on it.
+//
+// Input: NA
+// Output: NA
+inline void Socket::closeNow()
+{
+  rup_close(_rfd);
+  _rfd = -1;
+
+  for(auto it = _sched->_socks.begin();it != _sched->_socks.end();++it)
+  {
+    if(*it == this)
+    {
+      _sched->_socks.erase(it);
+      break;
+    }
+  }
+
+  // The tasks behind the waiters are gone when the scheduler tears down
+  if(!_sched->_teardown)
+  {
+    for(auto q : {&_reads, &_msgReads, &_writes, &_drains})
+    {
+      for(auto x : *q)
+      {
+        x->cancel();
+        _sched->wake(x->_h);
+      }
+      q->clear();
+    }
+  }
+}
+
+//
+// Socket::Write::poll
+//
+// Description: Try the write.  A message that fails with nothing in flight
+//               to its peer does not fit the window and never will.
+//
+// Input: NA
+// Output: bool - True once the write is done.
+inline bool Socket::Write::poll()
+{
+  if(_s->_rfd < 0)
+  {
+    _ret = 0;
+    return true;
+  }
+  if(!_msg)
+  {
+    _ret = rup_write(_s->_rfd, (void*)_buf, _len, &_peer);
+    return _ret == 1;
+  }
+  _ret = rup_writemsg(_s->_rfd, (void*)_buf, _len, &_peer);
+  return (_ret == 1) || (rup_pending(_s->_rfd, &_peer) == 0);
+}
+
+//
+// Socket::Drain::poll
+//
+// Description: Check whether the socket has drained, and close it if that
+//               is what was asked.
+//
+// Input: NA
+// Output: bool - True once the flush or close is done.
+inline bool Socket::Drain::poll()
+{
+  if(rup_pending(_s->_rfd, NULL) != 0)
+  {
+    return false;
+  }
+  if(_closing)
+  {
+    if(rup_linger(_s->_rfd) != 0)
+    {
+      return false;
+    }
+    _s->closeNow();
+  }
+  return true;
+}
+
+}
+
+#endif
+
+#endif
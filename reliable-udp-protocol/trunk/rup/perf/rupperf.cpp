@@ -0,0 +1,1097 @@
+/* Filename:    rupperf.cpp
+ * Description: Throughput and latency benchmark for RUP.  Runs reactor
+ *              server workers and client threads in one process over
+ *              loopback and reports messages/sec, goodput and latency
+ *              percentiles for each payload size, client count, I/O
+ *              backend, congestion controller, system call batching and
+ *              offload asked for, with the CPU time spent per gigabyte,
+ *              as JSON.  Can instead time the checksum engines.
+ *              Linux only.
+ *
+ * Usage:       make perf && bin/rupperf > results.json
+ *              bin/rupperf -h lists the options.
+ */
+
+#include "../include/rup.h"
+#include <time.h>
+#include <getopt.h>
+#include <sys/resource.h>
+
+// Defines
+#define PERF_ECHO 1
+#define PERF_STREAM 2
+#define PERF_SYNC 3
+#define PERF_CONTROL 4
+#define PERF_HOL 5
+#define PERF_WRITE 6
+#define PERF_HDRSIZE 24
+#define PERF_MAXLIST 16
+#define PERF_WARMUP 50
+#define PERF_MAXWORKERS 64
+#define PERF_CKSUMTIME 200000
+#define PERF_CTLEVERY 8
+#define PERF_BULKSTREAM 1
+#define PERF_CTLSTREAM 2
+
+// What to run: every combination of the lists is one result
+struct perfConfig
+{
+  int _modes[PERF_MAXLIST];
+  int _nmodes;
+  int _sizes[PERF_MAXLIST];
+  int _nsizes;
+  int _clients[PERF_MAXLIST];
+  int _nclients;
+  int _ios[PERF_MAXLIST];
+  int _nios;
+  int _ccs[PERF_MAXLIST];
+  int _nccs;
+  int _batches[PERF_MAXLIST];
+  int _nbatches;
+  int _offloads[PERF_MAXLIST];
+  int _noffloads;
+  int _count;
+  int _window;
+  int _workers;
+  int _port;
+  int _impaired;
+  struct rup_impair _impair;
+  int _checksum;
+};
+
+// Server side of the runs with one I/O backend, congestion controller,
+//   batching and offload:
+//   a reactor thread and socket per worker sharing the port, and the
+//   one-way latencies they measured of streamed messages
+struct perfServer
+{
+  struct perfConfig* _cfg;
+  int _io;
+  int _ioUsed;
+  int _cc;
+  int _batch;
+  int _offload;
+  int _offloadUsed;
+  int _maxSize;
+  volatile int _stop;
+  volatile int _ready;
+  pthread_t _threads[PERF_MAXWORKERS];
+  long long* _oneWay;
+  volatile int _nOneWay;
+  int _capOneWay;
+};
+
+// One client thread of a run and what it measured
+struct perfClient
+{
+  struct perfConfig* _cfg;
+  struct perfServer* _srv;
+  pthread_barrier_t* _barrier;
+  int _id;
+  int _mode;
+  int _size;
+  long long* _rtt;
+  int _nrtt;
+  long long _start;
+  long long _end;
+  long long _retransmits;
+  long long _timeouts;
+  long long _allocs;
+  long long _frameRtt;
+  long long _frameRtts;
+  int _ok;
+};
+
+// Function prototypes
+long long perfNow();
+double perfCpu();
+void perfPut(unsigned char* b, int type, int client, int seq, long long stamp);
+int perfType(unsigned char* b);
+long long perfStamp(unsigned char* b);
+int perfList(const char* arg, int* list, const char** names, int nnames);
+int perfOpts(int fd, struct perfServer* srv);
+int perfStart(struct perfServer* srv);
+void perfStop(struct perfServer* srv);
+void* perfWorker(void* arg);
+void perfReply(int fd, void* buf, int len, struct sockaddr_in* from);
+void* perfClientRun(void* arg);
+int perfCompare(const void* a, const void* b);
+long long perfPercentile(long long* v, int n, double p);
+int perfRun(FILE* out, struct perfConfig* cfg, struct perfServer* srv, int mode, int size, int clients, int first);
+int perfBitSum(struct pkt* p);
+unsigned int perfSum(int engine, struct pkt* p);
+void perfChecksum(FILE* out);
+void perfUsage();
+
+static const char* perfModeNames[] = { "", "echo", "stream", "", "control", "hol", "write" };
+static const char* perfIoNames[] = { "classic", "uring" };
+static const char* perfCcNames[] = { "none", "newreno", "delay" };
+static const char* perfBatchNames[] = { "off", "on" };
+static const char* perfOffloadNames[] = { "none", "gso", "gro", "gso+gro" };
+static const char* perfSumNames[] = { "bitwise", "performChecksum", "popcount", "crc32c", "crc32c_soft" };
+
+//
+// perfNow
+//
+// Description: Read the monotonic clock.
+//
+// Input: NA
+// Output: long long - The time in microseconds.
+long long perfNow()
+{
+	// Variable declarations
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+//
+// perfCpu
+//
+// Description: Read the CPU time of the whole process, server workers and
+//                clients alike, user and system.
+//
+// Input: NA
+// Output: double - The time in seconds.
+double perfCpu()
+{
+	// Variable declarations
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+//
+// perfPut
+//
+// Description: Write the header every benchmark message starts with: its
+//                type, client, sequence number and send time.  Both ends
+//                are in this process, so it stays in host byte order.
+//
+// Input: unsigned char* b - The message.
+// Input: int type - PERF_ECHO, PERF_STREAM, PERF_SYNC or PERF_CONTROL.
+// Input: int client - The client number.
+// Input: int seq - The message number.
+// Input: long long stamp - The send time in microseconds.
+// Output: NA
+void perfPut(unsigned char* b, int type, int client, int seq, long long stamp)
+{
+	memcpy(b, &type, 4);
+	memcpy(b + 4, &client, 4);
+	memcpy(b + 8, &seq, 4);
+	memset(b + 12, 0, 4);
+	memcpy(b + 16, &stamp, 8);
+}
+
+//
+// perfType
+//
+// Description: Read the type of a message.
+//
+// Input: unsigned char* b - The message.
+// Output: int - PERF_ECHO, PERF_STREAM, PERF_SYNC or PERF_CONTROL.
+int perfType(unsigned char* b)
+{
+	// Variable declarations
+	int type;
+
+	memcpy(&type, b, 4);
+	return type;
+}
+
+//
+// perfStamp
+//
+// Description: Read the send time of a message.
+//
+// Input: unsigned char* b - The message.
+// Output: long long - The send time in microseconds.
+long long perfStamp(unsigned char* b)
+{
+	// Variable declarations
+	long long stamp;
+
+	memcpy(&stamp, b + 16, 8);
+	return stamp;
+}
+
+//
+// perfList
+//
+// Description: Parse a comma separated list of numbers, or of names when
+//                names are given, each stored as its index.
+//
+// Input: const char* arg - The list.
+// Input: int* list - Filled in with up to PERF_MAXLIST values.
+// Input: const char** names - The names allowed, NULL for numbers.
+// Input: int nnames - The number of names.
+// Output: int - Returns the number of values, -1 on a bad entry.
+int perfList(const char* arg, int* list, const char** names, int nnames)
+{
+	// Variable declarations
+	int i, n, len;
+	const char* end;
+
+	// Variable assignments
+	n = 0;
+
+	while((*arg != '\0') && (n < PERF_MAXLIST))
+	{
+		end = strchr(arg, ',');
+		len = (end != NULL) ? (int)(end - arg) : (int)strlen(arg);
+		if(names == NULL)
+		{
+			list[n] = atoi(arg);
+			if(list[n] <= 0)
+			{
+				return -1;
+			}
+		}
+		else
+		{
+			for(i = 0;i < nnames;++i)
+			{
+				if((names[i][0] != '\0') && ((int)strlen(names[i]) == len) && (strncmp(arg, names[i], len) == 0))
+				{
+					break;
+				}
+			}
+			if(i == nnames)
+			{
+				return -1;
+			}
+			list[n] = i;
+		}
+		++n;
+		arg += (end != NULL) ? len + 1 : len;
+	}
+	return n;
+}
+
+//
+// perfOpts
+//
+// Description: Set the options of a run on a socket, client or server.
+//
+// Input: int fd - A valid RUP file descriptor.
+// Input: struct perfServer* srv - The server, its configuration,
+//          controller, batching and offload set.
+// Output: int - The offloads the kernel granted.
+int perfOpts(int fd, struct perfServer* srv)
+{
+	rup_setwindow(fd, srv->_cfg->_window);
+	rup_setcongestion(fd, srv->_cc);
+	rup_setbatch(fd, srv->_batch);
+	if(srv->_cfg->_impaired)
+	{
+		rup_setimpair(fd, &srv->_cfg->_impair);
+	}
+	return rup_setoffload(fd, srv->_offload);
+}
+
+//
+// perfStart
+//
+// Description: Start the server workers for one I/O backend, congestion
+//                controller, batching and offload, and wait until every
+//                one has bound the port.
+//
+// Input: struct perfServer* srv - The server, its configuration, backend,
+//          controller, batching and offload set.
+// Output: int - Returns 0 on success and -1 on failure.
+int perfStart(struct perfServer* srv)
+{
+	// Variable declarations
+	int i;
+
+	// Variable assignments
+	srv->_stop = 0;
+	srv->_ready = 0;
+	srv->_ioUsed = srv->_io;
+	srv->_offloadUsed = srv->_offload;
+
+	for(i = 0;i < srv->_cfg->_workers;++i)
+	{
+		if(pthread_create(&srv->_threads[i], NULL, perfWorker, srv) != 0)
+		{
+			return -1;
+		}
+	}
+	while(srv->_ready < srv->_cfg->_workers)
+	{
+		usleep(1000);
+	}
+	return 0;
+}
+
+//
+// perfStop
+//
+// Description: Make the server workers close their sockets and wait for
+//                them to return.
+//
+// Input: struct perfServer* srv - The server.
+// Output: NA
+void perfStop(struct perfServer* srv)
+{
+	// Variable declarations
+	int i;
+
+	srv->_stop = 1;
+	for(i = 0;i < srv->_cfg->_workers;++i)
+	{
+		pthread_join(srv->_threads[i], NULL);
+	}
+}
+
+//
+// perfWorker
+//
+// Description: Serve the benchmark port from a reactor of its own until
+//                told to stop: echo requests, syncs and control messages
+//                back on the stream they came on, and time the streamed
+//                messages from their send stamps.
+//
+// Input: void* arg - The server.
+// Output: void* - NULL.
+void* perfWorker(void* arg)
+{
+	// Variable declarations
+	int fd, n, idx, offload, stream;
+	struct perfServer* srv;
+	unsigned char* buf;
+	struct sockaddr_in from;
+
+	// Variable assignments
+	srv = (struct perfServer*)arg;
+	buf = new unsigned char[srv->_maxSize];
+	fd = rup_openio(srv->_io);
+
+	if(rup_getio(fd) != srv->_io)
+	{
+		srv->_ioUsed = rup_getio(fd);
+	}
+	offload = perfOpts(fd, srv);
+	if(offload != srv->_offload)
+	{
+		srv->_offloadUsed = offload;
+	}
+	rup_setreuseport(fd, 1);
+	if((rup_bind(fd, srv->_cfg->_port) != 0) || (rup_poll(fd) != 0))
+	{
+		printf("rupperf: cannot serve port %d\n", srv->_cfg->_port);
+		exit(0);
+	}
+	__sync_fetch_and_add(&srv->_ready, 1);
+
+	while(!srv->_stop)
+	{
+		rup_process(RUP_SERVE_TICK);
+		stream = RUP_ANYSTREAM;
+		while((n = rup_readstream(fd, &stream, buf, srv->_maxSize, &from)) > 0)
+		{
+			if(perfType(buf) == PERF_STREAM)
+			{
+				idx = __sync_fetch_and_add(&srv->_nOneWay, 1);
+				if(idx < srv->_capOneWay)
+				{
+					srv->_oneWay[idx] = perfNow() - perfStamp(buf);
+				}
+			}
+			else
+			{
+				rup_setstream(fd, stream);
+				perfReply(fd, buf, (perfType(buf) == PERF_SYNC) ? PERF_HDRSIZE : n, &from);
+			}
+			stream = RUP_ANYSTREAM;
+		}
+
+		// Pkts sent with rup_write are acknowledged as they arrive and
+		//   only need taking off the socket
+		while(rup_read(fd, buf, srv->_maxSize, &from) == 1)
+		{
+		}
+	}
+
+	rup_close(fd);
+	delete [] buf;
+	return NULL;
+}
+
+//
+// perfReply
+//
+// Description: Send a message back from a worker.  The reactor socket does
+//                not block, so a reply the window cannot take at once is
+//                sent blocking instead.
+//
+// Input: int fd - The worker's socket.
+// Input: void* buf - The message.
+// Input: int len - The message byte count.
+// Input: struct sockaddr_in* from - The client.
+// Output: NA
+void perfReply(int fd, void* buf, int len, struct sockaddr_in* from)
+{
+	if(rup_writemsg(fd, buf, len, from))
+	{
+		return;
+	}
+	rup_setnonblock(fd, 0);
+	rup_writemsg(fd, buf, len, from);
+	rup_setnonblock(fd, 1);
+}
+
+//
+// perfClientRun
+//
+// Description: One client of a run.  Connects, warms up, then either times
+//                count request and reply round trips (echo) or sends count
+//                messages back to back and waits for a sync to come back
+//                behind them (stream).  The control modes stream on one
+//                stream, and after every PERF_CTLEVERY messages time the
+//                round trip of a small control message on another (control)
+//                or on the same stream behind them (hol).  Write times
+//                count rup_write calls without a window, each of which
+//                returns once its pkt is acknowledged.
+//
+// Input: void* arg - The client.
+// Output: void* - NULL.
+void* perfClientRun(void* arg)
+{
+	// Variable declarations
+	int fd, i, count, stream;
+	long long t0;
+	struct perfClient* c;
+	struct sockaddr_in to;
+	struct rup_stats stats;
+	struct rup_allocinfo allocs;
+	unsigned char* buf;
+
+	// Variable assignments
+	c = (struct perfClient*)arg;
+	count = c->_cfg->_count;
+	buf = new unsigned char[c->_srv->_maxSize];
+	memset((char*)buf,'r',c->_srv->_maxSize);
+	memset((char*)&to,0,sizeof(to));
+	to.sin_family = AF_INET;
+	to.sin_port = htons(c->_cfg->_port);
+	to.sin_addr.s_addr = inet_addr("127.0.0.1");
+	fd = rup_openio(c->_srv->_io);
+	perfOpts(fd, c->_srv);
+	c->_ok = 1;
+
+	if(rup_connect(fd, &to) != 0)
+	{
+		c->_ok = 0;
+	}
+	for(i = 0;(c->_ok) && (i < PERF_WARMUP);++i)
+	{
+		perfPut(buf, PERF_ECHO, c->_id, -1, perfNow());
+		if((!rup_writemsg(fd, buf, c->_size, &to)) || (rup_readmsg(fd, buf, c->_srv->_maxSize, NULL) <= 0))
+		{
+			c->_ok = 0;
+		}
+	}
+
+	pthread_barrier_wait(c->_barrier);
+	if(c->_mode == PERF_WRITE)
+	{
+		rup_setwindow(fd, 1);
+	}
+	else if(c->_mode != PERF_ECHO)
+	{
+		rup_setstream(fd, PERF_BULKSTREAM);
+	}
+
+	// Once warm the socket only reuses its buffers, anything the timed
+	//   part allocates fails the run
+	rup_getallocs(&allocs);
+	c->_allocs = -allocs._allocs;
+	c->_start = perfNow();
+	for(i = 0;(c->_ok) && (i < count);++i)
+	{
+		t0 = perfNow();
+		perfPut(buf, (c->_mode == PERF_ECHO) ? PERF_ECHO : PERF_STREAM, c->_id, i, t0);
+		if(c->_mode == PERF_WRITE)
+		{
+			if(!rup_write(fd, buf, c->_size, &to))
+			{
+				c->_ok = 0;
+			}
+			else
+			{
+				c->_rtt[c->_nrtt++] = perfNow() - t0;
+			}
+		}
+		else if(!rup_writemsg(fd, buf, c->_size, &to))
+		{
+			c->_ok = 0;
+		}
+		else if(c->_mode == PERF_ECHO)
+		{
+			if(rup_readmsg(fd, buf, c->_srv->_maxSize, NULL) <= 0)
+			{
+				c->_ok = 0;
+			}
+			else
+			{
+				c->_rtt[c->_nrtt++] = perfNow() - t0;
+			}
+		}
+		else if((c->_mode != PERF_STREAM) && (i % PERF_CTLEVERY == PERF_CTLEVERY - 1))
+		{
+			// The reply comes back on the stream the message went on
+			stream = (c->_mode == PERF_CONTROL) ? PERF_CTLSTREAM : PERF_BULKSTREAM;
+			rup_setstream(fd, stream);
+			t0 = perfNow();
+			perfPut(buf, PERF_CONTROL, c->_id, i, t0);
+			if((!rup_writemsg(fd, buf, PERF_HDRSIZE, &to)) || (rup_readstream(fd, &stream, buf, c->_srv->_maxSize, NULL) <= 0))
+			{
+				c->_ok = 0;
+			}
+			else
+			{
+				c->_rtt[c->_nrtt++] = perfNow() - t0;
+			}
+			rup_setstream(fd, PERF_BULKSTREAM);
+		}
+	}
+
+	// The sync is read after every message before it on the connection
+	if((c->_ok) && (c->_mode != PERF_ECHO) && (c->_mode != PERF_WRITE))
+	{
+		perfPut(buf, PERF_SYNC, c->_id, count, perfNow());
+		if((!rup_writemsg(fd, buf, PERF_HDRSIZE, &to)) || (rup_readmsg(fd, buf, c->_srv->_maxSize, NULL) <= 0))
+		{
+			c->_ok = 0;
+		}
+	}
+	c->_end = perfNow();
+	rup_getallocs(&allocs);
+	c->_allocs += allocs._allocs;
+
+	rup_getstats(fd, &stats);
+	for(i = 0;i < RUP_PRIMS;++i)
+	{
+		c->_retransmits += stats._retransmits[i];
+	}
+	c->_timeouts = stats._timeouts;
+	c->_frameRtt = stats._rtt._sum;
+	c->_frameRtts = stats._rtt._count;
+	rup_close(fd);
+	delete [] buf;
+	return NULL;
+}
+
+//
+// perfCompare
+//
+// Description: Order two latencies for qsort.
+//
+// Input: const void* a - The first.
+// Input: const void* b - The second.
+// Output: int - Negative, zero or positive as a is below, equal or above b.
+int perfCompare(const void* a, const void* b)
+{
+	// Variable declarations
+	long long x, y;
+
+	// Variable assignments
+	x = *(const long long*)a;
+	y = *(const long long*)b;
+
+	return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+//
+// perfPercentile
+//
+// Description: The smallest sample at or above a fraction of a sorted set
+//                (nearest rank).
+//
+// Input: long long* v - The sorted samples.
+// Input: int n - The sample count.
+// Input: double p - The fraction, 0 to 1.
+// Output: long long - The sample, 0 for an empty set.
+long long perfPercentile(long long* v, int n, double p)
+{
+	// Variable declarations
+	int rank;
+
+	if(n == 0)
+	{
+		return 0;
+	}
+
+	// Variable assignments
+	rank = (int)(p * n + 0.999999);
+
+	rank = (rank < 1) ? 1 : ((rank > n) ? n : rank);
+	return v[rank - 1];
+}
+
+//
+// perfRun
+//
+// Description: Run one combination of mode, payload size and client count
+//                against a started server, and write its JSON result and
+//                a summary line on stderr.
+//
+// Input: FILE* out - Where the JSON goes.
+// Input: struct perfConfig* cfg - The benchmark configuration.
+// Input: struct perfServer* srv - The server.
+// Input: int mode - PERF_ECHO, PERF_STREAM, PERF_CONTROL, PERF_HOL or
+//          PERF_WRITE.
+// Input: int size - The message byte count, cut to a pkt for PERF_WRITE.
+// Input: int clients - The number of client threads.
+// Input: int first - Nonzero for the first result of the report.
+// Output: int ok - Returns 1 if every client finished and 0 otherwise.
+int perfRun(FILE* out, struct perfConfig* cfg, struct perfServer* srv, int mode, int size, int clients, int first)
+{
+	// Variable declarations
+	int i, n, ok;
+	long long start, end, retransmits, timeouts, allocs, frameRtt, frameRtts, bytes;
+	long long* lat;
+	double secs, msgs, cpu;
+	const char* kind;
+	pthread_t* threads;
+	pthread_barrier_t barrier;
+	struct perfClient* c;
+
+	// Variable assignments
+	c = new struct perfClient[clients];
+	threads = new pthread_t[clients];
+	lat = new long long[clients * cfg->_count];
+	n = 0;
+	ok = 1;
+	retransmits = 0;
+	timeouts = 0;
+	allocs = 0;
+	frameRtt = 0;
+	frameRtts = 0;
+	srv->_nOneWay = 0;
+	cpu = perfCpu();
+	pthread_barrier_init(&barrier, NULL, clients);
+
+	// A write carries a single pkt
+	if((mode == PERF_WRITE) && (size > (int)sizeof(struct pkt)))
+	{
+		size = sizeof(struct pkt);
+	}
+
+	for(i = 0;i < clients;++i)
+	{
+		memset((char*)&c[i],0,sizeof(struct perfClient));
+		c[i]._cfg = cfg;
+		c[i]._srv = srv;
+		c[i]._barrier = &barrier;
+		c[i]._id = i;
+		c[i]._mode = mode;
+		c[i]._size = size;
+		c[i]._rtt = lat + i * cfg->_count;
+		pthread_create(&threads[i], NULL, perfClientRun, &c[i]);
+	}
+
+	start = 0;
+	end = 0;
+	for(i = 0;i < clients;++i)
+	{
+		pthread_join(threads[i], NULL);
+		start = ((i == 0) || (c[i]._start < start)) ? c[i]._start : start;
+		end = (c[i]._end > end) ? c[i]._end : end;
+		retransmits += c[i]._retransmits;
+		timeouts += c[i]._timeouts;
+		allocs += c[i]._allocs;
+		frameRtt += c[i]._frameRtt;
+		frameRtts += c[i]._frameRtts;
+		ok &= c[i]._ok;
+	}
+	ok &= (allocs == 0);
+	cpu = perfCpu() - cpu;
+
+	// One-way delivery times of stream, round trips of the rest
+	if(mode != PERF_STREAM)
+	{
+		for(i = 0;i < clients;++i)
+		{
+			memmove(lat + n, c[i]._rtt, c[i]._nrtt * sizeof(long long));
+			n += c[i]._nrtt;
+		}
+	}
+	else
+	{
+		n = (srv->_nOneWay < srv->_capOneWay) ? srv->_nOneWay : srv->_capOneWay;
+		memcpy(lat, srv->_oneWay, n * sizeof(long long));
+	}
+	qsort(lat, n, sizeof(long long), perfCompare);
+
+	secs = (end > start) ? (end - start) / 1e6 : 1e-6;
+	msgs = (double)clients * cfg->_count;
+	bytes = (long long)msgs * size * ((mode == PERF_ECHO) ? 2 : 1);
+	kind = (mode == PERF_ECHO) ? "rtt" : ((mode == PERF_STREAM) ? "one_way" : ((mode == PERF_WRITE) ? "write_call" : "control_rtt"));
+
+	fprintf(out, "%s    {\"mode\": \"%s\", \"io\": \"%s\", \"cc\": \"%s\", \"batch\": \"%s\", \"offload\": \"%s\", \"size\": %d, \"clients\": %d, "
+		"\"messages\": %.0f, \"ok\": %s, \"seconds\": %.6f, \"msgs_per_sec\": %.1f, \"goodput_MBps\": %.3f, \"cpu_s\": %.3f, "
+		"\"cpu_s_per_GB\": %.3f, \"retransmits\": %lld, \"timeouts\": %lld, \"allocs\": %lld, \"frame_rtt_us\": %.1f, "
+		"\"latency_us\": {\"kind\": \"%s\", \"samples\": %d, \"p50\": %lld, \"p90\": %lld, \"p99\": %lld, \"p999\": %lld, \"max\": %lld}}",
+		(first) ? "" : ",\n", perfModeNames[mode], perfIoNames[srv->_ioUsed], perfCcNames[srv->_cc], perfBatchNames[srv->_batch],
+		perfOffloadNames[srv->_offloadUsed], size, clients, msgs, (ok) ? "true" : "false", secs, msgs / secs, bytes / secs / 1e6, cpu,
+		cpu / (bytes / 1e9), retransmits, timeouts, allocs, (frameRtts > 0) ? (double)frameRtt / frameRtts : 0.0,
+		kind, n, perfPercentile(lat, n, 0.5), perfPercentile(lat, n, 0.9), perfPercentile(lat, n, 0.99),
+		perfPercentile(lat, n, 0.999), (n > 0) ? lat[n - 1] : 0);
+	fflush(out);
+
+	fprintf(stderr, "%-7s %-7s %-7s %-3s %-7s %7d B %3d clients  %10.0f msg/s %9.2f MB/s %7.2f cpu s/GB  p50 %6lld  p90 %6lld  p99 %6lld  p99.9 %6lld us  rexmit %lld%s%s\n",
+		perfModeNames[mode], perfIoNames[srv->_ioUsed], perfCcNames[srv->_cc], perfBatchNames[srv->_batch], perfOffloadNames[srv->_offloadUsed],
+		size, clients, msgs / secs, bytes / secs / 1e6, cpu / (bytes / 1e9), perfPercentile(lat, n, 0.5), perfPercentile(lat, n, 0.9),
+		perfPercentile(lat, n, 0.99), perfPercentile(lat, n, 0.999), retransmits,
+		(allocs == 0) ? "" : "  ALLOCATED", (ok) ? "" : "  FAILED");
+
+	pthread_barrier_destroy(&barrier);
+	delete [] lat;
+	delete [] threads;
+	delete [] c;
+	return ok;
+}
+
+//
+// perfBitSum
+//
+// Description: The checksum performChecksum computed before the engines
+//                were added, every bit of the pkt payload counted one at a
+//                time, kept here as the baseline they are compared to.
+//
+// Input: struct pkt* p - The pkt.
+// Output: int result - The number of one bits in the payload.
+int perfBitSum(struct pkt* p)
+{
+	// Variable declarations
+	int i, j, result;
+	char c;
+
+	// Variable assignments
+	result = 0;
+
+	for(i = 0;i < BUFSIZE;++i)
+	{
+		c = p->_msgbuf[i];
+		for(j = 0;j < ((int)sizeof(char)*8);++j)
+		{
+			if(c & (1<<j))
+			{
+				result++;
+			}
+		}
+	}
+	return result;
+}
+
+//
+// perfSum
+//
+// Description: Run one checksum engine over the payload of a pkt.
+//
+// Input: int engine - An index into perfSumNames.
+// Input: struct pkt* p - The pkt.
+// Output: unsigned int - The checksum.
+unsigned int perfSum(int engine, struct pkt* p)
+{
+	switch(engine)
+	{
+	case 0:
+		return (unsigned int)perfBitSum(p);
+	case 1:
+		return (unsigned int)performChecksum(p);
+	case 2:
+		return rup_checksum(RUP_CKSUM_POPCOUNT, p->_msgbuf, BUFSIZE);
+	case 3:
+		return rup_checksum(RUP_CKSUM_CRC32C, p->_msgbuf, BUFSIZE);
+	default:
+		return rup_checksum(RUP_CKSUM_CRC32C_SOFT, p->_msgbuf, BUFSIZE);
+	}
+}
+
+//
+// perfChecksum
+//
+// Description: Time every checksum engine over the same pkt payload for at
+//                least PERF_CKSUMTIME microseconds each, and write the
+//                rate of each as JSON and a summary line on stderr.
+//
+// Input: FILE* out - Where the JSON goes.
+// Output: NA
+void perfChecksum(FILE* out)
+{
+	// Variable declarations
+	int i, engine;
+	long long start, end, calls;
+	volatile unsigned int sink;
+	double secs;
+	struct pkt* p;
+
+	// Variable assignments
+	p = new struct pkt;
+	sink = 0;
+
+	for(i = 0;i < BUFSIZE;++i)
+	{
+		p->_msgbuf[i] = (char)rand();
+	}
+
+	for(engine = 0;engine < (int)(sizeof(perfSumNames) / sizeof(perfSumNames[0]));++engine)
+	{
+		// Read the clock once per thousand runs, and keep every result
+		//   so none is optimized away
+		calls = 0;
+		start = perfNow();
+		do
+		{
+			for(i = 0;i < 1000;++i)
+			{
+				sink += perfSum(engine, p);
+			}
+			calls += 1000;
+			end = perfNow();
+		} while(end - start < PERF_CKSUMTIME);
+		secs = (end - start) / 1e6;
+
+		fprintf(out, "%s    {\"mode\": \"checksum\", \"engine\": \"%s\", \"bytes\": %d, \"calls\": %lld, \"seconds\": %.6f, "
+			"\"ns_per_call\": %.1f, \"GBps\": %.3f, \"value\": %u}", (engine == 0) ? "" : ",\n", perfSumNames[engine], BUFSIZE,
+			calls, secs, secs * 1e9 / calls, (double)calls * BUFSIZE / secs / 1e9, perfSum(engine, p));
+		fprintf(stderr, "checksum %-15s %5d B  %10.1f ns/call  %8.3f GB/s\n", perfSumNames[engine], BUFSIZE, secs * 1e9 / calls,
+			(double)calls * BUFSIZE / secs / 1e9);
+	}
+	fflush(out);
+	delete p;
+}
+
+//
+// perfUsage
+//
+// Description: Print the options.
+//
+// Input: NA
+// Output: NA
+void perfUsage()
+{
+	fprintf(stderr,
+		"usage: rupperf [options]\n"
+		"  -m, --mode LIST      echo,stream (default both), control,hol to\n"
+		"                       time a control message every %d streamed,\n"
+		"                       on a stream of its own or behind them,\n"
+		"                       write to time rup_write without a window\n"
+		"  -s, --sizes LIST     message bytes (default 64,1024,16384)\n"
+		"  -c, --clients LIST   client threads (default 1,8)\n"
+		"  -n, --count N        messages per client (default 2000)\n"
+		"  -w, --window N       window of every socket (default %d)\n"
+		"  -i, --io LIST        classic,uring (default classic)\n"
+		"  -C, --cc LIST        none,newreno,delay (default newreno)\n"
+		"  -b, --batch LIST     on,off: datagrams per system call, up to\n"
+		"                       RUP_BATCH or one (default on)\n"
+		"  -O, --offload LIST   none,gso,gro,gso+gro (default none)\n"
+		"  -W, --workers N      server reactors sharing the port (default 1)\n"
+		"  -p, --port N         server port (default 15000)\n"
+		"  -o, --output FILE    write the JSON there instead of stdout\n"
+		"  -K, --checksum       time the checksum engines over one pkt\n"
+		"                       payload instead, in GB/s\n"
+		"  impairment of every socket's sends, see rup_setimpair:\n"
+		"  --loss PCT --burst N --dup PCT --reorder PCT --depth N --corrupt PCT\n"
+		"  --delay US --jitter US --rate BYTES/S --seed N\n", PERF_CTLEVERY, RUP_MAXWINDOW);
+}
+
+//
+// main
+//
+// Description: Parse the options, then run every combination asked for and
+//                write the report.
+//
+// Input: int argc - The argument count.
+// Input: char** argv - The arguments.
+// Output: int - 0 if every run succeeded or -h asked for the options, 1
+//           otherwise.
+int main(int argc, char** argv)
+{
+	// Variable declarations
+	int i, k, m, opt, first, failed, maxClients;
+	struct perfConfig cfg;
+	struct perfServer srv;
+	FILE* out;
+	static struct option longOpts[] =
+	{
+		{ "mode", required_argument, NULL, 'm' },
+		{ "sizes", required_argument, NULL, 's' },
+		{ "clients", required_argument, NULL, 'c' },
+		{ "count", required_argument, NULL, 'n' },
+		{ "window", required_argument, NULL, 'w' },
+		{ "io", required_argument, NULL, 'i' },
+		{ "cc", required_argument, NULL, 'C' },
+		{ "batch", required_argument, NULL, 'b' },
+		{ "offload", required_argument, NULL, 'O' },
+		{ "workers", required_argument, NULL, 'W' },
+		{ "port", required_argument, NULL, 'p' },
+		{ "output", required_argument, NULL, 'o' },
+		{ "checksum", no_argument, NULL, 'K' },
+		{ "loss", required_argument, NULL, 1 },
+		{ "burst", required_argument, NULL, 2 },
+		{ "dup", required_argument, NULL, 3 },
+		{ "reorder", required_argument, NULL, 4 },
+		{ "depth", required_argument, NULL, 5 },
+		{ "corrupt", required_argument, NULL, 6 },
+		{ "delay", required_argument, NULL, 7 },
+		{ "jitter", required_argument, NULL, 8 },
+		{ "rate", required_argument, NULL, 9 },
+		{ "seed", required_argument, NULL, 10 },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	// Variable assignments
+	memset((char*)&cfg,0,sizeof(cfg));
+	memset((char*)&srv,0,sizeof(srv));
+	cfg._modes[0] = PERF_ECHO;
+	cfg._modes[1] = PERF_STREAM;
+	cfg._nmodes = 2;
+	cfg._sizes[0] = 64;
+	cfg._sizes[1] = 1024;
+	cfg._sizes[2] = 16384;
+	cfg._nsizes = 3;
+	cfg._clients[0] = 1;
+	cfg._clients[1] = 8;
+	cfg._nclients = 2;
+	cfg._ios[0] = RUP_IO_CLASSIC;
+	cfg._nios = 1;
+	cfg._ccs[0] = RUP_CC_NEWRENO;
+	cfg._nccs = 1;
+	cfg._batches[0] = 1;
+	cfg._nbatches = 1;
+	cfg._offloads[0] = 0;
+	cfg._noffloads = 1;
+	cfg._count = 2000;
+	cfg._window = RUP_MAXWINDOW;
+	cfg._workers = 1;
+	cfg._port = 15000;
+	cfg._impair._seed = 1;
+	out = stdout;
+
+	while((opt = getopt_long(argc, argv, "m:s:c:n:w:i:C:b:O:W:p:o:Kh", longOpts, NULL)) != -1)
+	{
+		switch(opt)
+		{
+			case 'm': cfg._nmodes = perfList(optarg, cfg._modes, perfModeNames, 7); break;
+			case 's': cfg._nsizes = perfList(optarg, cfg._sizes, NULL, 0); break;
+			case 'c': cfg._nclients = perfList(optarg, cfg._clients, NULL, 0); break;
+			case 'n': cfg._count = atoi(optarg); break;
+			case 'w': cfg._window = atoi(optarg); break;
+			case 'i': cfg._nios = perfList(optarg, cfg._ios, perfIoNames, 2); break;
+			case 'C': cfg._nccs = perfList(optarg, cfg._ccs, perfCcNames, 3); break;
+			case 'b': cfg._nbatches = perfList(optarg, cfg._batches, perfBatchNames, 2); break;
+			case 'O': cfg._noffloads = perfList(optarg, cfg._offloads, perfOffloadNames, 4); break;
+			case 'W': cfg._workers = atoi(optarg); break;
+			case 'p': cfg._port = atoi(optarg); break;
+			case 'o':
+				if((out = fopen(optarg, "w")) == NULL)
+				{
+					fprintf(stderr, "rupperf: cannot write %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'K': cfg._checksum = 1; break;
+			case 1: cfg._impair._loss = atof(optarg); cfg._impaired = 1; break;
+			case 2: cfg._impair._burst = atof(optarg); cfg._impaired = 1; break;
+			case 3: cfg._impair._dup = atof(optarg); cfg._impaired = 1; break;
+			case 4: cfg._impair._reorder = atof(optarg); cfg._impaired = 1; break;
+			case 5: cfg._impair._reorderDepth = atoi(optarg); cfg._impaired = 1; break;
+			case 6: cfg._impair._corrupt = atof(optarg); cfg._impaired = 1; break;
+			case 7: cfg._impair._delay_us = atoll(optarg); cfg._impaired = 1; break;
+			case 8: cfg._impair._jitter_us = atoll(optarg); cfg._impaired = 1; break;
+			case 9: cfg._impair._rate = atoll(optarg); cfg._impaired = 1; break;
+			case 10: cfg._impair._seed = strtoull(optarg, NULL, 10); break;
+			case 'h': perfUsage(); return 0;
+			default: perfUsage(); return 1;
+		}
+	}
+
+	if((cfg._nmodes <= 0) || (cfg._nsizes <= 0) || (cfg._nclients <= 0) || (cfg._nios <= 0) || (cfg._nccs <= 0) || (cfg._nbatches <= 0) || (cfg._noffloads <= 0) ||
+		(cfg._count <= 0) || (cfg._window < 1) || (cfg._window > RUP_MAXWINDOW) || (cfg._workers < 1) || (cfg._workers > PERF_MAXWORKERS))
+	{
+		perfUsage();
+		return 1;
+	}
+
+	// Every message carries the header, the largest must fit a read
+	maxClients = 0;
+	srv._cfg = &cfg;
+	srv._maxSize = PERF_HDRSIZE;
+	for(i = 0;i < cfg._nsizes;++i)
+	{
+		cfg._sizes[i] = (cfg._sizes[i] < PERF_HDRSIZE) ? PERF_HDRSIZE : ((cfg._sizes[i] > RUP_MAXMSG) ? RUP_MAXMSG : cfg._sizes[i]);
+		srv._maxSize = (cfg._sizes[i] > srv._maxSize) ? cfg._sizes[i] : srv._maxSize;
+	}
+	for(i = 0;i < cfg._nclients;++i)
+	{
+		maxClients = (cfg._clients[i] > maxClients) ? cfg._clients[i] : maxClients;
+	}
+	srv._capOneWay = maxClients * cfg._count;
+	srv._oneWay = new long long[srv._capOneWay];
+
+	fprintf(out, "{\n  \"tool\": \"rupperf\",\n  \"format\": 1,\n  \"config\": {\"count\": %d, \"window\": %d, \"workers\": %d, \"cpus\": %d, "
+		"\"impair\": ", cfg._count, cfg._window, cfg._workers, rup_cpus());
+	if(cfg._impaired)
+	{
+		fprintf(out, "{\"seed\": %llu, \"loss\": %g, \"burst\": %g, \"dup\": %g, \"reorder\": %g, \"depth\": %d, \"corrupt\": %g, "
+			"\"delay_us\": %lld, \"jitter_us\": %lld, \"rate\": %lld}", cfg._impair._seed, cfg._impair._loss, cfg._impair._burst,
+			cfg._impair._dup, cfg._impair._reorder, cfg._impair._reorderDepth, cfg._impair._corrupt, cfg._impair._delay_us,
+			cfg._impair._jitter_us, cfg._impair._rate);
+	}
+	else
+	{
+		fprintf(out, "null");
+	}
+	fprintf(out, "},\n  \"results\": [\n");
+
+	first = 1;
+	failed = 0;
+	if(cfg._checksum)
+	{
+		perfChecksum(out);
+	}
+	else
+	{
+		for(i = 0;i < cfg._nios * cfg._nccs * cfg._nbatches * cfg._noffloads;++i)
+		{
+			// Every backend, controller, batching and offload, the last
+			//   varying fastest
+			srv._io = cfg._ios[i / (cfg._nccs * cfg._nbatches * cfg._noffloads)];
+			srv._cc = cfg._ccs[(i / (cfg._nbatches * cfg._noffloads)) % cfg._nccs];
+			srv._batch = cfg._batches[(i / cfg._noffloads) % cfg._nbatches];
+			srv._offload = cfg._offloads[i % cfg._noffloads];
+			if(perfStart(&srv) != 0)
+			{
+				fprintf(stderr, "rupperf: cannot start the server\n");
+				return 1;
+			}
+			for(k = 0;k < cfg._nmodes;++k)
+			{
+				for(m = 0;m < cfg._nsizes * cfg._nclients;++m)
+				{
+					if(!perfRun(out, &cfg, &srv, cfg._modes[k], cfg._sizes[m / cfg._nclients], cfg._clients[m % cfg._nclients], first))
+					{
+						failed = 1;
+					}
+					first = 0;
+				}
+			}
+			perfStop(&srv);
+		}
+	}
+
+	fprintf(out, "\n  ]\n}\n");
+	if(out != stdout)
+	{
+		fclose(out);
+	}
+	delete [] srv._oneWay;
+	return failed;
+}
@@ -5,13 +5,722 @@
 //
 #include "../include/rup.h"
 
+#ifndef _WIN32_
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// The io_uring backend needs the multishot receives of Linux 6.0 headers
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#ifdef IORING_RECV_MULTISHOT
+#define RUP_URING
+#endif
+#endif
+#endif
+#endif
+
+// Retransmit timeout bounds in microseconds.  The timeout starts at
+//   RUP_INITRTO_US and follows the measured RTT after the first sample.
+#define RUP_INITRTO_US 100000
+#define RUP_MINRTO_US 1000
+#define RUP_MAXRTO_US 2000000
+
+// How many RTOs rup_close keeps answering retransmits of pkts it just
+//   acknowledged, in case the last ACK was lost, and the least time it
+//   does so since a loopback RTO can be a millisecond
+#define RUP_LINGER_RTOS 3
+#define RUP_LINGER_MIN_US 20000
+
+// Initial bucket count of a socket's peer table, a power of two.  The
+//   table doubles whenever it holds more than two peers per bucket.
+#define RUP_PEERHASH 64
+
+// A peer with nothing in flight or owed is forgotten once it has been
+//   quiet for RUP_PEERIDLE_US, or for the close linger once it was given
+//   up on.  A socket looks for such peers every RUP_PEERREAP_US.
+#define RUP_PEERIDLE_US 60000000
+#define RUP_PEERREAP_US 1000000
+
+// Most peers a socket keeps by default.  A frame from a new address past
+//   the cap takes the place of the longest quiet peer that is owed
+//   nothing, or is dropped if every peer is busy.
+#define RUP_MAXPEERS 4096
+
+// Most datagrams rup_process reads from one socket before moving on, so a
+//   busy socket cannot starve the others
+#define RUP_RECVBURST 64
+
+// Datagrams moved per sendmmsg/recvmmsg call.  Outgoing frames are queued
+//   and sent together, incoming ones are read together and answered with
+//   one ACK per peer.
+#define RUP_BATCH 32
+
+// Segmentation offload.  A run of equal sized frames to one peer goes to
+//   the kernel as one UDP_SEGMENT send, and with UDP_GRO the kernel may
+//   hand back up to RUP_GROSIZE bytes of coalesced datagrams per read.
+#define RUP_GROSIZE 65536
+#define RUP_GROBATCH 8
+
+// Impairment simulator, see rup_setimpair.  Frames the link is holding by
+//   default, and how long a reordered frame waits for later ones to pass
+//   it before it goes anyway.
+#define RUP_SIMQUEUE 1024
+#define RUP_SIMHOLD_US 10000
+
+#ifdef RUP_URING
+// io_uring backend.  One multishot recvmsg stays posted on the socket and
+//   fills RUP_URINGBUFS provided buffers (a power of two), each holding the
+//   recvmsg header, the source address and one frame.  Sends of a txFlush
+//   go in as one submission.
+#define RUP_URINGBUFS 256
+#define RUP_URINGBUFSIZE (sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + RUP_MAXFRAME)
+#define RUP_URINGSQ 64
+#define RUP_URINGCQ 1024
+
+// Completion tags.  A send also carries its flush generation in the top
+//   32 bits and its message index above the tag.
+#define RUP_URING_RECV 1
+#define RUP_URING_SEND 2
+#endif
+
+// Wire format
+//   Every datagram starts with a packed header in network byte order
+//     offset 0   version   1 byte
+//     offset 1   type      1 byte
+//     offset 2   flags     2 bytes
+//     offset 4   sequence  4 bytes
+//     offset 8   length    2 bytes, payload bytes at the end of the datagram
+//     offset 10  checksum  4 bytes, over the whole datagram with this field zero
+//     offset 14  connection 4 bytes, the ID the receiver gave the connection,
+//                0 until it has given one
+//   followed by the options named in flags, in flag bit order, and then
+//   the payload.  An ACK's sequence is cumulative: everything below it has
+//   arrived.  Its SACK option is a 64 bit map of the frames after that
+//   which the receiver is holding, bit 0 being sequence+1.  Data frames
+//   can carry the same acknowledgement for the opposite direction in their
+//   SACK and ACK (cumulative sequence) options.  Either kind of ACK also
+//   carries a WND option, the frames the receiver can still take beyond
+//   the cumulative sequence.  Only the bytes a pkt really uses are sent,
+//   and the session metadata of struct pkt is sent once per peer rather
+//   than in every datagram.  A data frame's delivery class is in its
+//   flags.  An UNREL frame takes no place in the window and is never
+//   acknowledged.  A FWD frame, header only, tells the receiver that the
+//   sender gave up on everything below its sequence.  A STRM option names
+//   the stream of a data frame and its sequence within that stream, so each
+//   stream is handed out in its own order; it is sent once a peer has been
+//   written on a stream other than 0.  A HELLO frame opens a connection
+//   and a WELCOME frame accepts it.  Their payload is the ID the sender
+//   gives the connection (4 bytes), the frames it can take (2), its
+//   largest frame (2), its checksum engine (1) and a resume token after
+//   its length (1): the token a client was given last time, or a new one
+//   from the server.  A frame whose connection ID is unknown is matched
+//   by its address instead.
+#define RUP_VERSION 3
+#define RUP_HDRSIZE 18
+#define RUP_MAXFRAME 1472
+
+// Frame types
+#define RUP_T_DATA 1
+#define RUP_T_ACK 2
+#define RUP_T_FWD 3
+#define RUP_T_HELLO 4
+#define RUP_T_WELCOME 5
+
+// Header flags, the top four bits name the checksum engine of the frame
+#define RUP_F_BASE 0x0001
+#define RUP_F_META 0x0002
+#define RUP_F_SACK 0x0004
+#define RUP_F_ACK 0x0008
+#define RUP_F_FRAG 0x0010
+#define RUP_F_WND 0x0020
+#define RUP_F_UNORD 0x0040
+#define RUP_F_PART 0x0080
+#define RUP_F_UNREL 0x0100
+#define RUP_F_STRM 0x0200
+
+// Largest fragment of a message, sized so a fragment frame carrying every
+//   option but metadata still fits RUP_MAXFRAME
+#define RUP_FRAGOPTS 36
+#define RUP_FRAGSIZE (RUP_MAXFRAME - RUP_HDRSIZE - RUP_FRAGOPTS)
+
+// Reassembly buffers a socket keeps for reuse once their message is read,
+//   and the largest buffer it keeps
+#define RUP_MSGPOOL 16
+#define RUP_MSGKEEP (64 * 1024)
+
+// An ACK frame: header, SACK map and advertised window
+#define RUP_ACKSIZE (RUP_HDRSIZE + 10)
+
+// Resume tokens: issue time, the server's RTT estimate and a check value
+//   keyed by a secret of the process, 4 bytes each.  A token is honoured
+//   for RUP_RESUME_SECS, and a client remembers the servers of its last
+//   RUP_RESUMES connections.
+#define RUP_TOKENSIZE 16
+#define RUP_HELLOSIZE (RUP_HDRSIZE + 10 + RUP_TOKENSIZE)
+#define RUP_RESUME_SECS 600
+#define RUP_RESUMES 64
+
+// Frames a socket holds for the application, in pkts and message
+//   fragments, before its advertised window closes
+#define RUP_RCVBUF 1024
+
+// Ready queue entries a socket keeps for reuse, and pkts each thread keeps
+//   for createPkt once they are handed back with freePkt
+#define RUP_READYPOOL 64
+#define RUP_PKTPOOL 64
+
+// Congestion window a peer starts with and never drops below outside of a
+//   timeout, in frames
+#define RUP_INITCWND 10
+#define RUP_MINCWND 2
+
+// A delay based sender grows while fewer than ALPHA of its frames are
+//   queued in the network and shrinks once more than BETA are.  Its
+//   smallest RTT is forgotten after RUP_MINRTT_US in case the path changed.
+#define RUP_DELAY_ALPHA 2
+#define RUP_DELAY_BETA 4
+#define RUP_MINRTT_US 10000000
+
+// Paced rate in percent of cwnd per RTT, in slow start and after it, and
+//   the frames that may go back to back when a sender falls behind
+#define RUP_PACE_SS 200
+#define RUP_PACE_CA 125
+#define RUP_PACE_QUANTUM 4
+
+// Storage class of the per thread pools and counters
+#ifdef _WIN32_
+#define RUP_TLS __declspec(thread)
+#else
+#define RUP_TLS __thread
+#endif
+
+// A data frame this far from the expected sequence comes from a sender
+//   that restarted, not from the stream in progress
+#define RUP_RESYNC 65536
+
+// Number of later frames a receiver must report before a hole below them
+//   is retransmitted without waiting for the timer
+#define RUP_DUPTHRESH 3
+#define RUP_F_CKSUMSHIFT 12
+#define RUP_F_CKSUMMASK 0xF000
+
+// Options and payload located in a frame by frameOptions
+struct rupOpts
+{
+	int _flags;
+	unsigned int _base;
+	unsigned char* _meta;
+	unsigned long long _sack;
+	unsigned int _ack;
+	unsigned int _msgId;
+	unsigned int _msgOff;
+	unsigned int _msgTotal;
+	int _wnd;
+	int _stream;
+	unsigned int _strmSeq;
+	unsigned char* _payload;
+	int _paylen;
+};
+
+// Session metadata of struct pkt, negotiated once per peer
+struct rupMeta
+{
+	struct sockaddr_in _client;
+	char _name[NAMESIZE];
+	char _password[PASSWORDSIZE];
+};
+
+// Slot holding one frame of a send or receive window
+struct winSlot
+{
+	int _used;
+	int _len;
+	int _retries;
+	int _metaVer;
+	int _dups;
+	int _lost;
+	int _early;
+	int _cls;
+	int _tries;
+	long long _expire;
+	int _stream;
+	unsigned int _strmSeq;
+	unsigned int _seq;
+	long long _sent;
+	long long _queued;
+	unsigned char _frame[RUP_MAXFRAME];
+};
+
+// Order of one stream to and from a peer: the next sequence each way and
+//   the message being reassembled from it
+struct rupStream
+{
+	unsigned int _sndNext;
+	unsigned int _rcvNext;
+	struct rupMsg* _asm;
+};
+
+// Window state kept for every peer a socket talks to.  The send and
+//   receive windows are allocated when the first frame needs them.
+struct rupPeer
+{
+	struct sockaddr_in _addr;
+	unsigned int _sndNext;
+	unsigned int _sndBase;
+	int _rcvInit;
+	unsigned int _rcvNext;
+	long long _lastAck;
+	long long _ackHeard;
+	long long _lastSeen;
+	int _active;
+	int _failed;
+	int _abandoned;
+	int _ackPending;
+	long long _ackDue;
+	long long _srtt;
+	long long _rttvar;
+	long long _rto;
+	int _samples;
+	struct rupMeta _sndMeta;
+	int _sndMetaVer;
+	int _sndMetaAcked;
+	struct rupMeta _rcvMeta;
+	unsigned int _sndMsgId;
+	int _sndStreams;
+	int _rcvStreams;
+	struct rupStream _streams[RUP_MAXSTREAMS];
+	int _ackLen;
+	unsigned int _ackSeq;
+	unsigned long long _ackSack;
+	int _ackWnd;
+	unsigned int _rcvEdge;
+	int _rwnd;
+	unsigned int _rwndAck;
+	unsigned char _ackFrame[RUP_ACKSIZE];
+	unsigned int _sndPaced;
+	int _inFlight;
+	int _lost;
+	long long _paceNext;
+	int _cwnd;
+	int _cwndAcc;
+	int _ssthresh;
+	int _undoCwnd;
+	int _undoSsthresh;
+	int _inRecovery;
+	unsigned int _recover;
+	unsigned int _ccRound;
+	long long _ccRttMin;
+	long long _minRtt;
+	long long _minRttAt;
+	int _fwdPending;
+	int _fwdTries;
+	unsigned int _fwdSeq;
+	long long _fwdSent;
+	unsigned int _cid;
+	unsigned int _peerCid;
+	int _peerWnd;
+	int _peerMtu;
+	int _peerCksum;
+	int _helloPending;
+	int _helloTries;
+	long long _helloSent;
+	int _resumed;
+	int _tokenLen;
+	unsigned char _token[RUP_TOKENSIZE];
+	struct rup_stats _stats;
+	struct winSlot* _snd;
+	struct winSlot* _rcv;
+	struct rupSock* _sock;
+	struct rupPeer* _next;
+	struct rupPeer* _hnext;
+	struct rupPeer* _cnext;
+};
+
+// Position in a caller's iovec array while gathering or scattering
+struct rupCursor
+{
+	const struct iovec* _iov;
+	int _cnt;
+	int _idx;
+	size_t _pos;
+};
+
+// Message being reassembled from its fragments, or waiting for rup_readmsg
+struct rupMsg
+{
+	unsigned int _id;
+	int _len;
+	int _got;
+	int _cap;
+	int _stream;
+	unsigned char* _buf;
+	struct sockaddr_in _from;
+	struct rupMsg* _next;
+};
+
+// In order pkt waiting to be handed out by rup_read
+struct rupReady
+{
+	int _len;
+	struct sockaddr_in _from;
+	struct pkt _pkt;
+	struct rupReady* _next;
+};
+
+#ifdef RUP_URING
+// io_uring of a socket opened with RUP_IO_URING: the mapped submission
+//   and completion queues and the provided receive buffers
+struct rupRing
+{
+	int _fd;
+	unsigned int* _sqTail;
+	unsigned int _sqMask;
+	unsigned int* _sqArray;
+	struct io_uring_sqe* _sqes;
+	unsigned int _sqLocal;
+	unsigned int _sqSubmitted;
+	unsigned int* _cqHead;
+	unsigned int* _cqTail;
+	unsigned int _cqMask;
+	struct io_uring_cqe* _cqes;
+	void* _ringMap;
+	size_t _ringLen;
+	size_t _sqeLen;
+	struct io_uring_buf_ring* _bufRing;
+	unsigned char* _bufs;
+	unsigned short _bufTail;
+	int _armed;
+	int _bound;
+	unsigned int _gen;
+	struct msghdr _rxMsg;
+};
+#endif
+
+// A frame the simulated link holds: when it may leave, or how many later
+//   frames must pass it first if it was picked to be reordered
+struct simFrame
+{
+	long long _ready;
+	long long _due;
+	int _holdFor;
+	int _len;
+	struct sockaddr_in _addr;
+	unsigned char _frame[RUP_MAXFRAME];
+};
+
+// Impairment simulator of a socket: its settings, counters, random state
+//   and the frames in flight on the simulated link
+struct rupSim
+{
+	struct rup_impair _cfg;
+	struct rup_impairinfo _info;
+	unsigned long long _rng;
+	int _bad;
+	long long _linkFree;
+	int _cap;
+	int _count;
+	struct simFrame* _held;
+};
+
+// State kept for every socket returned by rup_open
+struct rupSock
+{
+	int _fd;
+	int _window;
+	int _cc;
+	int _pacing;
+	int _cksum;
+	long long _ackDelay;
+	int _ackEvery;
+	struct rupPeer* _peers;
+	struct rupPeer** _hash;
+	struct rupPeer** _cids;
+	unsigned int _hashSize;
+	unsigned int _npeers;
+	unsigned int _maxPeers;
+	long long _reapAt;
+	int _failed;
+	struct rupReady* _readyHead;
+	struct rupReady* _readyTail;
+	int _readyLen;
+	struct rupReady* _readyFree;
+	int _readyFreeLen;
+	struct rupMsg* _msgHead;
+	struct rupMsg* _msgTail;
+	int _msgLen;
+	struct rupMsg* _msgFree;
+	int _msgFreeLen;
+	int _rcvBuf;
+	int _rcvUsed;
+	int _wndLow;
+	int _deliver;
+	int _partTries;
+	long long _partBudget;
+	struct rup_deliveryinfo _classes[RUP_DELIVER_UNRELIABLE + 1];
+	struct rup_stats _stats;
+	int _stream;
+	int _nonblock;
+	int _polled;
+	rup_callback _cb;
+	void* _cbArg;
+	int _rxBatch;
+	int _perPacket;
+	int _offload;
+	unsigned char* _groBuf;
+	struct rupRing* _ring;
+	struct rupSim* _sim;
+	int _txCount;
+	int _txLen[RUP_BATCH];
+	struct sockaddr_in _txAddr[RUP_BATCH];
+	unsigned char* _txFrame[RUP_BATCH];
+	struct winSlot* _txSlot[RUP_BATCH];
+	unsigned int _txSeq[RUP_BATCH];
+	unsigned char _txAck[RUP_BATCH][RUP_ACKSIZE];
+	unsigned char (*_txDgram)[RUP_MAXFRAME];
+	struct sockaddr_in _rxAddr[RUP_BATCH];
+	unsigned char _rxFrame[RUP_BATCH][RUP_MAXFRAME];
+};
+
+static struct rupSock* rupSocks[RUP_MAXSOCKS];
+
+// Descriptor of each rupSocks entry, so a lookup never reads the state of
+//   a socket another thread may be closing
+static int rupSockFds[RUP_MAXSOCKS];
+
+// Held while a thread adds or removes a rupSocks entry
+#ifdef _WIN32_
+static SRWLOCK rupSockLock = SRWLOCK_INIT;
+#else
+static pthread_mutex_t rupSockLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+// What a client last negotiated with each server, kept across its sockets
+//   so a reconnect can send data without waiting for the WELCOME.  Guarded
+//   by sockLock.
+struct rupResume
+{
+	struct sockaddr_in _addr;
+	int _window;
+	int _mtu;
+	int _cksum;
+	long long _srtt;
+	long long _rttvar;
+	long long _at;
+	int _tokenLen;
+	unsigned char _token[RUP_TOKENSIZE];
+};
+static struct rupResume rupResumes[RUP_RESUMES];
+
+// Secret the resume tokens of this process are keyed with, set by the
+//   first getSock
+static unsigned int rupTokenKey[2];
+
+// Pkts freed with freePkt, linked through their first bytes, and the heap
+//   use of each thread
+struct rupPktFree
+{
+	struct rupPktFree* _next;
+};
+static RUP_TLS struct rupPktFree* rupPktPool;
+static RUP_TLS int rupPktPoolLen;
+static RUP_TLS struct rup_allocinfo rupAllocs;
+
+// Congestion controller, called as ACKs, fast retransmits and timeouts
+//   happen on a peer's send window
+struct rupCongestion
+{
+	void (*_init)(struct rupPeer* p);
+	void (*_ack)(struct rupPeer* p, int acked, long long rtt, long long now);
+	void (*_loss)(struct rupPeer* p);
+	void (*_timeout)(struct rupPeer* p);
+};
+
+// Reactor of each thread: the sockets it registered with rup_poll and the
+//   descriptor they are registered with
+static RUP_TLS struct rupSock* rupPolled[RUP_MAXSOCKS];
+static RUP_TLS int rupPolledLen;
+#ifndef _WIN32_
+static RUP_TLS int rupEpfd = -1;
+#endif
+
+// One socket of rup_serve and the core its worker runs on
+struct rupWorker
+{
+	int _rfd;
+	int _cpu;
+	rup_callback _cb;
+	void* _arg;
+	int _ret;
+};
+
+// Set by rup_stop to end every rup_serve worker, and cleared when the
+//   last running rup_serve returns
+#ifdef _WIN32_
+static volatile LONG rupStopping = 0;
+static volatile LONG rupServing = 0;
+#else
+static volatile sig_atomic_t rupStopping = 0;
+static volatile sig_atomic_t rupServing = 0;
+#endif
+
 // Forward declarations
-int sendDataPkt_FromSender(int rfd, void* buf, int cc, struct sockaddr_in* to);
-int pktSentSuccessfully_FromSender(int rfd, void* buf, int cc, struct sockaddr_in* to);
-int stopConfirmation_FromSender(int rfd, void* buf, int cc, struct sockaddr_in* to);
-int receiveDataPkt_FromReceiver(int rfd, void* buf, int cc, struct sockaddr_in* from);
-int ACK_FromReceiver(int rfd, void* buf, int cc, struct sockaddr_in* to);
-int stopConfirmation_FromReceiver(int rfd, void* buf, int cc, struct sockaddr_in* to);
+struct rupSock* getSock(int rfd);
+void freeSock(int rfd);
+void sockLock();
+void sockUnlock();
+void unpollSock(struct rupSock* s);
+int pollFd(struct rupSock* s);
+struct rupPeer* getPeer(struct rupSock* s, struct sockaddr_in* addr);
+struct rupPeer* findPeer(struct rupSock* s, struct sockaddr_in* addr);
+void freePeer(struct rupPeer* p);
+void peerReap(struct rupSock* s, long long now);
+int peerIdle(struct rupPeer* p, long long now);
+int peerQuiet(struct rupPeer* p, long long now);
+int peerEvict(int rfd, struct rupSock* s);
+void peerDrop(struct rupSock* s, struct rupPeer** pp);
+unsigned int peerHash(struct sockaddr_in* addr);
+void peerGrow(struct rupSock* s);
+struct rupPeer* peerOf(int rfd, struct rupSock* s, unsigned char* frame, struct sockaddr_in* from);
+void peerMove(struct rupSock* s, struct rupPeer* p, struct sockaddr_in* addr);
+int peerFresh(struct rupPeer* p, int type, int flags, unsigned int seq, unsigned long long sack, struct rupOpts* o);
+void helloSend(int rfd, struct rupPeer* p, int type, unsigned char* token, int tokenLen);
+void helloInput(int rfd, struct rupPeer* p, int type, unsigned char* in, int len);
+void tokenMint(struct rupPeer* p, unsigned char* token);
+int tokenCheck(struct rupPeer* p, unsigned char* token, int tokenLen);
+unsigned int tokenMac(unsigned char* token, struct sockaddr_in* addr);
+int resumeFind(struct sockaddr_in* addr, struct rupResume* r);
+void resumeSave(struct rupPeer* p);
+int winInput(int rfd, unsigned char* in, int len, struct sockaddr_in* from);
+int winService(int rfd, struct rupSock* s, long long maxwait);
+long long winDeadline(struct rupSock* s, long long now, long long wait);
+int winRecv(int rfd, struct rupSock* s, int dontwait);
+void txQueue(int rfd, struct rupSock* s, unsigned char* frame, int len, struct rupPeer* p, struct winSlot* slot);
+void txFlush(int rfd, struct rupSock* s);
+void txSend(int rfd, struct rupSock* s);
+void simFlush(int rfd, struct rupSock* s);
+void simOffer(struct rupSim* m, unsigned char* frame, int len, struct sockaddr_in* to, long long now);
+void simHold(struct rupSim* m, unsigned char* frame, int len, struct sockaddr_in* to, long long ready, int holdFor);
+long long simDeadline(struct rupSim* m, long long now, long long wait);
+unsigned long long simRand(struct rupSim* m);
+int simChance(struct rupSim* m, double pct);
+void simClose(int rfd, struct rupSock* s);
+#ifdef RUP_URING
+struct rupRing* ringOpen();
+void ringClose(struct rupRing* r);
+int ringSend(int rfd, struct rupRing* r, struct mmsghdr* msgs, int nmsg);
+int ringRecv(int rfd, struct rupSock* s, int dontwait);
+int ringWait(struct rupRing* r, long long wait);
+struct io_uring_sqe* ringSqe(struct rupRing* r);
+int ringEnter(struct rupRing* r, int getevents, long long wait);
+void ringArm(struct rupRing* r, int rfd);
+void ringRecycle(struct rupRing* r, int bid);
+#endif
+void winTimers(int rfd, struct rupSock* s);
+void winAbort(struct rupPeer* p);
+struct winSlot* winReserve(int rfd, struct rupSock* s, struct rupPeer* p);
+void winCommit(int rfd, struct rupPeer* p, struct winSlot* slot);
+unsigned char* encodeOptions(struct rupPeer* p, unsigned char* frame, int* flags, struct rupOpts* o);
+int encodeFrag(struct rupPeer* p, struct rupCursor* c, int len, struct rupOpts* o, unsigned char* frame);
+void iovGather(struct rupCursor* c, unsigned char* dst, int n);
+int iovScatter(struct rupCursor* c, const unsigned char* src, int n);
+void msgDeliver(struct rupSock* s, struct rupPeer* p, unsigned char* frame, int len);
+struct rupMsg* msgAlloc(struct rupSock* s, int len);
+void msgGrow(struct rupMsg* m, int len);
+void msgRelease(struct rupSock* s, struct rupMsg* m);
+int popMsg(struct rupSock* s, int* stream, struct rupCursor* c, struct sockaddr_in* from);
+int msgRead(int rfd, int* stream, const struct iovec* iov, int iovcnt, struct sockaddr_in* from);
+struct rupReady* readyAlloc(struct rupSock* s);
+void readyRelease(struct rupSock* s, struct rupReady* r);
+struct pkt* pktAlloc();
+int popReady(struct rupSock* s, void* buf, int cc, struct sockaddr_in* from);
+int winWrite(int rfd, struct rupSock* s, void* buf, int cc, struct sockaddr_in* to);
+int winWriteOnce(int rfd, struct rupSock* s, void* buf, int cc, struct sockaddr_in* to);
+void winDatagram(int rfd, struct rupSock* s, struct rupPeer* p, unsigned char* frame, int len);
+int frameClass(int flags);
+int deliverFlag(struct rupSock* s, int whole);
+void winExpire(struct rupPeer* p, struct winSlot* slot);
+void winForward(int rfd, struct rupPeer* p);
+void winSlide(struct rupPeer* p, long long now);
+void winForwardInput(int rfd, struct rupSock* s, struct rupPeer* p, unsigned int base);
+void winRestart(struct rupPeer* p, unsigned int base);
+void winAdvance(struct rupSock* s, struct rupPeer* p, unsigned int base);
+int winInOrder(struct rupSock* s, struct rupPeer* p);
+void winHandOut(struct rupSock* s, struct rupPeer* p, unsigned char* frame, int len, int early);
+void readyPush(struct rupSock* s, struct rupPeer* p, unsigned char* frame, int len);
+void msgQueue(struct rupSock* s, struct rupMsg* m);
+int winPending(struct rupSock* s);
+long long rupNow();
+void winLinger(int rfd, struct rupSock* s);
+long long winLingerEnd(struct rupSock* s);
+long long winLingerSpan(struct rupPeer* p);
+void rttSample(struct rupPeer* p, long long rtt);
+void rttSeed(struct rupPeer* p, long long srtt, long long rttvar);
+void rtoUpdate(struct rupPeer* p);
+void histRecord(struct rup_histogram* h, long long v);
+int histIndex(long long v);
+long long histTop(int idx);
+void statsAdd(struct rup_stats* to, struct rup_stats* from);
+void histAdd(struct rup_histogram* to, struct rup_histogram* from);
+int encodePkt(struct rupPeer* p, struct pkt* in, unsigned char* frame, int* metaVer);
+void decodePkt(struct rupPeer* p, unsigned char* frame, int len, struct pkt* out);
+void putU16(unsigned char* b, unsigned int v);
+void putU32(unsigned char* b, unsigned int v);
+unsigned int getU16(unsigned char* b);
+unsigned int getU32(unsigned char* b);
+void frameHeader(unsigned char* frame, int type, int flags, unsigned int seq, int len, unsigned int cid);
+unsigned int frameChecksum(unsigned char* frame, int len);
+void frameSeal(unsigned char* frame, int len);
+unsigned int crc32cSoft(unsigned int crc, const unsigned char* b, int len);
+unsigned int crc32cUpdate(unsigned int crc, const unsigned char* b, int len);
+unsigned int popcountSum(const unsigned char* b, int len);
+void winAck(int rfd, struct rupPeer* p);
+void winAckInput(int rfd, struct rupPeer* p, unsigned int cum, unsigned long long sack, int wnd, int pure);
+int winAckNew(struct rupPeer* p, unsigned int cum, unsigned long long sack);
+unsigned long long winSackMap(struct rupPeer* p);
+int frameOptions(unsigned char* frame, int len, struct rupOpts* o);
+void winAckFlush(int rfd, struct rupSock* s, int all);
+int winLimit(struct rupSock* s, struct rupPeer* p);
+int winReady(struct rupPeer* p);
+unsigned int winEdge(struct rupPeer* p);
+void winStreams(struct rupSock* s, struct rupPeer* p);
+int rcvWindow(struct rupSock* s);
+void rcvUpdate(struct rupSock* s);
+void winPace(int rfd, struct rupPeer* p, long long now);
+void winLost(struct rupPeer* p, struct winSlot* slot);
+long long paceGap(struct rupPeer* p);
+void ccInit(struct rupPeer* p);
+void ccNoneInit(struct rupPeer* p);
+void renoInit(struct rupPeer* p);
+void renoAck(struct rupPeer* p, int acked, long long rtt, long long now);
+void renoLoss(struct rupPeer* p);
+void renoTimeout(struct rupPeer* p);
+int ccRecovered(struct rupPeer* p);
+void ccUndo(struct rupPeer* p);
+void delayAck(struct rupPeer* p, int acked, long long rtt, long long now);
+void delayLoss(struct rupPeer* p);
+
+// Controllers selected by rup_setcongestion, indexed by RUP_CC_*
+static const struct rupCongestion rupCCs[] =
+{
+	{ ccNoneInit, NULL, NULL, NULL },
+	{ renoInit, renoAck, renoLoss, renoTimeout },
+	{ renoInit, delayAck, delayLoss, renoTimeout }
+};
+
+#ifndef _WIN32_
+// strncpy_s is a Microsoft extension, provide the same truncating copy here
+static int strncpy_s(char* dest, size_t destsz, const char* src, size_t count)
+{
+	if(count >= destsz)
+	{
+		count = destsz - 1;
+	}
+	memcpy(dest, src, count);
+	dest[count] = '\0';
+	return 0;
+}
+#endif
 
 //
 // rup_open
@@ -22,6 +731,20 @@ int stopConfirmation_FromReceiver(int rfd, void* buf, int cc, struct sockaddr_in
 // Input: NA
 // Output: int sock - Return a descriptor to be used in all other RUP calls.
 int rup_open()
+{
+	return rup_openio(RUP_IO_CLASSIC);
+}
+
+//
+// rup_openio
+//
+// Description: Open a socket like rup_open, doing its I/O with the given
+//               backend.  RUP_IO_URING falls back to RUP_IO_CLASSIC when
+//               the kernel cannot provide it, see rup_getio.
+//
+// Input: int io - RUP_IO_CLASSIC or RUP_IO_URING.
+// Output: int sock - Return a descriptor to be used in all other RUP calls.
+int rup_openio(int io)
 {
 	// Variable declarations
 	int sock;
@@ -50,9 +773,30 @@ int rup_open()
 		printf("UDP Error: socket() call in rup_open\n");
 		exit(0);
 	}
+
+	// Create the window state for the new socket
+	getSock(sock);
+#ifdef RUP_URING
+	if(io == RUP_IO_URING)
+	{
+		getSock(sock)->_ring = ringOpen();
+	}
+#endif
 	return sock;
 }
 
+//
+// rup_getio
+//
+// Description: Tell which I/O backend a socket ended up with.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Output: int - RUP_IO_CLASSIC or RUP_IO_URING.
+int rup_getio(int rfd)
+{
+	return (getSock(rfd)->_ring != NULL) ? RUP_IO_URING : RUP_IO_CLASSIC;
+}
+
 //
 // rup_bind
 //
@@ -66,9 +810,15 @@ int rup_bind(int rfd, int portno)
 	// Variable declarations
 	int ret;
 	struct sockaddr_in server;
+#ifdef RUP_URING
+	struct rupSock* s;
+#endif
 
 	// Variable assignments
 	ret = 0;
+#ifdef RUP_URING
+	s = getSock(rfd);
+#endif
 
 	server.sin_family = AF_INET;
 	server.sin_addr.s_addr = INADDR_ANY;   /* ok from any machine */
@@ -80,9 +830,74 @@ int rup_bind(int rfd, int portno)
 		printf("binding udp socket\n");
 		ret = -1; 
 	}
+#ifdef RUP_URING
+	else if((s->_ring != NULL) && (!s->_ring->_bound))
+	{
+		ringArm(s->_ring, rfd);
+		ringEnter(s->_ring, 0, -1);
+	}
+#endif
 	return ret;
 }
 
+//
+// rup_connect
+//
+// Description: Set up a connection to a server: trade connection IDs and
+//               parameters in a HELLO and its WELCOME.  A server this
+//               process talked to recently is resumed instead, its window,
+//               checksum engine and RTT taken from then, and data may
+//               follow the HELLO at once.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct sockaddr_in* to - The server's ip address and port number.
+// Output: int - Returns 0 on success and -1 if the server never answered.
+int rup_connect(int rfd, struct sockaddr_in* to)
+{
+	// Variable declarations
+	struct rupSock* s;
+	struct rupPeer* p;
+	struct rupResume r;
+
+	// Variable assignments
+	s = getSock(rfd);
+	p = getPeer(s, to);
+
+	if(p->_peerCid != 0)
+	{
+		return 0;
+	}
+
+	p->_helloTries = 0;
+	if(resumeFind(to, &r))
+	{
+		p->_peerWnd = r._window;
+		p->_peerMtu = r._mtu;
+		p->_peerCksum = r._cksum;
+		p->_rwnd = (r._window < RUP_MAXWINDOW) ? r._window : RUP_MAXWINDOW;
+		if((p->_samples == 0) && (r._srtt > 0))
+		{
+			rttSeed(p, r._srtt, r._rttvar);
+		}
+		memcpy(p->_token, r._token, r._tokenLen);
+		p->_tokenLen = r._tokenLen;
+		p->_resumed = 1;
+	}
+	helloSend(rfd, p, RUP_T_HELLO, p->_token, p->_tokenLen);
+	txFlush(rfd, s);
+
+	// A resumed or non-blocking connection completes in the background
+	if((p->_resumed) || (s->_nonblock))
+	{
+		return 0;
+	}
+	while(p->_helloPending)
+	{
+		winService(rfd, s, -1);
+	}
+	return (p->_peerCid != 0) ? 0 : -1;
+}
+
 //
 // rup_close
 //
@@ -92,6 +907,16 @@ int rup_bind(int rfd, int portno)
 // Output: NA
 void rup_close(int rfd)
 {
+	// Let any pkts still in flight reach their receiver, then answer
+	//   retransmits from senders whose last ACK may have been lost
+	rup_flush(rfd);
+	winLinger(rfd, getSock(rfd));
+	if(getSock(rfd)->_polled)
+	{
+		unpollSock(getSock(rfd));
+	}
+	freeSock(rfd);
+
 #ifdef _WIN32_
 	rfd = 0;
 	WSACleanup();
@@ -114,57 +939,79 @@ void rup_close(int rfd)
 int rup_write(int rfd, void* buf, int cc, struct sockaddr_in* to)
 {
 	// Variable declarations
-	int ret;
+	int ret, failed;
+	struct rupSock* s;
+	struct rupPeer* p;
 
 	// Variable assignments
 	ret = 0;
+	s = getSock(rfd);
 
-	// send pkt to receiver
-	//   A true return value indicates to the sender
-	//   that the receiver has received the pkt
-	if(sendDataPkt_FromSender(rfd, buf, cc, to))
-	{
-		//printf("ret = %d\n", ret);
-		//printf("sendDataPkt_FromSender has succeded!!!\n");
-		// send pkt sent successfully ACK to receiver
-		//   A true return value indicates that the sender
-		//   has told the receiver it knows the pkt arrived
-		//   at the receiver successfully
-		if(pktSentSuccessfully_FromSender(rfd, buf, cc, to))
-		{
-			//printf("pktSentSuccessfully_FromSender has succeded!!!\n");
-			// send stop ack to receiver
-			//   A true return value indicates the reveiver is aware
-			//   the sender has sent pkt successfully, and has received
-			//   an ACK from the receiver for the pkt being sent
-			//   successfully.
-			//
-			// At this point the sender knows there is no need to
-			//   keep sending ACK's or receiving ACK's.  The sender
-			//   can timeout and leave function without getting a
-			//   response back from receiver without the possiblity
-			//   of the data pkt not being delivered..
-			if(stopConfirmation_FromSender(rfd, buf, cc, to))
-			{
-				//printf("stopConfirmation_FromSender has succeded!!!\n");
-				ret = 1;
+	// An unreliable pkt goes out once, whatever the window holds
+	if(s->_deliver == RUP_DELIVER_UNRELIABLE)
+	{
+		ret = winWriteOnce(rfd, s, buf, cc, to);
+		if(!(s->_offload & RUP_OFFLOAD_GSO))
+		{
+			txFlush(rfd, s);
+		}
+		return ret;
+	}
+
+	// A non-blocking socket with a full window gives the ACKs already
+	//   queued one chance to open it, then leaves the pkt with the caller
+	if(s->_nonblock)
+	{
+		p = getPeer(s, to);
+		if((int)(p->_sndNext - p->_sndBase) >= s->_window)
+		{
+			while(winRecv(rfd, s, 1))
+			{
 			}
-			else
+			winTimers(rfd, s);
+			if((int)(p->_sndNext - p->_sndBase) >= s->_window)
 			{
-				//printf("stopConfirmation_FromSender has FAILED\n");
-				ret = 1;
+				txFlush(rfd, s);
+				return 0;
 			}
 		}
-		else
+	}
+
+	// send pkt to receiver
+	//   A true return value indicates the pkt is in the
+	//   peer's send window and has been sent once
+	if(winWrite(rfd, s, buf, cc, to))
+	{
+		ret = 1;
+
+		// Without a window the caller waits for the receiver's ACK.
+		//   The receiver answers any retransmit of a pkt it already
+		//   delivered, so there is nothing left to confirm once the
+		//   ACK is here.
+		if((s->_window == 1) && (!s->_nonblock))
 		{
-			//printf("pktSentSuccessfully_FromSender has FAILED\n");
-			ret = 0;
+			p = getPeer(s, to);
+			failed = p->_failed;
+			while(p->_sndBase != p->_sndNext)
+			{
+				winService(rfd, s, -1);
+			}
+
+			// The receiver never answered
+			if(p->_failed != failed)
+			{
+				ret = 0;
+			}
 		}
 	}
-	else
+
+	// With segmentation offload a bulk sender's frames are held while the
+	//   window has room so a run of them goes out in one send.  Every wait
+	//   flushes them first.
+	p = getPeer(s, to);
+	if((!(s->_offload & RUP_OFFLOAD_GSO)) || (s->_window == 1) || ((int)(p->_sndNext - p->_sndBase) >= s->_window))
 	{
-		//printf("sendDataPkt_FromSender has FAILED\n");
-		ret = 0;
+		txFlush(rfd, s);
 	}
 	return ret;
 }
@@ -184,705 +1031,7089 @@ int rup_read(int rfd, void* buf, int cc, struct sockaddr_in* from)
 {
 	// Variable declarations
 	int ret;
+	struct rupSock* s;
 
 	// Variable assignments
 	ret = 0;
+	s = getSock(rfd);
 
 	while(ret != 1)
 	{
-		// wait to receive the data pkt from sender
-		if(receiveDataPkt_FromReceiver(rfd, buf, cc, from))
-		{
-			//printf("receiveDataPkt_FromReceiver has succeded!!!\n");
-			// send ACK to sender
-			//   A true return value indicates the receiver knows the
-			//   sender knows the original data pkt was delivered
-			//   to the receiver successfully  
-			if(ACK_FromReceiver(rfd, buf, cc, from))
-			{
-				//printf("ACK_FromReceiver has succeded!!!\n");
-				// send stop confirmation to sender
-				//   A true return value indicates the sender has confirmed
-				//   the ack sending can be stopped.  Original data pkt has
-				//   been delivered and acks have been sent and received by
-				//   both receiver and sender. 
-				if(stopConfirmation_FromReceiver(rfd, buf, cc, from))
-				{
-					//printf("stopConfirmation_FromReceiver has succeded!!!\n");
-					ret = 1;
-				}
-				else
-				{
-					//printf("stopConfirmation_FromReceiver has FAILED\n");
-					ret = 0;
-				}
-			}
-			else
+		// hand out pkts that have already arrived in order, otherwise
+		//   wait for the next datagram.  ACKs for data that arrives are
+		//   sent right away and duplicates of delivered pkts are answered
+		//   with another ACK, so the sender never waits on us.
+		if(popReady(s, buf, cc, from))
+		{
+			ret = 1;
+		}
+		else if(s->_nonblock)
+		{
+			// Take in whatever is queued on the socket and stop
+			while(winRecv(rfd, s, 1))
 			{
-				//printf("ACK_FromReceiver has FAILED\n");
-				ret = 0;
 			}
+			winTimers(rfd, s);
+			ret = popReady(s, buf, cc, from);
+			break;
 		}
 		else
 		{
-			//printf("ReceiveDataPkt_FromReceiver has FAILED\n");
-			ret = 0;
+			winService(rfd, s, -1);
 		}
 	}
+	txFlush(rfd, s);
 	return ret;
 }
 
 //
-// performChecksum
+// rup_writemsg
 //
-// Description: Compute a checksum for on the pkt _msgbuf data.
+// Description: Send a message of any size up to RUP_MAXMSG from one buffer.
 //
-// Input: struct pkt* p - A pointer to the pkt to perform the checksum.
-// Output: int result - Returns the integer value of the checksum computed.
-int performChecksum(struct pkt* p)
+// Input: int rfd - A valid RUP file descriptor.
+// Input: void* buf - The message.
+// Input: int len - The message byte count.
+// Input: struct sockaddr_in* to - The receiver's address.
+// Output: int - Returns 1 on success and 0 on failure.
+int rup_writemsg(int rfd, void* buf, int len, struct sockaddr_in* to)
 {
 	// Variable declarations
-	int i, j, result;
-	char c;
-	struct pkt* curPkt;
-
-	// Variable assignments
-	i = 0;
-	j = 0;
-	result = 0;
-	curPkt = p;
+	struct iovec iov;
 
-	// loop through the max length of the payload, BUFSIZE.
-	for(i = 0;i < BUFSIZE;++i)
+	if(len < 0)
 	{
-		// assign the temp char, c, to each char in msgbuf.
-		c = curPkt->_msgbuf[i];
-
-		// loop through the char bit by bit
-		for(j = 0;j < ((sizeof(char))*8);++j)
-		{
-			// if the AND process, &, results in a one(1), then add
-			//   one to the result
-			if(c & (1<<j))
-			{
-				result++;
-			}
-		}
+		return 0;
 	}
-	return result;
+
+	// Variable assignments
+	iov.iov_base = buf;
+	iov.iov_len = len;
+
+	return rup_writev(rfd, &iov, 1, to);
 }
 
 //
-// sendDataPkt_FromSender
+// rup_writev
 //
-// Description: Send a pkt to a remote system and receive an ACK to confirm
-//                the data was received.
+// Description: Send the bytes of an iovec array as one message of up to
+//               RUP_MAXMSG.  It goes out as RUP_FRAGSIZE fragments, each
+//               gathered straight from the iovecs into its send window
+//               slot, as many in flight at once as the window allows, and
+//               the receiver hands it back whole.
 //
 // Input: int rfd - A valid RUP file descriptor.
-// Input: void* buf - A pointer to the data being sent.
-// Input: int cc - The byte count/size of buf.
-// Input: struct sockaddr_in* to - A socket address structure containing
-//          ip address and port number of the local machine.
-// Output: int sendPkt - Returns 1 on success and 0 on failure.
-int sendDataPkt_FromSender(int rfd, void* buf, int cc, struct sockaddr_in* to)
+// Input: const struct iovec* iov - The message's pieces.
+// Input: int iovcnt - The number of pieces.
+// Input: struct sockaddr_in* to - The receiver's address.
+// Output: int - Returns 1 on success and 0 on failure.
+int rup_writev(int rfd, const struct iovec* iov, int iovcnt, struct sockaddr_in* to)
 {
 	// Variable declarations
-	int rc, sendPkt, selret, pktID, inChecksum, sendingPkt;
-	unsigned int fromlen;
-	char* tns;
-	char* fns;
-	struct pkt inBuf;
-	struct sockaddr_in from;
-	struct timeval tval;
-	fd_set rfds;
+	int i, ret, off, n, len, nfrag, failed;
+	long long start;
+	size_t total;
+	struct rupSock* s;
+	struct rupPeer* p;
+	struct winSlot* slot;
+	struct rupOpts o;
+	struct rupCursor c;
+	unsigned char frame[RUP_MAXFRAME];
 
 	// Variable assignments
-	sendPkt = 0;
-	selret = 0;
-	pktID = ((struct pkt*)buf)->_id;
-	sendingPkt = 1;
-	fromlen = sizeof(struct sockaddr_in);
+	total = 0;
+
+	for(i = 0;i < iovcnt;++i)
+	{
+		total += iov[i].iov_len;
+	}
+	if((iovcnt < 0) || (total > RUP_MAXMSG))
+	{
+		return 0;
+	}
 
-	memset((char*)&inBuf,0,sizeof(struct pkt));
+	ret = 1;
+	len = (int)total;
+	s = getSock(rfd);
+	p = getPeer(s, to);
+	nfrag = (len + RUP_FRAGSIZE - 1) / RUP_FRAGSIZE;
+	nfrag = (nfrag > 0) ? nfrag : 1;
+	c._iov = iov;
+	c._cnt = iovcnt;
+	c._idx = 0;
+	c._pos = 0;
 
-	// getting the to address into a variable
-	tns = inet_ntoa(to->sin_addr);
+	// An unreliable message of one fragment goes out once, whatever the
+	//   window holds
+	if((s->_deliver == RUP_DELIVER_UNRELIABLE) && (nfrag == 1))
+	{
+		memset((char*)&o,0,sizeof(struct rupOpts));
+		o._msgId = p->_sndMsgId++;
+		o._msgTotal = len;
+		winDatagram(rfd, s, p, frame, encodeFrag(p, &c, len, &o, frame));
+		if(!(s->_offload & RUP_OFFLOAD_GSO))
+		{
+			txFlush(rfd, s);
+		}
+		return 1;
+	}
 
-	while(sendPkt != 1)
+	// A non-blocking socket only takes a message its window can hold now
+	if(s->_nonblock)
 	{
-		//printf("sendDataPkt_FromSender(): sendPkt = %d\n", sendPkt);
-		if(sendingPkt)
+		if((int)(p->_sndNext - p->_sndBase) + nfrag > s->_window)
 		{
-			// Send a pkt to reader
-			if( sendto(rfd, (char*)buf, cc, 0, (struct sockaddr*)to, fromlen) < 0 )
+			while(winRecv(rfd, s, 1))
 			{
-				printf("ERROR in sendDataPkt_FromSender() - sendto()");
-				exit(0);
 			}
-
-			tval.tv_sec = 0;
-			tval.tv_usec = 100000;
-
-			// set socket for select call
-			FD_ZERO(&rfds); 
-			FD_SET(rfd,&rfds);
-
-			// Set timer for reading on the socket
-			selret = select(rfd+1,&rfds,NULL,NULL,&tval);
-
-			if(selret != 0)
+			winTimers(rfd, s);
+			if((int)(p->_sndNext - p->_sndBase) + nfrag > s->_window)
 			{
-				// Wait for ACK
-#ifdef _WIN32_
-				if((rc=recvfrom(rfd, (char*)&inBuf, sizeof(struct pkt), 0, (struct sockaddr*)(&from), (int*)&fromlen)) < 0 )
-#else
-				if((rc=recvfrom(rfd, &inBuf, sizeof(struct pkt), 0, (struct sockaddr*)(&from), &fromlen)) < 0 )
-#endif
-				{
-					printf("ERROR in sendDataPkt_FromSender().\n");
-					printf("Write error: errno %d\n",errno);
-					printf("reading datagram");
-					exit(0);
-				}
+				txFlush(rfd, s);
+				return 0;
+			}
+		}
+	}
 
-				// assign checksum to checksum pkt
-				inChecksum = performChecksum(((struct pkt*)(&inBuf)));
+	memset((char*)&o,0,sizeof(struct rupOpts));
+	o._msgId = p->_sndMsgId++;
+	o._msgTotal = len;
+	failed = p->_failed;
+	start = rupNow();
 
-				// getting the from address into a variable
-				fns = inet_ntoa(from.sin_addr);
+	for(off = 0;(off < len) || (off == 0);off += n)
+	{
+		n = (len - off < RUP_FRAGSIZE) ? len - off : RUP_FRAGSIZE;
+		o._msgOff = off;
+		slot = winReserve(rfd, s, p);
 
-				// Check pkt for ACK
-				if((inBuf._ackvar == ACK)&&(from.sin_port == to->sin_port)&&(pktID == inBuf._id)&&(!(strcmp(fns,tns))))
-				{
-					//printf("sendDataPkt_FromSender() - setting return value to 1\n");
-					//printf("ackvar = %c\n", inBuf._ackvar);
-					sendPkt = 1;
-				}
-				else
-				{
-					//printf("received someone else's data pkt and disregarding it\n");
-					sendPkt = 0;
-				}
-			}
-			else
-			{
-				//printf("No pkt received(sendDataPkt_FromSender)...select returned %d\n",selret);
-				sendPkt = 0;
-			}
+		// Waiting for room can fail the peer, which empties its window,
+		//   so the rest of the message would only fail fragment by
+		//   fragment
+		if(p->_failed != failed)
+		{
+			break;
 		}
-		else
+		slot->_len = encodeFrag(p, &c, n, &o, slot->_frame);
+		slot->_metaVer = -1;
+		slot->_queued = (off + n >= len) ? start : 0;
+		winCommit(rfd, p, slot);
+		if(n == 0)
+		{
+			break;
+		}
+	}
+
+	// Without a window the caller waits for the last ACK, as rup_write does
+	if((s->_window == 1) && (!s->_nonblock))
+	{
+		while(p->_sndBase != p->_sndNext)
 		{
-			sendingPkt = 1;
+			winService(rfd, s, -1);
 		}
 	}
-	return sendPkt;
+	if(p->_failed != failed)
+	{
+		ret = 0;
+	}
+
+	if((!(s->_offload & RUP_OFFLOAD_GSO)) || (s->_window == 1) || ((int)(p->_sndNext - p->_sndBase) >= s->_window))
+	{
+		txFlush(rfd, s);
+	}
+	return ret;
 }
 
 //
-// pktSentSuccessfully_FromSender
+// rup_readmsg
 //
-// Description: Send an ACK to notify the receiver that the sender
-//                is aware the pkt was received at the receiver successfully.
+// Description: Read the next message sent with rup_writemsg or rup_writev
+//               into one buffer.
 //
 // Input: int rfd - A valid RUP file descriptor.
-// Input: void* buf - A pointer to the data being sent.
-// Input: int cc - The byte count/size of buf.
-// Input: struct sockaddr_in* to - A socket address structure containing
-//          ip address and port number of the local machine.
-// Output: int pktSent - Returns 1 on success and 0 on failure.
-int pktSentSuccessfully_FromSender(int rfd, void* buf, int cc, struct sockaddr_in* to)
+// Input: void* buf - Filled with the message, up to cap bytes.
+// Input: int cap - The byte count of buf.
+// Input: struct sockaddr_in* from - Set to the sender's address if not NULL.
+// Output: int len - The message byte count, which is more than cap when the
+//           message was cut short, or -1 if the socket is non-blocking and
+//           no message is waiting.
+int rup_readmsg(int rfd, void* buf, int cap, struct sockaddr_in* from)
+{
+	// Variable declarations
+	struct iovec iov;
+
+	// Variable assignments
+	iov.iov_base = buf;
+	iov.iov_len = (cap > 0) ? cap : 0;
+
+	return rup_readv(rfd, &iov, 1, from);
+}
+
+//
+// rup_readv
+//
+// Description: Read the next message sent with rup_writemsg or rup_writev,
+//               scattering it across an iovec array.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: const struct iovec* iov - The buffers to fill, in order.
+// Input: int iovcnt - The number of buffers.
+// Input: struct sockaddr_in* from - Set to the sender's address if not NULL.
+// Output: int len - The message byte count, which is more than the buffers
+//           hold when the message was cut short, or -1 if the socket is
+//           non-blocking and no message is waiting.
+int rup_readv(int rfd, const struct iovec* iov, int iovcnt, struct sockaddr_in* from)
+{
+	return msgRead(rfd, NULL, iov, iovcnt, from);
+}
+
+//
+// rup_readstream
+//
+// Description: Read the next message of one stream, or of any stream,
+//               into one buffer.  Messages of the other streams wait for
+//               their own reads.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int* stream - The stream to read, or RUP_ANYSTREAM, set to the
+//          stream the message came on.
+// Input: void* buf - Filled with the message, up to cap bytes.
+// Input: int cap - The byte count of buf.
+// Input: struct sockaddr_in* from - Set to the sender's address if not NULL.
+// Output: int len - The message byte count, which is more than cap when the
+//           message was cut short, or -1 if the socket is non-blocking and
+//           no message is waiting.
+int rup_readstream(int rfd, int* stream, void* buf, int cap, struct sockaddr_in* from)
+{
+	// Variable declarations
+	struct iovec iov;
+
+	// Variable assignments
+	iov.iov_base = buf;
+	iov.iov_len = (cap > 0) ? cap : 0;
+
+	return msgRead(rfd, stream, &iov, 1, from);
+}
+
+//
+// msgRead
+//
+// Description: Wait for a message of the stream wanted, unless the socket
+//                is non-blocking, and scatter it across the caller's
+//                iovecs.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int* stream - The stream wanted, NULL or RUP_ANYSTREAM for any,
+//          set to the message's stream.
+// Input: const struct iovec* iov - The buffers to fill, in order.
+// Input: int iovcnt - The number of buffers.
+// Input: struct sockaddr_in* from - Set to the sender's address if not NULL.
+// Output: int len - The message byte count, or -1 if the socket is
+//           non-blocking and no message is waiting.
+int msgRead(int rfd, int* stream, const struct iovec* iov, int iovcnt, struct sockaddr_in* from)
+{
+	// Variable declarations
+	int ret;
+	struct rupSock* s;
+	struct rupCursor c;
+
+	// Variable assignments
+	s = getSock(rfd);
+	c._iov = iov;
+	c._cnt = (iovcnt > 0) ? iovcnt : 0;
+	c._idx = 0;
+	c._pos = 0;
+
+	while((ret = popMsg(s, stream, &c, from)) < 0)
+	{
+		if(s->_nonblock)
+		{
+			while(winRecv(rfd, s, 1))
+			{
+			}
+			winTimers(rfd, s);
+			ret = popMsg(s, stream, &c, from);
+			break;
+		}
+		winService(rfd, s, -1);
+	}
+	txFlush(rfd, s);
+	return ret;
+}
+
+//
+// rup_setwindow
+//
+// Description: Set how many pkts rup_write may have in flight to one receiver
+//               before it blocks waiting for ACKs.  A window of 1 keeps the
+//               stop-and-wait handshake.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int window - Number of unacknowledged pkts allowed, 1 to RUP_MAXWINDOW.
+// Output: int - Returns 0 on success and -1 on failure.
+int rup_setwindow(int rfd, int window)
+{
+	// Variable declarations
+	struct rupSock* s;
+
+	if((window < 1) || (window > RUP_MAXWINDOW))
+	{
+		return -1;
+	}
+
+	// Variable assignments
+	s = getSock(rfd);
+
+	s->_window = window;
+	return 0;
+}
+
+//
+// rup_setcongestion
+//
+// Description: Choose the congestion controller that limits how many of a
+//               socket's window slots each peer may have in flight.  Frames
+//               beyond it wait in the window until ACKs make room.  Every
+//               peer restarts from the controller's initial window.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int cc - RUP_CC_NONE, RUP_CC_NEWRENO or RUP_CC_DELAY.
+// Output: int - Returns 0 on success and -1 on failure.
+int rup_setcongestion(int rfd, int cc)
+{
+	// Variable declarations
+	struct rupSock* s;
+	struct rupPeer* p;
+
+	if((cc < RUP_CC_NONE) || (cc > RUP_CC_DELAY))
+	{
+		return -1;
+	}
+
+	// Variable assignments
+	s = getSock(rfd);
+
+	s->_cc = cc;
+	for(p = s->_peers;p != NULL;p = p->_next)
+	{
+		ccInit(p);
+	}
+	return 0;
+}
+
+//
+// rup_setpacing
+//
+// Description: Spread new frames over the round trip instead of sending a
+//               window's worth back to back.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int on - Nonzero to pace, 0 to send as soon as the window allows.
+// Output: int - Returns 0 on success.
+int rup_setpacing(int rfd, int on)
+{
+	// Variable declarations
+	struct rupSock* s;
+
+	// Variable assignments
+	s = getSock(rfd);
+
+	s->_pacing = on ? 1 : 0;
+	return 0;
+}
+
+//
+// rup_setrcvbuf
+//
+// Description: Set how many frames, pkts or message fragments, the socket
+//               holds for the application before it stops offering its
+//               peers room to send more.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int frames - The buffer size in frames, at least 1.
+// Output: int - Returns 0 on success and -1 on failure.
+int rup_setrcvbuf(int rfd, int frames)
+{
+	// Variable declarations
+	struct rupSock* s;
+
+	if(frames < 1)
+	{
+		return -1;
+	}
+
+	// Variable assignments
+	s = getSock(rfd);
+
+	s->_rcvBuf = frames;
+	s->_wndLow = 1;
+	rcvUpdate(s);
+	return 0;
+}
+
+//
+// rup_setmaxpeers
+//
+// Description: Set how many remote addresses the socket keeps state for.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int peers - The most peers, at least 1.
+// Output: int - Returns 0 on success and -1 on failure.
+int rup_setmaxpeers(int rfd, int peers)
+{
+	// Variable declarations
+	struct rupSock* s;
+
+	if(peers < 1)
+	{
+		return -1;
+	}
+
+	// Variable assignments
+	s = getSock(rfd);
+
+	s->_maxPeers = peers;
+	return 0;
+}
+
+//
+// rup_setdelivery
+//
+// Description: Choose the delivery class of the pkts and messages written
+//               from now on, and the limits of RUP_DELIVER_PARTIAL.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int mode - One of the RUP_DELIVER_* classes.
+// Input: int tries - Transmissions of a partial frame, 0 for no limit.
+// Input: int budget_ms - Lifetime of a partial frame, 0 for no limit.
+// Output: int - Returns 0 on success and -1 on failure.
+int rup_setdelivery(int rfd, int mode, int tries, int budget_ms)
+{
+	// Variable declarations
+	struct rupSock* s;
+
+	if((mode < RUP_DELIVER_ORDERED) || (mode > RUP_DELIVER_UNRELIABLE) || (tries < 0) || (budget_ms < 0))
+	{
+		return -1;
+	}
+
+	// Variable assignments
+	s = getSock(rfd);
+
+	s->_deliver = mode;
+	s->_partTries = tries;
+	s->_partBudget = (long long)budget_ms * 1000;
+	return 0;
+}
+
+//
+// rup_getdelivery
+//
+// Description: Report the counters of one delivery class of a socket.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int mode - One of the RUP_DELIVER_* classes.
+// Input: struct rup_deliveryinfo* info - Filled in with the counters.
+// Output: int - Returns 0 on success and -1 on failure.
+int rup_getdelivery(int rfd, int mode, struct rup_deliveryinfo* info)
+{
+	if((mode < RUP_DELIVER_ORDERED) || (mode > RUP_DELIVER_UNRELIABLE))
+	{
+		return -1;
+	}
+
+	*info = getSock(rfd)->_classes[mode];
+	return 0;
+}
+
+//
+// rup_setstream
+//
+// Description: Choose the stream the pkts and messages written from now on
+//               go on.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int stream - The stream, 0 to RUP_MAXSTREAMS - 1.
+// Output: int - Returns 0 on success and -1 on failure.
+int rup_setstream(int rfd, int stream)
+{
+	if((stream < 0) || (stream >= RUP_MAXSTREAMS))
+	{
+		return -1;
+	}
+
+	getSock(rfd)->_stream = stream;
+	return 0;
+}
+
+//
+// rup_flush
+//
+// Description: Block until every pkt queued by a windowed rup_write has been
+//               acknowledged by its receiver.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Output: int ret - Returns 1 on success and 0 on failure.
+int rup_flush(int rfd)
+{
+	// Variable declarations
+	int ret, failed;
+	struct rupSock* s;
+
+	// Variable assignments
+	ret = 1;
+	s = getSock(rfd);
+	failed = s->_failed;
+
+	// A delayed ACK the peer is waiting on goes out now
+	winAckFlush(rfd, s, 1);
+
+	while(winPending(s))
+	{
+		winService(rfd, s, -1);
+	}
+	txFlush(rfd, s);
+
+	// Some receiver stopped answering before it had everything
+	if(s->_failed != failed)
+	{
+		ret = 0;
+	}
+	return ret;
+}
+
+//
+// rup_pending
+//
+// Description: Count the frames sent to a peer, or to every peer, that are
+//               still waiting for an ACK.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct sockaddr_in* peer - The remote ip address and port number,
+//          NULL for every peer.
+// Output: int count - The frames in flight.
+int rup_pending(int rfd, struct sockaddr_in* peer)
+{
+	// Variable declarations
+	int count;
+	struct rupSock* s;
+	struct rupPeer* p;
+
+	// Variable assignments
+	count = 0;
+	s = getSock(rfd);
+
+	for(p = s->_peers;p != NULL;p = p->_next)
+	{
+		if((peer == NULL) || ((p->_addr.sin_addr.s_addr == peer->sin_addr.s_addr) && (p->_addr.sin_port == peer->sin_port)))
+		{
+			count += (int)(p->_sndNext - p->_sndBase);
+		}
+	}
+	return count;
+}
+
+//
+// rup_linger
+//
+// Description: Report how long rup_close would still answer retransmits
+//               if it were called now.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Output: long long - Microseconds left, 0 when rup_close would return at once.
+long long rup_linger(int rfd)
+{
+	// Variable declarations
+	long long left;
+
+	// Variable assignments
+	left = winLingerEnd(getSock(rfd)) - rupNow();
+
+	return (left > 0) ? left : 0;
+}
+
+//
+// rup_setdelack
+//
+// Description: Let the receiver hold its ACK for in order pkts, either until
+//               a pkt of its own can carry it back, every pkts have arrived
+//               or delay_us microseconds have passed.  Pkts that show loss
+//               are still acknowledged at once.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int delay_us - Longest hold in microseconds, 0 to ACK every pkt.
+// Input: int every - ACK at least once for this many pkts, 1 to RUP_MAXWINDOW.
+// Output: int - Returns 0 on success and -1 on failure.
+int rup_setdelack(int rfd, int delay_us, int every)
+{
+	// Variable declarations
+	struct rupSock* s;
+
+	if((delay_us < 0) || (delay_us > RUP_INITRTO_US / 2) || (every < 1) || (every > RUP_MAXWINDOW))
+	{
+		return -1;
+	}
+
+	// Variable assignments
+	s = getSock(rfd);
+
+	s->_ackDelay = delay_us;
+	s->_ackEvery = every;
+	return 0;
+}
+
+//
+// rup_getrtt
+//
+// Description: Report the round trip estimator kept for a peer.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct sockaddr_in* peer - The remote ip address and port number.
+// Input: struct rup_rttinfo* info - Filled in with the peer's estimator.
+// Output: int - Returns 0 on success and -1 if the peer is unknown.
+int rup_getrtt(int rfd, struct sockaddr_in* peer, struct rup_rttinfo* info)
+{
+	// Variable declarations
+	struct rupSock* s;
+	struct rupPeer* p;
+
+	// Variable assignments
+	s = getSock(rfd);
+
+	for(p = s->_peers;p != NULL;p = p->_next)
+	{
+		if((p->_addr.sin_addr.s_addr == peer->sin_addr.s_addr) && (p->_addr.sin_port == peer->sin_port))
+		{
+			info->_srtt = p->_srtt;
+			info->_rttvar = p->_rttvar;
+			info->_rto = p->_rto;
+			info->_samples = p->_samples;
+			info->_cwnd = winLimit(s, p);
+			info->_ssthresh = p->_ssthresh;
+			info->_rwnd = p->_rwnd;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+//
+// rup_getconn
+//
+// Description: Report the connection set up with a peer.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct sockaddr_in* peer - The remote ip address and port number.
+// Input: struct rup_conninfo* info - Filled in with the connection.
+// Output: int - Returns 0 on success and -1 if the peer is unknown.
+int rup_getconn(int rfd, struct sockaddr_in* peer, struct rup_conninfo* info)
+{
+	// Variable declarations
+	struct rupSock* s;
+	struct rupPeer* p;
+
+	// Variable assignments
+	s = getSock(rfd);
+
+	for(p = s->_peers;p != NULL;p = p->_next)
+	{
+		if((p->_addr.sin_addr.s_addr == peer->sin_addr.s_addr) && (p->_addr.sin_port == peer->sin_port))
+		{
+			info->_cid = p->_cid;
+			info->_peerCid = p->_peerCid;
+			info->_window = p->_peerWnd;
+			info->_mtu = p->_peerMtu;
+			info->_cksum = p->_peerCksum;
+			info->_resumed = p->_resumed;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+//
+// rup_getstats
+//
+// Description: Report the traffic of a socket, its peers' counters added
+//               to the frames it dropped before finding a peer.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rup_stats* stats - Filled in with the counters.
+// Output: int - Returns 0 on success.
+int rup_getstats(int rfd, struct rup_stats* stats)
+{
+	// Variable declarations
+	struct rupSock* s;
+	struct rupPeer* p;
+
+	// Variable assignments
+	s = getSock(rfd);
+
+	memcpy((char*)stats, (char*)&s->_stats, sizeof(struct rup_stats));
+	for(p = s->_peers;p != NULL;p = p->_next)
+	{
+		statsAdd(stats, &p->_stats);
+	}
+	return 0;
+}
+
+//
+// rup_getpeerstats
+//
+// Description: Report the traffic to and from one peer of a socket.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct sockaddr_in* peer - The remote ip address and port number.
+// Input: struct rup_stats* stats - Filled in with the peer's counters.
+// Output: int - Returns 0 on success and -1 if the peer is unknown.
+int rup_getpeerstats(int rfd, struct sockaddr_in* peer, struct rup_stats* stats)
+{
+	// Variable declarations
+	struct rupSock* s;
+	struct rupPeer* p;
+
+	// Variable assignments
+	s = getSock(rfd);
+
+	for(p = s->_peers;p != NULL;p = p->_next)
+	{
+		if((p->_addr.sin_addr.s_addr == peer->sin_addr.s_addr) && (p->_addr.sin_port == peer->sin_port))
+		{
+			memcpy((char*)stats, (char*)&p->_stats, sizeof(struct rup_stats));
+			return 0;
+		}
+	}
+	return -1;
+}
+
+//
+// rup_histpercentile
+//
+// Description: Read a percentile off a histogram: the top of the bucket
+//               holding it, kept within the smallest and largest values.
+//
+// Input: struct rup_histogram* h - The histogram.
+// Input: double pct - The percentile, 50 for the median.
+// Output: long long - The time in microseconds, 0 for an empty histogram.
+long long rup_histpercentile(struct rup_histogram* h, double pct)
+{
+	// Variable declarations
+	int i;
+	long long rank, seen, v;
+
+	if(h->_count == 0)
+	{
+		return 0;
+	}
+
+	// Variable assignments
+	rank = (long long)((pct / 100.0) * (double)h->_count + 0.5);
+	rank = (rank < 1) ? 1 : ((rank > h->_count) ? h->_count : rank);
+	seen = 0;
+	v = h->_max;
+
+	for(i = 0;i < RUP_HISTBUCKETS;++i)
+	{
+		seen += h->_buckets[i];
+		if(seen >= rank)
+		{
+			v = histTop(i);
+			break;
+		}
+	}
+	v = (v > h->_max) ? h->_max : v;
+	return (v < h->_min) ? h->_min : v;
+}
+
+//
+// rup_setchecksum
+//
+// Description: Choose the checksum engine used for the frames a socket sends.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int type - RUP_CKSUM_NONE, RUP_CKSUM_POPCOUNT or RUP_CKSUM_CRC32C.
+// Output: int - Returns 0 on success and -1 on failure.
+int rup_setchecksum(int rfd, int type)
+{
+	if((type < RUP_CKSUM_NONE) || (type > RUP_CKSUM_CRC32C))
+	{
+		return -1;
+	}
+	getSock(rfd)->_cksum = type;
+	return 0;
+}
+
+//
+// rup_checksum
+//
+// Description: Run one of the checksum engines over a buffer.
+//
+// Input: int type - RUP_CKSUM_NONE, RUP_CKSUM_POPCOUNT, RUP_CKSUM_CRC32C,
+//          or RUP_CKSUM_CRC32C_SOFT to force the table driven CRC32C.
+// Input: const void* buf - The buffer.
+// Input: int len - The byte count of the buffer.
+// Output: unsigned int - The checksum.
+unsigned int rup_checksum(int type, const void* buf, int len)
+{
+	// Variable declarations
+	unsigned int result;
+
+	// Variable assignments
+	result = 0;
+
+	switch(type)
+	{
+	case RUP_CKSUM_POPCOUNT:
+		result = popcountSum((const unsigned char*)buf, len);
+		break;
+	case RUP_CKSUM_CRC32C:
+		result = crc32cUpdate(0xFFFFFFFF, (const unsigned char*)buf, len) ^ 0xFFFFFFFF;
+		break;
+	case RUP_CKSUM_CRC32C_SOFT:
+		result = crc32cSoft(0xFFFFFFFF, (const unsigned char*)buf, len) ^ 0xFFFFFFFF;
+		break;
+	default:
+		break;
+	}
+	return result;
+}
+
+//
+// rup_setnonblock
+//
+// Description: Turn non-blocking mode on or off.  In non-blocking mode
+//               rup_read returns 0 when no pkt is waiting and rup_write
+//               returns 0 when the peer's window is full; neither waits
+//               for an ACK.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int on - Nonzero for non-blocking mode.
+// Output: int - Returns 0 on success.
+int rup_setnonblock(int rfd, int on)
+{
+	// Variable declarations
+	struct rupSock* s;
+
+	// Variable assignments
+	s = getSock(rfd);
+
+	s->_nonblock = (on) ? 1 : 0;
+	return 0;
+}
+
+//
+// rup_setcallback
+//
+// Description: Have rup_process hand the pkts arriving on a socket to a
+//               callback instead of queueing them for rup_read.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: rup_callback cb - The callback, NULL to queue pkts again.
+// Input: void* arg - Passed through to the callback.
+// Output: int - Returns 0 on success.
+int rup_setcallback(int rfd, rup_callback cb, void* arg)
+{
+	// Variable declarations
+	struct rupSock* s;
+
+	// Variable assignments
+	s = getSock(rfd);
+
+	s->_cb = cb;
+	s->_cbArg = arg;
+	return 0;
+}
+
+//
+// rup_setoffload
+//
+// Description: Ask the kernel to segment runs of equal sized frames sent to
+//               one peer (GSO) and to coalesce the datagrams it receives
+//               (GRO).  Each is only turned on if the kernel supports it.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int flags - RUP_OFFLOAD_GSO and/or RUP_OFFLOAD_GRO, 0 for neither.
+// Output: int - Returns the offloads now in use.
+int rup_setoffload(int rfd, int flags)
+{
+	// Variable declarations
+	int ret;
+	struct rupSock* s;
+#if !defined(_WIN32_) && defined(UDP_SEGMENT)
+	int on;
+#endif
+
+	// Variable assignments
+	ret = 0;
+	s = getSock(rfd);
+
+	// A provided receive buffer holds a single frame
+	if(s->_ring != NULL)
+	{
+		flags &= ~RUP_OFFLOAD_GRO;
+	}
+
+#if !defined(_WIN32_) && defined(UDP_SEGMENT)
+	// The option only exists on kernels that can segment, setting it to
+	//   0 leaves every send unsegmented unless it asks otherwise
+	on = 0;
+	if((flags & RUP_OFFLOAD_GSO) && (setsockopt(rfd, IPPROTO_UDP, UDP_SEGMENT, (char*)&on, sizeof(on)) == 0))
+	{
+		ret |= RUP_OFFLOAD_GSO;
+	}
+
+	on = (flags & RUP_OFFLOAD_GRO) ? 1 : 0;
+	if(((on) || (s->_offload & RUP_OFFLOAD_GRO)) && (setsockopt(rfd, IPPROTO_UDP, UDP_GRO, (char*)&on, sizeof(on)) == 0) && (on))
+	{
+		ret |= RUP_OFFLOAD_GRO;
+		if(s->_groBuf == NULL)
+		{
+			s->_groBuf = new unsigned char[RUP_GROBATCH * RUP_GROSIZE];
+			rupAllocs._allocs++;
+		}
+	}
+#endif
+
+	s->_offload = ret;
+	return ret;
+}
+
+//
+// rup_setbatch
+//
+// Description: Send and read up to RUP_BATCH datagrams per system call, or
+//               one per call to measure what batching saves.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int on - Nonzero to batch, 0 for one datagram per system call.
+// Output: int - Returns 0 on success.
+int rup_setbatch(int rfd, int on)
+{
+	// Variable declarations
+	struct rupSock* s;
+
+	// Variable assignments
+	s = getSock(rfd);
+
+	s->_perPacket = on ? 0 : 1;
+	return 0;
+}
+
+//
+// rup_setimpair
+//
+// Description: Put a simulated network link under the frames a socket
+//               sends, or take it away.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rup_impair* cfg - The link, NULL for none.
+// Output: int - Returns 0 on success and -1 on failure.
+int rup_setimpair(int rfd, struct rup_impair* cfg)
+{
+	// Variable declarations
+	struct rupSock* s;
+	struct rupSim* m;
+
+	if((cfg != NULL) && ((cfg->_loss < 0) || (cfg->_loss > 100) || (cfg->_burst < 0) || (cfg->_dup < 0) || (cfg->_dup > 100) ||
+		(cfg->_reorder < 0) || (cfg->_reorder > 100) || (cfg->_reorderDepth < 0) || (cfg->_corrupt < 0) || (cfg->_corrupt > 100) ||
+		(cfg->_delay_us < 0) || (cfg->_jitter_us < 0) || (cfg->_rate < 0) || (cfg->_queue < 0)))
+	{
+		return -1;
+	}
+
+	// Variable assignments
+	s = getSock(rfd);
+
+	// Frames still on the old link go out at once
+	simClose(rfd, s);
+	if(cfg == NULL)
+	{
+		return 0;
+	}
+
+	m = new struct rupSim;
+	memset((char*)m,0,sizeof(struct rupSim));
+	m->_cfg = *cfg;
+	m->_rng = cfg->_seed;
+	m->_cap = (cfg->_queue > 0) ? cfg->_queue : RUP_SIMQUEUE;
+	m->_held = new struct simFrame[m->_cap];
+	rupAllocs._allocs += 2;
+	s->_sim = m;
+	return 0;
+}
+
+//
+// rup_getimpair
+//
+// Description: Report what a socket's simulated link has done so far.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rup_impairinfo* info - Filled in with the counters.
+// Output: int - Returns 0 on success and -1 if the socket has no link.
+int rup_getimpair(int rfd, struct rup_impairinfo* info)
+{
+	// Variable declarations
+	struct rupSock* s;
+
+	// Variable assignments
+	s = getSock(rfd);
+
+	if(s->_sim == NULL)
+	{
+		return -1;
+	}
+	*info = s->_sim->_info;
+	return 0;
+}
+
+//
+// rup_poll
+//
+// Description: Register a socket with the calling thread's reactor,
+//               driven by rup_process on that thread, and put it in
+//               non-blocking mode.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Output: int - Returns 0 on success and -1 on failure.
+int rup_poll(int rfd)
+{
+	// Variable declarations
+	struct rupSock* s;
+#ifndef _WIN32_
+	struct epoll_event ev;
+#endif
+
+	// Variable assignments
+	s = getSock(rfd);
+
+	if(s->_polled)
+	{
+		return 0;
+	}
+
+	if(rupPolledLen >= RUP_MAXSOCKS)
+	{
+		printf("UDP Error: too many sockets in one reactor\n");
+		return -1;
+	}
+
+#ifndef _WIN32_
+	if(rupEpfd < 0)
+	{
+		rupEpfd = epoll_create(RUP_MAXSOCKS);
+		if(rupEpfd < 0)
+		{
+			printf("UDP Error: epoll_create() call in rup_poll\n");
+			return -1;
+		}
+	}
+
+	memset((char*)&ev,0,sizeof(struct epoll_event));
+	ev.events = EPOLLIN;
+	ev.data.ptr = s;
+	if(epoll_ctl(rupEpfd, EPOLL_CTL_ADD, pollFd(s), &ev) < 0)
+	{
+		printf("UDP Error: epoll_ctl() call in rup_poll\n");
+		return -1;
+	}
+#endif
+
+	rupPolled[rupPolledLen++] = s;
+	s->_polled = 1;
+	s->_nonblock = 1;
+	return 0;
+}
+
+//
+// rup_process
+//
+// Description: Run the calling thread's reactor once.  Waits until one of
+//               its sockets has datagrams, a timer is due or timeout_ms
+//               has passed, then reads what arrived, sends due ACKs and
+//               retransmits, and hands each in order pkt to its socket's
+//               callback.
+//
+// Input: int timeout_ms - Longest wait in milliseconds, -1 for no limit
+//          and 0 to only do the work already pending.
+// Output: int count - Returns the number of pkts handed to callbacks plus
+//           those queued for rup_read, or -1 if nothing is registered.
+int rup_process(int timeout_ms)
+{
+	// Variable declarations
+	int i, j, n, fd, count;
+	long long now, wait;
+	struct rupSock* s;
+	struct pkt inPkt;
+	struct sockaddr_in from;
+#ifdef _WIN32_
+	int maxfd;
+	struct timeval tval;
+	fd_set rfds;
+#else
+	int rc;
+	struct epoll_event ev[RUP_MAXSOCKS];
+#endif
+
+	// Variable assignments
+	count = 0;
+	now = rupNow();
+	wait = (timeout_ms < 0) ? -1 : (long long)timeout_ms * 1000;
+
+	// Sleep no longer than the earliest timer of any registered socket,
+	//   and not at all while pkts are already waiting to be handed out
+	for(i = 0;i < rupPolledLen;++i)
+	{
+		s = rupPolled[i];
+		txFlush(s->_fd, s);
+		wait = winDeadline(s, now, wait);
+		if(s->_readyHead != NULL)
+		{
+			wait = 0;
+		}
+	}
+
+	if(rupPolledLen == 0)
+	{
+		return -1;
+	}
+
+#ifdef _WIN32_
+	maxfd = 0;
+	FD_ZERO(&rfds);
+	for(i = 0;i < rupPolledLen;++i)
+	{
+		s = rupPolled[i];
+		FD_SET(s->_fd,&rfds);
+		maxfd = (s->_fd > maxfd) ? s->_fd : maxfd;
+	}
+	tval.tv_sec = (long)(wait / 1000000);
+	tval.tv_usec = (long)(wait % 1000000);
+	if(select(maxfd+1,&rfds,NULL,NULL,(wait < 0) ? NULL : &tval) > 0)
+	{
+		for(i = 0;i < rupPolledLen;++i)
+		{
+			s = rupPolled[i];
+			if(FD_ISSET(s->_fd,&rfds))
+			{
+				for(j = 0;(j < RUP_RECVBURST) && (winRecv(s->_fd, s, 1));++j)
+				{
+				}
+			}
+		}
+	}
+#else
+	// epoll counts in milliseconds, round up so a timer is never early
+	n = epoll_wait(rupEpfd, ev, RUP_MAXSOCKS, (wait < 0) ? -1 : (int)((wait + 999) / 1000));
+	for(i = 0;i < n;++i)
+	{
+		s = (struct rupSock*)ev[i].data.ptr;
+		for(j = 0;(j < RUP_RECVBURST) && ((rc = winRecv(s->_fd, s, 1)) > 0);j += rc)
+		{
+		}
+	}
+#endif
+
+	// Advance every session's timers, then hand out what is in order
+	for(i = 0;i < rupPolledLen;++i)
+	{
+		s = rupPolled[i];
+		fd = s->_fd;
+		winTimers(fd, s);
+		if(s->_cb != NULL)
+		{
+			while(popReady(s, &inPkt, sizeof(struct pkt), &from))
+			{
+				s->_cb(fd, &inPkt, &from, s->_cbArg);
+				++count;
+			}
+		}
+		else
+		{
+			count += s->_readyLen;
+		}
+		count += s->_msgLen;
+		txFlush(fd, s);
+	}
+	return count;
+}
+
+//
+// rup_setreuseport
+//
+// Description: Let several sockets bind the same port, the kernel then
+//               spreads the remote addresses over them so each socket
+//               only ever sees its own share of peers.  Call before
+//               rup_bind on every socket sharing the port.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: int on - 1 to share the port, 0 for the default.
+// Output: int - Returns 0 on success and -1 on failure.
+int rup_setreuseport(int rfd, int on)
+{
+#if !defined(_WIN32_) && defined(SO_REUSEPORT)
+	if(setsockopt(rfd, SOL_SOCKET, SO_REUSEPORT, (char*)&on, sizeof(on)) < 0)
+	{
+		printf("UDP Error: setsockopt() call in rup_setreuseport\n");
+		return -1;
+	}
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+//
+// rup_setaffinity
+//
+// Description: Pin the calling thread to one cpu.
+//
+// Input: int cpu - The cpu number, taken modulo the cpus online.
+// Output: int - Returns 0 on success and -1 on failure.
+int rup_setaffinity(int cpu)
+{
+	// Variable declarations
+#ifndef _WIN32_
+	cpu_set_t set;
+#endif
+	int ncpu;
+
+	// Variable assignments
+	ncpu = rup_cpus();
+	cpu = ((cpu % ncpu) + ncpu) % ncpu;
+
+#ifdef _WIN32_
+	if(SetThreadAffinityMask(GetCurrentThread(), ((DWORD_PTR)1) << cpu) == 0)
+	{
+		return -1;
+	}
+#else
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if(pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set) != 0)
+	{
+		return -1;
+	}
+#endif
+	return 0;
+}
+
+//
+// rup_cpus
+//
+// Description: Count the cpus online.
+//
+// Input: NA
+// Output: int - The number of cpus, at least 1.
+int rup_cpus()
+{
+	// Variable declarations
+	int n;
+
+#ifdef _WIN32_
+	SYSTEM_INFO info;
+
+	GetSystemInfo(&info);
+	n = (int)info.dwNumberOfProcessors;
+#else
+	n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	return (n > 0) ? n : 1;
+}
+
+//
+// serveWorker
+//
+// Description: Body of one rup_serve thread.  Pins itself to its cpu,
+//                registers its socket with a reactor of its own and runs
+//                it until rup_stop, then closes the socket.
+//
+// Input: void* arg - The struct rupWorker of the thread.
+// Output: void* - NULL.
+#ifdef _WIN32_
+DWORD WINAPI serveWorker(LPVOID arg)
+#else
+void* serveWorker(void* arg)
+#endif
+{
+	// Variable declarations
+	struct rupWorker* w;
+
+	// Variable assignments
+	w = (struct rupWorker*)arg;
+
+	// Losing the pin only costs cache locality, keep serving without it
+	rup_setaffinity(w->_cpu);
+	if(rup_poll(w->_rfd) < 0)
+	{
+		w->_ret = -1;
+	}
+	else
+	{
+		rup_setcallback(w->_rfd, w->_cb, w->_arg);
+		while(!rupStopping)
+		{
+			rup_process(RUP_SERVE_TICK);
+		}
+	}
+	rup_close(w->_rfd);
+#ifdef _WIN32_
+	return 0;
+#else
+	return NULL;
+#endif
+}
+
+//
+// rup_serve
+//
+// Description: Serve a port from several cores.  Opens one socket per
+//               worker, all bound to portno with rup_setreuseport, and
+//               runs each in its own thread pinned to its own cpu with its
+//               own reactor, handing in order pkts to cb as rup_process
+//               does.  The kernel keeps each remote address on one socket,
+//               so every peer's session lives on one thread and workers
+//               share no state.  Returns once rup_stop has been called and
+//               every worker has closed its socket.
+//
+// Input: int portno - A port number to serve.
+// Input: int workers - The number of worker threads, 0 for one per cpu.
+// Input: rup_callback cb - Called on the worker's thread for each pkt.
+// Input: void* arg - Passed through to the callback.
+// Output: int - Returns 0 on success and -1 on failure.
+int rup_serve(int portno, int workers, rup_callback cb, void* arg)
+{
+	// Variable declarations
+	int i, n, ret;
+	struct rupWorker* w;
+#ifdef _WIN32_
+	HANDLE* tids;
+#else
+	pthread_t* tids;
+#endif
+
+	// Variable assignments
+	ret = 0;
+	n = 0;
+	workers = (workers > 0) ? workers : rup_cpus();
+
+	if(workers > RUP_MAXSOCKS)
+	{
+		printf("UDP Error: too many workers in rup_serve\n");
+		return -1;
+	}
+
+	// A stop made before this call or during another rup_serve still
+	//   holds, it is only cleared once nothing is left serving
+#ifdef _WIN32_
+	InterlockedIncrement(&rupServing);
+#else
+	__sync_fetch_and_add(&rupServing, 1);
+#endif
+
+	w = new struct rupWorker[workers];
+#ifdef _WIN32_
+	tids = new HANDLE[workers];
+#else
+	tids = new pthread_t[workers];
+#endif
+
+	// Bind every socket before any worker starts, so a port that cannot
+	//   be shared fails here instead of in a running worker
+	for(i = 0;i < workers;++i)
+	{
+		w[i]._rfd = rup_open();
+		w[i]._cpu = i;
+		w[i]._cb = cb;
+		w[i]._arg = arg;
+		w[i]._ret = 0;
+		if(((workers > 1) && (rup_setreuseport(w[i]._rfd, 1) < 0)) || (rup_bind(w[i]._rfd, portno) < 0))
+		{
+			rup_close(w[i]._rfd);
+			ret = -1;
+			break;
+		}
+	}
+
+	if(ret < 0)
+	{
+		while(i-- > 0)
+		{
+			rup_close(w[i]._rfd);
+		}
+	}
+	else
+	{
+		for(n = 0;n < workers;++n)
+		{
+#ifdef _WIN32_
+			tids[n] = CreateThread(NULL, 0, serveWorker, &w[n], 0, NULL);
+			if(tids[n] == NULL)
+#else
+			if(pthread_create(&tids[n], NULL, serveWorker, &w[n]) != 0)
+#endif
+			{
+				printf("UDP Error: thread create call in rup_serve\n");
+				ret = -1;
+				break;
+			}
+		}
+
+		// Without every worker the port would drop its share of peers
+		if(n < workers)
+		{
+			rup_stop();
+			for(i = n;i < workers;++i)
+			{
+				rup_close(w[i]._rfd);
+			}
+		}
+
+		for(i = 0;i < n;++i)
+		{
+#ifdef _WIN32_
+			WaitForSingleObject(tids[i], INFINITE);
+			CloseHandle(tids[i]);
+#else
+			pthread_join(tids[i], NULL);
+#endif
+			if(w[i]._ret < 0)
+			{
+				ret = -1;
+			}
+		}
+	}
+
+	delete [] tids;
+	delete [] w;
+#ifdef _WIN32_
+	if(InterlockedDecrement(&rupServing) == 0)
+	{
+		InterlockedExchange(&rupStopping, 0);
+	}
+#else
+	if(__sync_sub_and_fetch(&rupServing, 1) == 0)
+	{
+		__sync_fetch_and_and(&rupStopping, 0);
+	}
+#endif
+	return ret;
+}
+
+//
+// rup_stop
+//
+// Description: Make every rup_serve worker close its socket and return
+//               within RUP_SERVE_TICK milliseconds.  Safe to call from a
+//               callback or a signal handler.
+//
+// Input: NA
+// Output: NA
+void rup_stop()
+{
+#ifdef _WIN32_
+	InterlockedExchange(&rupStopping, 1);
+#else
+	__sync_fetch_and_or(&rupStopping, 1);
+#endif
+}
+
+//
+// performChecksum
+//
+// Description: Compute a checksum for on the pkt _msgbuf data.
+//
+// Input: struct pkt* p - A pointer to the pkt to perform the checksum.
+// Output: int result - Returns the integer value of the checksum computed.
+int performChecksum(struct pkt* p)
+{
+	// count the one bits across the max length of the payload, BUFSIZE,
+	//   a word at a time rather than bit by bit
+	return (int)popcountSum((const unsigned char*)p->_msgbuf, BUFSIZE);
+}
+
+//
+// rupNow
+//
+// Description: Read the monotonic clock for the window retransmit timers, so
+//                a step of the wall clock neither fires nor stalls them.
+//
+// Input: NA
+// Output: long long - The current time in microseconds.
+long long rupNow()
+{
+#ifdef _WIN32_
+	return ((long long)GetTickCount()) * 1000;
+#else
+	// Variable declarations
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((long long)ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+//
+// getSock
+//
+// Description: Find the window state for a socket, creating it the first
+//                time the socket is seen.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Output: struct rupSock* - The state for the socket.
+struct rupSock* getSock(int rfd)
+{
+	// Variable declarations
+	int i, freeIdx;
+	struct rupSock* s;
+
+	// Variable assignments
+	freeIdx = -1;
+
+	for(i = 0;i < RUP_MAXSOCKS;++i)
+	{
+		if((rupSocks[i] != NULL) && (rupSockFds[i] == rfd))
+		{
+			return rupSocks[i];
+		}
+	}
+
+	// Only the thread that owns rfd creates its state, the lock keeps two
+	//   threads from taking the same free entry
+	sockLock();
+	for(i = 0;(i < RUP_MAXSOCKS) && (freeIdx < 0);++i)
+	{
+		if(rupSocks[i] == NULL)
+		{
+			freeIdx = i;
+		}
+	}
+
+	if(freeIdx < 0)
+	{
+		printf("UDP Error: too many RUP sockets open\n");
+		exit(0);
+	}
+
+	// Pick the checksum engine and build its tables now rather than race
+	//   another thread to it on the first pkt
+	crc32cSoft(0, NULL, 0);
+	crc32cUpdate(0, NULL, 0);
+	if((rupTokenKey[0] == 0) && (rupTokenKey[1] == 0))
+	{
+		rupTokenKey[0] = (((unsigned int)rand()) << 16) ^ ((unsigned int)rand()) ^ ((unsigned int)rupNow());
+		rupTokenKey[1] = (((unsigned int)rand()) << 16) ^ ((unsigned int)rand()) ^ ((unsigned int)(size_t)&freeIdx);
+	}
+
+	s = new struct rupSock;
+	memset((char*)s,0,sizeof(struct rupSock));
+	rupAllocs._allocs += 2;
+	s->_fd = rfd;
+	s->_window = 1;
+	s->_cc = RUP_CC_NEWRENO;
+	s->_cksum = RUP_CKSUM_CRC32C;
+	s->_ackEvery = 1;
+	s->_rcvBuf = RUP_RCVBUF;
+	s->_maxPeers = RUP_MAXPEERS;
+	s->_hashSize = RUP_PEERHASH;
+	s->_hash = new struct rupPeer*[s->_hashSize];
+	memset((char*)s->_hash,0,s->_hashSize * sizeof(struct rupPeer*));
+	s->_cids = new struct rupPeer*[s->_hashSize];
+	memset((char*)s->_cids,0,s->_hashSize * sizeof(struct rupPeer*));
+	rupAllocs._allocs++;
+	rupSockFds[freeIdx] = rfd;
+	rupSocks[freeIdx] = s;
+	sockUnlock();
+	return s;
+}
+
+//
+// freeSock
+//
+// Description: Release the window state of a socket and every peer and
+//                undelivered pkt hanging off it.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Output: NA
+void freeSock(int rfd)
+{
+	// Variable declarations
+	int i;
+	struct rupSock* s;
+	struct rupPeer* p;
+	struct rupReady* r;
+	struct rupMsg* m;
+
+	for(i = 0;i < RUP_MAXSOCKS;++i)
+	{
+		s = rupSocks[i];
+		if((s != NULL) && (rupSockFds[i] == rfd))
+		{
+			sockLock();
+			rupSocks[i] = NULL;
+			sockUnlock();
+
+			while(s->_peers != NULL)
+			{
+				p = s->_peers;
+				s->_peers = p->_next;
+				freePeer(p);
+			}
+			while(s->_readyHead != NULL)
+			{
+				r = s->_readyHead;
+				s->_readyHead = r->_next;
+				delete r;
+				rupAllocs._frees++;
+			}
+			while(s->_readyFree != NULL)
+			{
+				r = s->_readyFree;
+				s->_readyFree = r->_next;
+				delete r;
+				rupAllocs._frees++;
+			}
+			while(s->_msgHead != NULL)
+			{
+				m = s->_msgHead;
+				s->_msgHead = m->_next;
+				delete [] m->_buf;
+				delete m;
+				rupAllocs._frees += 2;
+			}
+			while(s->_msgFree != NULL)
+			{
+				m = s->_msgFree;
+				s->_msgFree = m->_next;
+				delete [] m->_buf;
+				delete m;
+				rupAllocs._frees += 2;
+			}
+			if(s->_groBuf != NULL)
+			{
+				delete [] s->_groBuf;
+				rupAllocs._frees++;
+			}
+			if(s->_txDgram != NULL)
+			{
+				delete [] s->_txDgram;
+				rupAllocs._frees++;
+			}
+			if(s->_sim != NULL)
+			{
+				delete [] s->_sim->_held;
+				delete s->_sim;
+				rupAllocs._frees += 2;
+			}
+#ifdef RUP_URING
+			if(s->_ring != NULL)
+			{
+				ringClose(s->_ring);
+			}
+#endif
+			delete [] s->_hash;
+			delete [] s->_cids;
+			delete s;
+			rupAllocs._frees += 3;
+		}
+	}
+}
+
+//
+// sockLock
+//
+// Description: Take the lock guarding rupSocks entries and the resume
+//                cache.
+//
+// Input: NA
+// Output: NA
+void sockLock()
+{
+#ifdef _WIN32_
+	AcquireSRWLockExclusive(&rupSockLock);
+#else
+	pthread_mutex_lock(&rupSockLock);
+#endif
+}
+
+//
+// sockUnlock
+//
+// Description: Release the lock taken by sockLock.
+//
+// Input: NA
+// Output: NA
+void sockUnlock()
+{
+#ifdef _WIN32_
+	ReleaseSRWLockExclusive(&rupSockLock);
+#else
+	pthread_mutex_unlock(&rupSockLock);
+#endif
+}
+
+//
+// unpollSock
+//
+// Description: Take a socket out of the calling thread's reactor, closing
+//                the reactor's epoll descriptor once it serves nothing.
+//
+// Input: struct rupSock* s - The socket state.
+// Output: NA
+void unpollSock(struct rupSock* s)
+{
+	// Variable declarations
+	int i;
+
+	for(i = 0;i < rupPolledLen;++i)
+	{
+		if(rupPolled[i] == s)
+		{
+			rupPolled[i] = rupPolled[--rupPolledLen];
+			break;
+		}
+	}
+
+#ifndef _WIN32_
+	if(rupEpfd >= 0)
+	{
+		epoll_ctl(rupEpfd, EPOLL_CTL_DEL, pollFd(s), NULL);
+		if(rupPolledLen == 0)
+		{
+			close(rupEpfd);
+			rupEpfd = -1;
+		}
+	}
+#endif
+	s->_polled = 0;
+}
+
+//
+// pollFd
+//
+// Description: The descriptor a reactor watches for a socket's input.
+//
+// Input: struct rupSock* s - The socket state.
+// Output: int - The socket itself, or its io_uring.
+int pollFd(struct rupSock* s)
+{
+#ifdef RUP_URING
+	// An io_uring socket is read by its ring, which turns readable when
+	//   completions are waiting
+	if(s->_ring != NULL)
+	{
+		return s->_ring->_fd;
+	}
+#endif
+	return s->_fd;
+}
+
+//
+// getPeer
+//
+// Description: Find the window state kept for a remote address, creating
+//                it the first time the address is seen.
+//
+// Input: struct rupSock* s - The socket state.
+// Input: struct sockaddr_in* addr - The remote ip address and port number.
+// Output: struct rupPeer* - The state for the peer.
+struct rupPeer* getPeer(struct rupSock* s, struct sockaddr_in* addr)
+{
+	// Variable declarations
+	unsigned int h;
+	struct rupPeer* p;
+	struct rupPeer* q;
+
+	// Variable assignments
+	p = findPeer(s, addr);
+
+	if(p != NULL)
+	{
+		return p;
+	}
+
+	h = peerHash(addr);
+	p = new struct rupPeer;
+	memset((char*)p,0,sizeof(struct rupPeer));
+	rupAllocs._allocs++;
+	p->_lastSeen = rupNow();
+	p->_ackHeard = p->_lastSeen;
+	p->_addr.sin_family = AF_INET;
+	p->_addr.sin_addr = addr->sin_addr;
+	p->_addr.sin_port = addr->sin_port;
+
+	// Start at a random sequence number so a restarted sender is not
+	//   mistaken for duplicates of its earlier incarnation
+	p->_sndNext = (((unsigned int)rand()) << 16) ^ ((unsigned int)rand()) ^ ((unsigned int)rupNow());
+	p->_sndBase = p->_sndNext;
+	p->_sndPaced = p->_sndNext;
+	p->_rwnd = RUP_MAXWINDOW;
+	p->_rwndAck = p->_sndNext;
+	p->_rto = RUP_INITRTO_US;
+	p->_sock = s;
+	ccInit(p);
+	p->_next = s->_peers;
+	s->_peers = p;
+	p->_hnext = s->_hash[h & (s->_hashSize - 1)];
+	s->_hash[h & (s->_hashSize - 1)] = p;
+
+	// The ID frames from the peer will carry once it has been told it,
+	//   random so a stale one from an earlier socket rarely matches
+	do
+	{
+		p->_cid = (((unsigned int)rand()) << 16) ^ ((unsigned int)rand()) ^ ((unsigned int)rupNow());
+		for(q = s->_cids[p->_cid & (s->_hashSize - 1)];(q != NULL) && (q->_cid != p->_cid);q = q->_cnext)
+		{
+		}
+	} while((p->_cid == 0) || (q != NULL));
+	p->_cnext = s->_cids[p->_cid & (s->_hashSize - 1)];
+	s->_cids[p->_cid & (s->_hashSize - 1)] = p;
+
+	if(++s->_npeers > 2 * s->_hashSize)
+	{
+		peerGrow(s);
+	}
+	return p;
+}
+
+//
+// findPeer
+//
+// Description: Find the window state kept for a remote address.
+//
+// Input: struct rupSock* s - The socket state.
+// Input: struct sockaddr_in* addr - The remote ip address and port number.
+// Output: struct rupPeer* - The state for the peer, NULL if there is none.
+struct rupPeer* findPeer(struct rupSock* s, struct sockaddr_in* addr)
+{
+	// Variable declarations
+	struct rupPeer* p;
+
+	for(p = s->_hash[peerHash(addr) & (s->_hashSize - 1)];p != NULL;p = p->_hnext)
+	{
+		if((p->_addr.sin_addr.s_addr == addr->sin_addr.s_addr) && (p->_addr.sin_port == addr->sin_port))
+		{
+			return p;
+		}
+	}
+	return NULL;
+}
+
+//
+// freePeer
+//
+// Description: Release the state kept for a peer, remembering what it
+//                learnt of a server for the next connection to it.  The
+//                caller has already taken it out of the socket's tables.
+//
+// Input: struct rupPeer* p - The peer.
+// Output: NA
+void freePeer(struct rupPeer* p)
+{
+	// Variable declarations
+	int i;
+
+	resumeSave(p);
+	for(i = 0;i < RUP_MAXSTREAMS;++i)
+	{
+		if(p->_streams[i]._asm != NULL)
+		{
+			delete [] p->_streams[i]._asm->_buf;
+			delete p->_streams[i]._asm;
+			rupAllocs._frees += 2;
+		}
+	}
+	if(p->_snd != NULL)
+	{
+		delete [] p->_snd;
+		rupAllocs._frees++;
+	}
+	if(p->_rcv != NULL)
+	{
+		delete [] p->_rcv;
+		rupAllocs._frees++;
+	}
+	delete p;
+	rupAllocs._frees++;
+}
+
+//
+// peerReap
+//
+// Description: Forget the peers of a socket that have gone idle, see
+//                peerIdle.  Their counters stay with the socket.  No frame
+//                queued for sending may still point into their windows.
+//
+// Input: struct rupSock* s - The socket state.
+// Input: long long now - The current time in microseconds.
+// Output: NA
+void peerReap(struct rupSock* s, long long now)
+{
+	// Variable declarations
+	struct rupPeer* p;
+	struct rupPeer** pp;
+
+	// Variable assignments
+	pp = &s->_peers;
+
+	while(*pp != NULL)
+	{
+		p = *pp;
+
+		// Traffic since the last pass is as good as now
+		if(p->_active)
+		{
+			p->_active = 0;
+			p->_lastSeen = now;
+		}
+		if(!peerIdle(p, now))
+		{
+			pp = &p->_next;
+			continue;
+		}
+		peerDrop(s, pp);
+	}
+}
+
+//
+// peerEvict
+//
+// Description: Make room for a new peer on a socket at its peer cap by
+//                forgetting the one quiet the longest among those with no
+//                traffic since the last reap pass and nothing owed, see
+//                peerQuiet.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rupSock* s - The socket state.
+// Output: int - Returns 1 if a peer was forgotten and 0 if every peer is busy.
+int peerEvict(int rfd, struct rupSock* s)
+{
+	// Variable declarations
+	long long now;
+	struct rupPeer** pp;
+	struct rupPeer** oldest;
+
+	// Variable assignments
+	now = rupNow();
+	oldest = NULL;
+
+	for(pp = &s->_peers;*pp != NULL;pp = &(*pp)->_next)
+	{
+		if((!(*pp)->_active) && (peerQuiet(*pp, now)) && ((oldest == NULL) || ((*pp)->_lastSeen < (*oldest)->_lastSeen)))
+		{
+			oldest = pp;
+		}
+	}
+	if(oldest == NULL)
+	{
+		return 0;
+	}
+
+	// Frames still queued may point into the peer's window
+	txFlush(rfd, s);
+	peerDrop(s, oldest);
+	return 1;
+}
+
+//
+// peerDrop
+//
+// Description: Take a peer out of its socket's tables and free it, keeping
+//                its counters with the socket.
+//
+// Input: struct rupSock* s - The socket state.
+// Input: struct rupPeer** pp - The link of the socket's peer list that
+//          points to the peer.
+// Output: NA
+void peerDrop(struct rupSock* s, struct rupPeer** pp)
+{
+	// Variable declarations
+	struct rupPeer* p;
+	struct rupPeer** hp;
+
+	// Variable assignments
+	p = *pp;
+
+	*pp = p->_next;
+	for(hp = &s->_hash[peerHash(&p->_addr) & (s->_hashSize - 1)];*hp != p;hp = &(*hp)->_hnext)
+	{
+	}
+	*hp = p->_hnext;
+	for(hp = &s->_cids[p->_cid & (s->_hashSize - 1)];*hp != p;hp = &(*hp)->_cnext)
+	{
+	}
+	*hp = p->_cnext;
+	s->_npeers--;
+	statsAdd(&s->_stats, &p->_stats);
+	freePeer(p);
+}
+
+//
+// peerIdle
+//
+// Description: Whether a peer may be forgotten: it is owed nothing, see
+//                peerQuiet, and it has been quiet for RUP_PEERIDLE_US, or
+//                for the linger once it was given up on and has not
+//                answered since.
+//
+// Input: struct rupPeer* p - The peer.
+// Input: long long now - The current time in microseconds.
+// Output: int - Returns 1 if the peer is idle and 0 otherwise.
+int peerIdle(struct rupPeer* p, long long now)
+{
+	// Variable declarations
+	long long span;
+
+	// Variable assignments
+	span = winLingerSpan(p);
+
+	if(!peerQuiet(p, now))
+	{
+		return 0;
+	}
+	return (now - p->_lastSeen >= ((p->_abandoned) ? span : RUP_PEERIDLE_US)) ? 1 : 0;
+}
+
+//
+// peerQuiet
+//
+// Description: Whether a peer is owed nothing: nothing sent to it waits for
+//                an ACK, it is owed no ACK, HELLO or FWD, and the close
+//                linger after its last ACK is over.
+//
+// Input: struct rupPeer* p - The peer.
+// Input: long long now - The current time in microseconds.
+// Output: int - Returns 1 if the peer is owed nothing and 0 otherwise.
+int peerQuiet(struct rupPeer* p, long long now)
+{
+	if((p->_sndBase != p->_sndNext) || (p->_ackPending) || (p->_helloPending) || (p->_fwdPending))
+	{
+		return 0;
+	}
+	if((p->_lastAck != 0) && (now < p->_lastAck + winLingerSpan(p)))
+	{
+		return 0;
+	}
+	return 1;
+}
+
+//
+// peerHash
+//
+// Description: Hash a peer's address and port for the peer table.
+//
+// Input: struct sockaddr_in* addr - The peer's address.
+// Output: unsigned int - The hash, masked by the caller to a bucket.
+unsigned int peerHash(struct sockaddr_in* addr)
+{
+	// Variable declarations
+	unsigned int h;
+
+	// Variable assignments
+	h = (unsigned int)addr->sin_addr.s_addr ^ (((unsigned int)addr->sin_port) << 16);
+
+	// Fibonacci hashing, then fold the well mixed high bits down
+	h *= 2654435761U;
+	return h ^ (h >> 16);
+}
+
+//
+// peerGrow
+//
+// Description: Double a socket's peer tables and rehash every peer into
+//                them.
+//
+// Input: struct rupSock* s - The socket state.
+// Output: NA
+void peerGrow(struct rupSock* s)
+{
+	// Variable declarations
+	unsigned int b;
+	struct rupPeer* p;
+
+	// Variable assignments
+	delete [] s->_hash;
+	delete [] s->_cids;
+	s->_hashSize *= 2;
+	s->_hash = new struct rupPeer*[s->_hashSize];
+	s->_cids = new struct rupPeer*[s->_hashSize];
+	rupAllocs._allocs += 2;
+	rupAllocs._frees += 2;
+	memset((char*)s->_hash,0,s->_hashSize * sizeof(struct rupPeer*));
+	memset((char*)s->_cids,0,s->_hashSize * sizeof(struct rupPeer*));
+
+	for(p = s->_peers;p != NULL;p = p->_next)
+	{
+		b = peerHash(&p->_addr) & (s->_hashSize - 1);
+		p->_hnext = s->_hash[b];
+		s->_hash[b] = p;
+		b = p->_cid & (s->_hashSize - 1);
+		p->_cnext = s->_cids[b];
+		s->_cids[b] = p;
+	}
+}
+
+//
+// peerOf
+//
+// Description: Find the peer a received frame belongs to, by the ID the
+//                frame carries for its connection when it has one, by its
+//                address otherwise.  The peer found by its ID may still be
+//                at its old address, see peerFresh.  Only data and HELLO
+//                frames create a peer for an address never seen, an ACK,
+//                FWD or WELCOME answers a peer that must already exist.  A
+//                socket at its peer cap makes room with peerEvict first.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rupSock* s - The socket state.
+// Input: unsigned char* frame - The received frame.
+// Input: struct sockaddr_in* from - The address it came from.
+// Output: struct rupPeer* - The peer, NULL if the frame has none.
+struct rupPeer* peerOf(int rfd, struct rupSock* s, unsigned char* frame, struct sockaddr_in* from)
+{
+	// Variable declarations
+	unsigned int cid;
+	struct rupPeer* p;
+
+	// Variable assignments
+	cid = getU32(frame + 14);
+
+	if(cid != 0)
+	{
+		for(p = s->_cids[cid & (s->_hashSize - 1)];p != NULL;p = p->_cnext)
+		{
+			if(p->_cid == cid)
+			{
+				return p;
+			}
+		}
+	}
+	p = findPeer(s, from);
+
+	if((p == NULL) && ((frame[1] == RUP_T_DATA) || (frame[1] == RUP_T_HELLO)))
+	{
+		if((s->_npeers >= s->_maxPeers) && (!peerEvict(rfd, s)))
+		{
+			return NULL;
+		}
+		p = getPeer(s, from);
+	}
+	return p;
+}
+
+//
+// peerMove
+//
+// Description: Give a peer a new address, rehashing it in the address table.
+//
+// Input: struct rupSock* s - The socket state.
+// Input: struct rupPeer* p - The peer.
+// Input: struct sockaddr_in* addr - Its new address.
+// Output: NA
+void peerMove(struct rupSock* s, struct rupPeer* p, struct sockaddr_in* addr)
+{
+	// Variable declarations
+	struct rupPeer** pp;
+
+	// Variable assignments
+	pp = &s->_hash[peerHash(&p->_addr) & (s->_hashSize - 1)];
+
+	while(*pp != p)
+	{
+		pp = &(*pp)->_hnext;
+	}
+	*pp = p->_hnext;
+
+	p->_addr.sin_addr = addr->sin_addr;
+	p->_addr.sin_port = addr->sin_port;
+	pp = &s->_hash[peerHash(&p->_addr) & (s->_hashSize - 1)];
+	p->_hnext = *pp;
+	*pp = p;
+}
+
+//
+// peerFresh
+//
+// Description: Whether a frame moves a connection forward: data the
+//                receive window has not seen yet, or an ACK for frames
+//                still unacknowledged.  Only such a frame may move the
+//                connection to the address it came from, so a delayed or
+//                replayed copy of an old frame cannot take it away.
+//
+// Input: struct rupPeer* p - The peer.
+// Input: int type - The frame type.
+// Input: int flags - The frame flags.
+// Input: unsigned int seq - The frame's sequence number.
+// Input: unsigned long long sack - The SACK map of an ACK frame.
+// Input: struct rupOpts* o - The options of a data frame.
+// Output: int - Returns 1 if the frame is new and 0 otherwise.
+int peerFresh(struct rupPeer* p, int type, int flags, unsigned int seq, unsigned long long sack, struct rupOpts* o)
+{
+	// Variable declarations
+	int d;
+
+	if(type == RUP_T_ACK)
+	{
+		return winAckNew(p, seq, sack);
+	}
+	if((type != RUP_T_DATA) || (flags & RUP_F_UNREL))
+	{
+		return 0;
+	}
+	if((flags & RUP_F_ACK) && (winAckNew(p, o->_ack, o->_sack)))
+	{
+		return 1;
+	}
+	if(!p->_rcvInit)
+	{
+		return 1;
+	}
+
+	d = (int)(seq - p->_rcvNext);
+	return ((d >= 0) && (d < RUP_MAXWINDOW) && ((int)(seq - p->_rcvEdge) < 0) && (!p->_rcv[seq % RUP_MAXWINDOW]._used)) ? 1 : 0;
+}
+
+//
+// helloSend
+//
+// Description: Send a HELLO, or a WELCOME in answer to one, with this
+//                side's ID for the connection and its parameters.  A HELLO
+//                is repeated by winTimers until the WELCOME arrives.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rupPeer* p - The peer.
+// Input: int type - RUP_T_HELLO or RUP_T_WELCOME.
+// Input: unsigned char* token - The resume token to send.
+// Input: int tokenLen - Its byte count, 0 for none.
+// Output: NA
+void helloSend(int rfd, struct rupPeer* p, int type, unsigned char* token, int tokenLen)
+{
+	// Variable declarations
+	unsigned char frame[RUP_HELLOSIZE];
+	unsigned char* b;
+
+	// Variable assignments
+	b = frame + RUP_HDRSIZE;
+
+	putU32(b, p->_cid);
+	putU16(b + 4, rcvWindow(p->_sock));
+	putU16(b + 6, RUP_MAXFRAME);
+	b[8] = (unsigned char)p->_sock->_cksum;
+	b[9] = (unsigned char)tokenLen;
+	memcpy(b + 10, token, tokenLen);
+
+	frameHeader(frame, type, p->_sock->_cksum << RUP_F_CKSUMSHIFT, 0, 10 + tokenLen, p->_peerCid);
+	frameSeal(frame, RUP_HDRSIZE + 10 + tokenLen);
+	txQueue(rfd, p->_sock, frame, RUP_HDRSIZE + 10 + tokenLen, p, NULL);
+
+	if(type == RUP_T_HELLO)
+	{
+		p->_helloPending = 1;
+		p->_helloSent = rupNow();
+		p->_active = 1;
+	}
+}
+
+//
+// helloInput
+//
+// Description: Take the peer's ID for the connection and its parameters
+//                from a HELLO or WELCOME.  A HELLO is answered with a
+//                WELCOME and a new resume token, and a valid token it
+//                carried seeds the RTT estimator.  A WELCOME completes
+//                rup_connect, times the round trip when the HELLO went
+//                once, and its token is kept for the next connection.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rupPeer* p - The peer that sent the frame.
+// Input: int type - RUP_T_HELLO or RUP_T_WELCOME.
+// Input: unsigned char* in - The frame.
+// Input: int len - The frame byte count.
+// Output: NA
+void helloInput(int rfd, struct rupPeer* p, int type, unsigned char* in, int len)
+{
+	// Variable declarations
+	int tokenLen;
+	unsigned char* b;
+	unsigned char token[RUP_TOKENSIZE];
+
+	// Variable assignments
+	b = in + RUP_HDRSIZE;
+
+	if((len < RUP_HDRSIZE + 10) || (getU32(b) == 0))
+	{
+		return;
+	}
+	tokenLen = b[9];
+	if((tokenLen > RUP_TOKENSIZE) || (len < RUP_HDRSIZE + 10 + tokenLen))
+	{
+		return;
+	}
+
+	p->_peerCid = getU32(b);
+	p->_peerWnd = getU16(b + 4);
+	p->_peerMtu = getU16(b + 6);
+	p->_peerCksum = b[8];
+
+	if(type == RUP_T_HELLO)
+	{
+		if(tokenCheck(p, b + 10, tokenLen))
+		{
+			p->_resumed = 1;
+		}
+		tokenMint(p, token);
+		helloSend(rfd, p, RUP_T_WELCOME, token, RUP_TOKENSIZE);
+		return;
+	}
+
+	if(p->_helloPending)
+	{
+		if(p->_helloTries == 0)
+		{
+			rttSample(p, rupNow() - p->_helloSent);
+		}
+		p->_helloPending = 0;
+	}
+	if(tokenLen == RUP_TOKENSIZE)
+	{
+		memcpy(p->_token, b + 10, RUP_TOKENSIZE);
+		p->_tokenLen = RUP_TOKENSIZE;
+		resumeSave(p);
+	}
+}
+
+//
+// tokenMint
+//
+// Description: Make a resume token for a peer: the time, this side's RTT
+//                estimate of the path and a check value keyed by the
+//                process secret and the peer's address.
+//
+// Input: struct rupPeer* p - The peer.
+// Input: unsigned char* token - Filled with RUP_TOKENSIZE bytes.
+// Output: NA
+void tokenMint(struct rupPeer* p, unsigned char* token)
+{
+	putU32(token, (unsigned int)(rupNow() / 1000000));
+	putU32(token + 4, (p->_samples > 0) ? (unsigned int)p->_srtt : 0);
+	putU32(token + 8, (p->_samples > 0) ? (unsigned int)p->_rttvar : 0);
+	putU32(token + 12, tokenMac(token, &p->_addr));
+}
+
+//
+// tokenCheck
+//
+// Description: Check a resume token from a peer and, if it was made here
+//                for that ip address no more than RUP_RESUME_SECS ago, seed a
+//                peer without RTT samples with the estimate it carries.  The
+//                check value catches stale and foreign tokens, it is not
+//                meant to stop a forger.
+//
+// Input: struct rupPeer* p - The peer.
+// Input: unsigned char* token - The token.
+// Input: int tokenLen - Its byte count.
+// Output: int - Returns 1 if the token is valid and 0 otherwise.
+int tokenCheck(struct rupPeer* p, unsigned char* token, int tokenLen)
+{
+	// Variable declarations
+	long long age;
+
+	if((tokenLen != RUP_TOKENSIZE) || (getU32(token + 12) != tokenMac(token, &p->_addr)))
+	{
+		return 0;
+	}
+
+	// Variable assignments
+	age = rupNow() / 1000000 - getU32(token);
+
+	if((age < 0) || (age > RUP_RESUME_SECS))
+	{
+		return 0;
+	}
+	if((p->_samples == 0) && (getU32(token + 4) > 0))
+	{
+		rttSeed(p, getU32(token + 4), getU32(token + 8));
+	}
+	return 1;
+}
+
+//
+// tokenMac
+//
+// Description: The check value of a resume token, a CRC32C of the process
+//                secret, the peer's ip address and the token's other fields.
+//                The port is left out: a client reconnects from a new one.
+//
+// Input: unsigned char* token - The token.
+// Input: struct sockaddr_in* addr - The peer's address.
+// Output: unsigned int - The check value.
+unsigned int tokenMac(unsigned char* token, struct sockaddr_in* addr)
+{
+	// Variable declarations
+	unsigned int crc;
+
+	// Variable assignments
+	crc = crc32cUpdate(0xFFFFFFFF, (const unsigned char*)rupTokenKey, sizeof(rupTokenKey));
+	crc = crc32cUpdate(crc, (const unsigned char*)&addr->sin_addr.s_addr, 4);
+	crc = crc32cUpdate(crc, token, 12);
+	return crc ^ 0xFFFFFFFF;
+}
+
+//
+// resumeFind
+//
+// Description: Look up what was last negotiated with a server, if it is
+//                still recent enough to resume.
+//
+// Input: struct sockaddr_in* addr - The server's address.
+// Input: struct rupResume* r - Filled in with the entry.
+// Output: int - Returns 1 if an entry was found and 0 otherwise.
+int resumeFind(struct sockaddr_in* addr, struct rupResume* r)
+{
+	// Variable declarations
+	int i, found;
+
+	// Variable assignments
+	found = 0;
+
+	sockLock();
+	for(i = 0;i < RUP_RESUMES;++i)
+	{
+		if((rupResumes[i]._tokenLen > 0) && (rupResumes[i]._addr.sin_addr.s_addr == addr->sin_addr.s_addr) &&
+			(rupResumes[i]._addr.sin_port == addr->sin_port) && (rupNow() - rupResumes[i]._at < RUP_RESUME_SECS * 1000000LL))
+		{
+			*r = rupResumes[i];
+			found = 1;
+			break;
+		}
+	}
+	sockUnlock();
+	return found;
+}
+
+//
+// resumeSave
+//
+// Description: Remember what was negotiated with a server that gave this
+//                side a resume token, replacing its old entry or else the
+//                oldest one.
+//
+// Input: struct rupPeer* p - The peer.
+// Output: NA
+void resumeSave(struct rupPeer* p)
+{
+	// Variable declarations
+	int i, use;
+	struct rupResume* r;
+
+	if(p->_tokenLen == 0)
+	{
+		return;
+	}
+
+	// Variable assignments
+	use = 0;
+
+	sockLock();
+	for(i = 0;i < RUP_RESUMES;++i)
+	{
+		if((rupResumes[i]._addr.sin_addr.s_addr == p->_addr.sin_addr.s_addr) && (rupResumes[i]._addr.sin_port == p->_addr.sin_port))
+		{
+			use = i;
+			break;
+		}
+		if(rupResumes[i]._at < rupResumes[use]._at)
+		{
+			use = i;
+		}
+	}
+	r = &rupResumes[use];
+	r->_addr = p->_addr;
+	r->_window = p->_peerWnd;
+	r->_mtu = p->_peerMtu;
+	r->_cksum = p->_peerCksum;
+	if(p->_samples > 0)
+	{
+		r->_srtt = p->_srtt;
+		r->_rttvar = p->_rttvar;
+	}
+	r->_at = rupNow();
+	r->_tokenLen = p->_tokenLen;
+	memcpy(r->_token, p->_token, p->_tokenLen);
+	sockUnlock();
+}
+
+//
+// winPending
+//
+// Description: Check whether any windowed pkt written on the socket is
+//                still waiting for its ACK.
+//
+// Input: struct rupSock* s - The socket state.
+// Output: int - Returns 1 if pkts are in flight and 0 otherwise.
+int winPending(struct rupSock* s)
+{
+	// Variable declarations
+	struct rupPeer* p;
+
+	for(p = s->_peers;p != NULL;p = p->_next)
+	{
+		if(p->_sndBase != p->_sndNext)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//
+// putU16 / putU32 / getU16 / getU32
+//
+// Description: Store and load header fields in network byte order without
+//                caring about the alignment of the frame buffer.
+void putU16(unsigned char* b, unsigned int v)
+{
+	b[0] = (unsigned char)(v >> 8);
+	b[1] = (unsigned char)v;
+}
+
+void putU32(unsigned char* b, unsigned int v)
+{
+	b[0] = (unsigned char)(v >> 24);
+	b[1] = (unsigned char)(v >> 16);
+	b[2] = (unsigned char)(v >> 8);
+	b[3] = (unsigned char)v;
+}
+
+unsigned int getU16(unsigned char* b)
+{
+	return (((unsigned int)b[0]) << 8) | b[1];
+}
+
+unsigned int getU32(unsigned char* b)
+{
+	return (((unsigned int)b[0]) << 24) | (((unsigned int)b[1]) << 16) | (((unsigned int)b[2]) << 8) | b[3];
+}
+
+//
+// frameHeader
+//
+// Description: Fill in the fixed header of a frame.  The checksum is left
+//                zero until frameSeal is called on the finished frame.
+//
+// Input: unsigned char* frame - The frame buffer.
+// Input: int type - The frame type.
+// Input: int flags - The options that follow the header.
+// Input: unsigned int seq - The sequence number.
+// Input: int len - The payload byte count.
+// Input: unsigned int cid - The receiver's ID for the connection, 0 if none.
+// Output: NA
+void frameHeader(unsigned char* frame, int type, int flags, unsigned int seq, int len, unsigned int cid)
+{
+	frame[0] = RUP_VERSION;
+	frame[1] = (unsigned char)type;
+	putU16(frame + 2, flags);
+	putU32(frame + 4, seq);
+	putU16(frame + 8, len);
+	putU32(frame + 10, 0);
+	putU32(frame + 14, cid);
+}
+
+//
+// frameChecksum
+//
+// Description: Compute the checksum of a whole frame as if its checksum
+//                field were zero, with the engine named in the frame's
+//                flags.  Only the bytes actually on the wire are covered.
+//
+// Input: unsigned char* frame - The frame buffer.
+// Input: int len - The frame byte count.
+// Output: unsigned int result - The checksum of the frame.
+unsigned int frameChecksum(unsigned char* frame, int len)
+{
+	// Variable declarations
+	unsigned int result;
+
+	// Variable assignments
+	result = 0;
+
+	// cover everything but the checksum field itself, the connection ID
+	//   after it included
+	switch((getU16(frame + 2) & RUP_F_CKSUMMASK) >> RUP_F_CKSUMSHIFT)
+	{
+	case RUP_CKSUM_POPCOUNT:
+		result = popcountSum(frame, 10) + popcountSum(frame + 14, len - 14);
+		break;
+	case RUP_CKSUM_CRC32C:
+		result = crc32cUpdate(0xFFFFFFFF, frame, 10);
+		result = crc32cUpdate(result, frame + 14, len - 14) ^ 0xFFFFFFFF;
+		break;
+	default:
+		break;
+	}
+	return result;
+}
+
+//
+// popcountSum
+//
+// Description: The original RUP checksum, a count of the one bits in a
+//                buffer, done a word at a time.
+//
+// Input: const unsigned char* b - The buffer.
+// Input: int len - The byte count of the buffer.
+// Output: unsigned int result - The number of bits set.
+unsigned int popcountSum(const unsigned char* b, int len)
+{
+	// Variable declarations
+	unsigned int result;
+	unsigned long long w;
+
+	// Variable assignments
+	result = 0;
+
+	while(len >= 8)
+	{
+		memcpy((char*)&w, b, 8);
+#ifdef __GNUC__
+		result += __builtin_popcountll(w);
+#else
+		w = w - ((w >> 1) & 0x5555555555555555ULL);
+		w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+		w = (w + (w >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+		result += (unsigned int)((w * 0x0101010101010101ULL) >> 56);
+#endif
+		b += 8;
+		len -= 8;
+	}
+	while(len-- > 0)
+	{
+		w = *b++;
+		while(w)
+		{
+			result += (unsigned int)(w & 1);
+			w >>= 1;
+		}
+	}
+	return result;
+}
+
+// CRC32C slicing-by-8 tables, built on first use
+static unsigned int crc32cTable[8][256];
+static int crc32cReady = 0;
+
+//
+// crc32cInit
+//
+// Description: Build the slicing-by-8 tables for CRC32C (Castagnoli,
+//                reflected polynomial 0x82F63B78).
+//
+// Input: NA
+// Output: NA
+void crc32cInit()
+{
+	// Variable declarations
+	int i, j, k;
+	unsigned int c;
+
+	for(i = 0;i < 256;++i)
+	{
+		c = (unsigned int)i;
+		for(j = 0;j < 8;++j)
+		{
+			c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : (c >> 1);
+		}
+		crc32cTable[0][i] = c;
+	}
+	for(i = 0;i < 256;++i)
+	{
+		for(k = 1;k < 8;++k)
+		{
+			c = crc32cTable[k - 1][i];
+			crc32cTable[k][i] = (c >> 8) ^ crc32cTable[0][c & 0xFF];
+		}
+	}
+	crc32cReady = 1;
+}
+
+//
+// crc32cSoft
+//
+// Description: Software CRC32C, eight bytes per step with the slicing-by-8
+//                tables.  The crc is not pre or post inverted here.
+//
+// Input: unsigned int crc - The running crc.
+// Input: const unsigned char* b - The buffer.
+// Input: int len - The byte count of the buffer.
+// Output: unsigned int crc - The updated crc.
+unsigned int crc32cSoft(unsigned int crc, const unsigned char* b, int len)
+{
+	// Variable declarations
+	unsigned int lo, hi;
+
+	if(!crc32cReady)
+	{
+		crc32cInit();
+	}
+
+	while(len >= 8)
+	{
+		lo = crc ^ ((unsigned int)b[0] | ((unsigned int)b[1] << 8) | ((unsigned int)b[2] << 16) | ((unsigned int)b[3] << 24));
+		hi = (unsigned int)b[4] | ((unsigned int)b[5] << 8) | ((unsigned int)b[6] << 16) | ((unsigned int)b[7] << 24);
+		crc = crc32cTable[7][lo & 0xFF] ^ crc32cTable[6][(lo >> 8) & 0xFF] ^
+			crc32cTable[5][(lo >> 16) & 0xFF] ^ crc32cTable[4][lo >> 24] ^
+			crc32cTable[3][hi & 0xFF] ^ crc32cTable[2][(hi >> 8) & 0xFF] ^
+			crc32cTable[1][(hi >> 16) & 0xFF] ^ crc32cTable[0][hi >> 24];
+		b += 8;
+		len -= 8;
+	}
+	while(len-- > 0)
+	{
+		crc = crc32cTable[0][(crc ^ *b++) & 0xFF] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(_WIN32_)
+//
+// crc32cHard
+//
+// Description: CRC32C with the SSE4.2 crc32 instruction.  Only called once
+//                the cpu has been checked for SSE4.2.
+//
+// Input: unsigned int crc - The running crc.
+// Input: const unsigned char* b - The buffer.
+// Input: int len - The byte count of the buffer.
+// Output: unsigned int crc - The updated crc.
+__attribute__((target("sse4.2")))
+unsigned int crc32cHard(unsigned int crc, const unsigned char* b, int len)
+{
+	// Variable declarations
+	unsigned long long c, w;
+
+	// Variable assignments
+	c = crc;
+
+	while(len >= 8)
+	{
+		memcpy((char*)&w, b, 8);
+		c = __builtin_ia32_crc32di(c, w);
+		b += 8;
+		len -= 8;
+	}
+	crc = (unsigned int)c;
+	while(len-- > 0)
+	{
+		crc = __builtin_ia32_crc32qi(crc, *b++);
+	}
+	return crc;
+}
+#endif
+
+// CRC32C engine picked for this cpu
+static unsigned int (*crc32cEngine)(unsigned int, const unsigned char*, int) = NULL;
+
+//
+// crc32cUpdate
+//
+// Description: Run CRC32C with the fastest engine this cpu supports.  The
+//                choice is made once, on first use.
+//
+// Input: unsigned int crc - The running crc.
+// Input: const unsigned char* b - The buffer.
+// Input: int len - The byte count of the buffer.
+// Output: unsigned int crc - The updated crc.
+unsigned int crc32cUpdate(unsigned int crc, const unsigned char* b, int len)
+{
+	if(crc32cEngine == NULL)
+	{
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(_WIN32_)
+		crc32cEngine = __builtin_cpu_supports("sse4.2") ? crc32cHard : crc32cSoft;
+#else
+		crc32cEngine = crc32cSoft;
+#endif
+	}
+	return crc32cEngine(crc, b, len);
+}
+
+//
+// frameSeal
+//
+// Description: Store the checksum of a finished frame in its header.
+//
+// Input: unsigned char* frame - The frame buffer.
+// Input: int len - The frame byte count.
+// Output: NA
+void frameSeal(unsigned char* frame, int len)
+{
+	putU32(frame + 10, frameChecksum(frame, len));
+}
+
+//
+// encodePkt
+//
+// Description: Encode a pkt as a data frame.  The payload holds the pkt id,
+//                ackvar, command and the used part of _msgbuf.  The client
+//                address, name and password only go out while the peer has
+//                not acknowledged a frame carrying their current values.
+//
+// Input: struct rupPeer* p - The peer the frame goes to.
+// Input: struct pkt* in - The pkt to encode.
+// Input: unsigned char* frame - A RUP_MAXFRAME buffer for the frame.
+// Input: int* metaVer - Set to the metadata version carried, or -1 if none.
+// Output: int - The byte count of the frame.
+int encodePkt(struct rupPeer* p, struct pkt* in, unsigned char* frame, int* metaVer)
+{
+	// Variable declarations
+	int flags, len, n, msglen;
+	unsigned char* b;
+
+	// Variable assignments
+	flags = RUP_F_BASE | deliverFlag(p->_sock, 1);
+	*metaVer = -1;
+
+	// A change of client address, name or password starts a new metadata
+	//   version which is resent until the receiver has it
+	if((p->_sndMetaVer == 0) ||
+		(p->_sndMeta._client.sin_addr.s_addr != in->_client.sin_addr.s_addr) ||
+		(p->_sndMeta._client.sin_port != in->_client.sin_port) ||
+		(strncmp(p->_sndMeta._name, in->_client_name, NAMESIZE) != 0) ||
+		(strncmp(p->_sndMeta._password, in->_client_password, PASSWORDSIZE) != 0))
+	{
+		p->_sndMeta._client = in->_client;
+		memcpy(p->_sndMeta._name, in->_client_name, NAMESIZE);
+		memcpy(p->_sndMeta._password, in->_client_password, PASSWORDSIZE);
+		p->_sndMetaVer++;
+		p->_sndMetaAcked = 0;
+	}
+	if(!p->_sndMetaAcked)
+	{
+		flags |= RUP_F_META;
+		*metaVer = p->_sndMetaVer;
+	}
+
+	b = encodeOptions(p, frame, &flags, NULL);
+
+	// Payload, trailing zero bytes of _msgbuf are not sent since the
+	//   receiver zero fills the pkt it hands back
+	msglen = BUFSIZE;
+	while((msglen > 0) && (in->_msgbuf[msglen - 1] == 0))
+	{
+		msglen--;
+	}
+	n = (int)strnlen(in->_command, COMMANDSIZE);
+	len = 4 + 1 + 1 + n + msglen;
+	putU32(b, (unsigned int)in->_id);
+	b[4] = (unsigned char)in->_ackvar;
+	b[5] = (unsigned char)n;
+	memcpy(b + 6, in->_command, n);
+	memcpy(b + 6 + n, in->_msgbuf, msglen);
+	b += len;
+
+	flags |= p->_sock->_cksum << RUP_F_CKSUMSHIFT;
+	frameHeader(frame, RUP_T_DATA, flags, p->_sndNext, len, p->_peerCid);
+	frameSeal(frame, (int)(b - frame));
+	return (int)(b - frame);
+}
+
+//
+// encodeOptions
+//
+// Description: Write a data frame's options after its header.  Anything
+//                received from the peer is acknowledged here rather than in
+//                a frame of its own, which adds the ACK and SACK flags.  An
+//                unreliable frame may be lost for good, so it never carries
+//                the ACK, nor takes a sequence number of its stream.
+//
+// Input: struct rupPeer* p - The peer the frame goes to.
+// Input: unsigned char* frame - A RUP_MAXFRAME buffer for the frame.
+// Input: int* flags - The options wanted, updated with the ones added.
+// Input: struct rupOpts* o - The fragment option values, NULL if none.
+// Output: unsigned char* - Where the payload starts.
+unsigned char* encodeOptions(struct rupPeer* p, unsigned char* frame, int* flags, struct rupOpts* o)
+{
+	// Variable declarations
+	int n;
+	unsigned long long sack;
+	unsigned char* b;
+	struct rupStream* st;
+
+	// Variable assignments
+	sack = 0;
+	st = &p->_streams[p->_sock->_stream];
+
+	if((p->_sock->_stream != 0) || (p->_sndStreams))
+	{
+		*flags |= RUP_F_STRM;
+		p->_sndStreams = 1;
+	}
+
+	if((p->_rcvInit) && (!(*flags & RUP_F_UNREL)))
+	{
+		*flags |= RUP_F_ACK | RUP_F_WND;
+		sack = winSackMap(p);
+		if(sack != 0)
+		{
+			*flags |= RUP_F_SACK;
+		}
+		p->_ackPending = 0;
+		p->_lastAck = rupNow();
+	}
+
+	b = frame + RUP_HDRSIZE;
+	putU32(b, p->_sndBase);
+	b += 4;
+	if(*flags & RUP_F_META)
+	{
+		memcpy(b, (char*)&p->_sndMeta._client.sin_addr.s_addr, 4);
+		memcpy(b + 4, (char*)&p->_sndMeta._client.sin_port, 2);
+		b += 6;
+		n = (int)strnlen(p->_sndMeta._name, NAMESIZE);
+		*b++ = (unsigned char)n;
+		memcpy(b, p->_sndMeta._name, n);
+		b += n;
+		n = (int)strnlen(p->_sndMeta._password, PASSWORDSIZE);
+		*b++ = (unsigned char)n;
+		memcpy(b, p->_sndMeta._password, n);
+		b += n;
+	}
+	if(*flags & RUP_F_SACK)
+	{
+		putU32(b, (unsigned int)(sack >> 32));
+		putU32(b + 4, (unsigned int)sack);
+		b += 8;
+	}
+	if(*flags & RUP_F_ACK)
+	{
+		putU32(b, p->_rcvNext);
+		b += 4;
+	}
+	if(*flags & RUP_F_FRAG)
+	{
+		putU32(b, o->_msgId);
+		putU32(b + 4, o->_msgOff);
+		putU32(b + 8, o->_msgTotal);
+		b += 12;
+	}
+	if(*flags & RUP_F_WND)
+	{
+		n = rcvWindow(p->_sock);
+		putU16(b, n);
+		b += 2;
+		if((int)(p->_rcvNext + n - p->_rcvEdge) > 0)
+		{
+			p->_rcvEdge = p->_rcvNext + n;
+		}
+	}
+	if(*flags & RUP_F_STRM)
+	{
+		putU16(b, p->_sock->_stream);
+		putU32(b + 2, st->_sndNext);
+		b += 6;
+	}
+
+	// Stream 0 counts its frames from the start, so its sequence is right
+	//   once the option is first sent
+	if(!(*flags & RUP_F_UNREL))
+	{
+		st->_sndNext++;
+	}
+	return b;
+}
+
+//
+// encodeFrag
+//
+// Description: Encode one fragment of a message as a data frame, gathering
+//                its bytes straight from the caller's iovecs.  The fragment
+//                option names the message, where the fragment starts in it
+//                and the message's full length.
+//
+// Input: struct rupPeer* p - The peer the frame goes to.
+// Input: struct rupCursor* c - Where the fragment's bytes start, advanced
+//          past them.
+// Input: int len - The fragment byte count, at most RUP_FRAGSIZE.
+// Input: struct rupOpts* o - The message id, offset and total length.
+// Input: unsigned char* frame - A RUP_MAXFRAME buffer for the frame.
+// Output: int - The byte count of the frame.
+int encodeFrag(struct rupPeer* p, struct rupCursor* c, int len, struct rupOpts* o, unsigned char* frame)
+{
+	// Variable declarations
+	int flags;
+	unsigned char* b;
+
+	// Variable assignments
+	flags = RUP_F_BASE | RUP_F_FRAG | deliverFlag(p->_sock, o->_msgTotal <= RUP_FRAGSIZE);
+
+	b = encodeOptions(p, frame, &flags, o);
+	iovGather(c, b, len);
+	b += len;
+
+	flags |= p->_sock->_cksum << RUP_F_CKSUMSHIFT;
+	frameHeader(frame, RUP_T_DATA, flags, p->_sndNext, len, p->_peerCid);
+	frameSeal(frame, (int)(b - frame));
+	return (int)(b - frame);
+}
+
+//
+// deliverFlag
+//
+// Description: The header flag naming the socket's delivery class, for a
+//                data frame about to be encoded.
+//
+// Input: struct rupSock* s - The socket state.
+// Input: int whole - Nonzero if the frame holds a whole pkt or message.
+// Output: int - The flag, 0 for RUP_DELIVER_ORDERED.
+int deliverFlag(struct rupSock* s, int whole)
+{
+	switch(s->_deliver)
+	{
+		case RUP_DELIVER_UNORDERED:
+			return RUP_F_UNORD;
+		case RUP_DELIVER_PARTIAL:
+			return RUP_F_PART;
+		case RUP_DELIVER_UNRELIABLE:
+			return (whole) ? RUP_F_UNREL : RUP_F_PART;
+	}
+	return 0;
+}
+
+//
+// frameClass
+//
+// Description: The delivery class of a data frame, from its header flags.
+//
+// Input: int flags - The frame's header flags.
+// Output: int - One of the RUP_DELIVER_* classes.
+int frameClass(int flags)
+{
+	if(flags & RUP_F_UNREL)
+	{
+		return RUP_DELIVER_UNRELIABLE;
+	}
+	if(flags & RUP_F_PART)
+	{
+		return RUP_DELIVER_PARTIAL;
+	}
+	if(flags & RUP_F_UNORD)
+	{
+		return RUP_DELIVER_UNORDERED;
+	}
+	return RUP_DELIVER_ORDERED;
+}
+
+//
+// iovGather
+//
+// Description: Copy bytes out of a caller's iovecs.
+//
+// Input: struct rupCursor* c - Where to start, advanced past the bytes.
+// Input: unsigned char* dst - Where the bytes go.
+// Input: int n - The byte count, no more than the iovecs have left.
+// Output: NA
+void iovGather(struct rupCursor* c, unsigned char* dst, int n)
+{
+	// Variable declarations
+	size_t k;
+
+	while((n > 0) && (c->_idx < c->_cnt))
+	{
+		k = c->_iov[c->_idx].iov_len - c->_pos;
+		k = (k < (size_t)n) ? k : (size_t)n;
+		memcpy((char*)dst, (char*)c->_iov[c->_idx].iov_base + c->_pos, k);
+		dst += k;
+		n -= (int)k;
+		c->_pos += k;
+		if(c->_pos == c->_iov[c->_idx].iov_len)
+		{
+			c->_idx++;
+			c->_pos = 0;
+		}
+	}
+}
+
+//
+// iovScatter
+//
+// Description: Copy bytes into a caller's iovecs, as many as they hold.
+//
+// Input: struct rupCursor* c - Where to start, advanced past the bytes.
+// Input: const unsigned char* src - The bytes.
+// Input: int n - The byte count.
+// Output: int - The number of bytes copied.
+int iovScatter(struct rupCursor* c, const unsigned char* src, int n)
+{
+	// Variable declarations
+	int done;
+	size_t k;
+
+	// Variable assignments
+	done = 0;
+
+	while((n > done) && (c->_idx < c->_cnt))
+	{
+		k = c->_iov[c->_idx].iov_len - c->_pos;
+		k = (k < (size_t)(n - done)) ? k : (size_t)(n - done);
+		memcpy((char*)c->_iov[c->_idx].iov_base + c->_pos, (char*)src + done, k);
+		done += (int)k;
+		c->_pos += k;
+		if(c->_pos == c->_iov[c->_idx].iov_len)
+		{
+			c->_idx++;
+			c->_pos = 0;
+		}
+	}
+	return done;
+}
+
+//
+// decodePkt
+//
+// Description: Rebuild a pkt from a data frame, filling in the session
+//                metadata last negotiated with the peer.
+//
+// Input: struct rupPeer* p - The peer that sent the frame.
+// Input: unsigned char* frame - The data frame.
+// Input: int len - The byte count of the frame.
+// Input: struct pkt* out - The pkt to fill in.
+// Output: NA
+void decodePkt(struct rupPeer* p, unsigned char* frame, int len, struct pkt* out)
+{
+	// Variable declarations
+	int n, paylen;
+	unsigned char* b;
+	struct rupOpts o;
+
+	memset((char*)out,0,sizeof(struct pkt));
+
+	if(!frameOptions(frame, len, &o))
+	{
+		return;
+	}
+
+	if(o._meta != NULL)
+	{
+		b = o._meta;
+		memset((char*)&p->_rcvMeta,0,sizeof(struct rupMeta));
+		p->_rcvMeta._client.sin_family = AF_INET;
+		memcpy((char*)&p->_rcvMeta._client.sin_addr.s_addr, b, 4);
+		memcpy((char*)&p->_rcvMeta._client.sin_port, b + 4, 2);
+		b += 6;
+		n = *b++;
+		memcpy(p->_rcvMeta._name, b, (n < NAMESIZE) ? n : NAMESIZE - 1);
+		b += n;
+		n = *b++;
+		memcpy(p->_rcvMeta._password, b, (n < PASSWORDSIZE) ? n : PASSWORDSIZE - 1);
+	}
+	out->_client = p->_rcvMeta._client;
+	memcpy(out->_client_name, p->_rcvMeta._name, NAMESIZE);
+	memcpy(out->_client_password, p->_rcvMeta._password, PASSWORDSIZE);
+
+	// Payload
+	b = o._payload;
+	paylen = o._paylen;
+	if(paylen >= 6)
+	{
+		out->_id = (int)getU32(b);
+		out->_ackvar = (char)b[4];
+		n = b[5];
+		if((n < COMMANDSIZE) && (6 + n <= paylen))
+		{
+			memcpy(out->_command, b + 6, n);
+			paylen -= 6 + n;
+			memcpy(out->_msgbuf, b + 6 + n, (paylen < BUFSIZE) ? paylen : BUFSIZE);
+		}
+	}
+
+	// Callers check the pkt checksum the same way they always have
+	out->_checksum = performChecksum(out);
+}
+
+//
+// frameOptions
+//
+// Description: Locate the options and payload of a frame.  Each option is
+//                present only when its flag is set, and they follow the
+//                header in flag bit order.
+//
+// Input: unsigned char* frame - The frame buffer.
+// Input: int len - The frame byte count.
+// Input: struct rupOpts* o - Filled in with the options found.
+// Output: int - Returns 1 if the frame is well formed and 0 otherwise.
+int frameOptions(unsigned char* frame, int len, struct rupOpts* o)
+{
+	// Variable declarations
+	unsigned char* b;
+	unsigned char* end;
+
+	// Variable assignments
+	memset((char*)o,0,sizeof(struct rupOpts));
+	o->_wnd = -1;
+	o->_flags = getU16(frame + 2);
+	o->_paylen = getU16(frame + 8);
+	b = frame + RUP_HDRSIZE;
+	end = frame + len - o->_paylen;
+
+	if(end < b)
+	{
+		return 0;
+	}
+
+	if(o->_flags & RUP_F_BASE)
+	{
+		if(b + 4 > end)
+		{
+			return 0;
+		}
+		o->_base = getU32(b);
+		b += 4;
+	}
+	if(o->_flags & RUP_F_META)
+	{
+		// address, port, then a length prefixed name and password
+		o->_meta = b;
+		b += 6;
+		if((b >= end) || (b + 1 + b[0] >= end))
+		{
+			return 0;
+		}
+		b += 1 + b[0];
+		if(b + 1 + b[0] > end)
+		{
+			return 0;
+		}
+		b += 1 + b[0];
+	}
+	if(o->_flags & RUP_F_SACK)
+	{
+		if(b + 8 > end)
+		{
+			return 0;
+		}
+		o->_sack = (((unsigned long long)getU32(b)) << 32) | getU32(b + 4);
+		b += 8;
+	}
+	if(o->_flags & RUP_F_ACK)
+	{
+		if(b + 4 > end)
+		{
+			return 0;
+		}
+		o->_ack = getU32(b);
+		b += 4;
+	}
+	if(o->_flags & RUP_F_FRAG)
+	{
+		if(b + 12 > end)
+		{
+			return 0;
+		}
+		o->_msgId = getU32(b);
+		o->_msgOff = getU32(b + 4);
+		o->_msgTotal = getU32(b + 8);
+		b += 12;
+	}
+	if(o->_flags & RUP_F_WND)
+	{
+		if(b + 2 > end)
+		{
+			return 0;
+		}
+		o->_wnd = getU16(b);
+		b += 2;
+	}
+	if(o->_flags & RUP_F_STRM)
+	{
+		if(b + 6 > end)
+		{
+			return 0;
+		}
+		o->_stream = getU16(b);
+		o->_strmSeq = getU32(b + 2);
+		b += 6;
+		if(o->_stream >= RUP_MAXSTREAMS)
+		{
+			return 0;
+		}
+	}
+
+	o->_payload = end;
+	return 1;
+}
+
+//
+// winSend
+//
+// Description: Send, or resend, the frame held in a send window slot.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rupPeer* p - The peer the slot belongs to.
+// Input: struct winSlot* slot - The slot holding the frame.
+// Output: NA
+void winSend(int rfd, struct rupPeer* p, struct winSlot* slot)
+{
+	txQueue(rfd, p->_sock, slot->_frame, slot->_len, p, slot);
+	slot->_sent = rupNow();
+	if(slot->_retries == 0)
+	{
+		p->_sock->_classes[slot->_cls]._sent++;
+	}
+	else
+	{
+		p->_sock->_classes[slot->_cls]._retransmits++;
+		p->_stats._retransmits[(getU16(slot->_frame + 2) & RUP_F_FRAG) ? RUP_PRIM_WRITEMSG : RUP_PRIM_WRITE]++;
+	}
+}
+
+//
+// winAck
+//
+// Description: Acknowledge everything received from a peer in one frame:
+//                a cumulative sequence plus a SACK map of the out of order
+//                frames being held.  Nothing else goes on the wire.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rupPeer* p - The peer being acknowledged.
+// Output: NA
+void winAck(int rfd, struct rupPeer* p)
+{
+	// Variable declarations
+	int len, wnd;
+	unsigned long long sack;
+	unsigned char* outAck;
+
+	// Variable assignments
+	sack = winSackMap(p);
+	wnd = rcvWindow(p->_sock);
+	outAck = p->_ackFrame;
+
+	// The sealed ACK is kept per peer, so answering a retransmit with an
+	//   ACK already sent costs no encoding or checksum
+	if((p->_ackLen == 0) || (p->_ackSeq != p->_rcvNext) || (p->_ackSack != sack) || (p->_ackWnd != wnd) ||
+		((int)((getU16(outAck + 2) & RUP_F_CKSUMMASK) >> RUP_F_CKSUMSHIFT) != p->_sock->_cksum) ||
+		(getU32(outAck + 14) != p->_peerCid))
+	{
+		len = RUP_HDRSIZE;
+		if(sack != 0)
+		{
+			frameHeader(outAck, RUP_T_ACK, RUP_F_SACK | RUP_F_WND | (p->_sock->_cksum << RUP_F_CKSUMSHIFT), p->_rcvNext, 0, p->_peerCid);
+			putU32(outAck + len, (unsigned int)(sack >> 32));
+			putU32(outAck + len + 4, (unsigned int)sack);
+			len += 8;
+		}
+		else
+		{
+			frameHeader(outAck, RUP_T_ACK, RUP_F_WND | (p->_sock->_cksum << RUP_F_CKSUMSHIFT), p->_rcvNext, 0, p->_peerCid);
+		}
+		putU16(outAck + len, wnd);
+		len += 2;
+		frameSeal(outAck, len);
+		p->_ackLen = len;
+		p->_ackSeq = p->_rcvNext;
+		p->_ackSack = sack;
+		p->_ackWnd = wnd;
+	}
+
+	// The peer may send up to the edge of the largest window offered
+	if((int)(p->_rcvNext + wnd - p->_rcvEdge) > 0)
+	{
+		p->_rcvEdge = p->_rcvNext + wnd;
+	}
+	if(wnd < RUP_MAXWINDOW)
+	{
+		p->_sock->_wndLow = 1;
+	}
+
+	txQueue(rfd, p->_sock, outAck, p->_ackLen, p, NULL);
+	p->_lastAck = rupNow();
+	p->_ackPending = 0;
+}
+
+//
+// winSackMap
+//
+// Description: Build the SACK map of the out of order frames held for a
+//                peer, bit 0 standing for the sequence after the cumulative
+//                ACK point.
+//
+// Input: struct rupPeer* p - The peer being acknowledged.
+// Output: unsigned long long sack - The SACK map.
+unsigned long long winSackMap(struct rupPeer* p)
+{
+	// Variable declarations
+	int i;
+	unsigned int seq;
+	unsigned long long sack;
+	struct winSlot* slot;
+
+	// Variable assignments
+	sack = 0;
+
+	if(p->_rcv == NULL)
+	{
+		return 0;
+	}
+	for(i = 0;i < RUP_MAXWINDOW - 1;++i)
+	{
+		seq = p->_rcvNext + 1 + i;
+		slot = &p->_rcv[seq % RUP_MAXWINDOW];
+		if((slot->_used) && (slot->_seq == seq))
+		{
+			sack |= 1ULL << i;
+		}
+	}
+	return sack;
+}
+
+//
+// winAckFlush
+//
+// Description: Send the delayed ACK of every peer whose ACK is due.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rupSock* s - The socket state.
+// Input: int all - Nonzero to send every pending ACK, due or not.
+// Output: NA
+void winAckFlush(int rfd, struct rupSock* s, int all)
+{
+	// Variable declarations
+	long long now;
+	struct rupPeer* p;
+
+	// Variable assignments
+	now = rupNow();
+
+	for(p = s->_peers;p != NULL;p = p->_next)
+	{
+		if((p->_ackPending) && ((all) || (now >= p->_ackDue)))
+		{
+			winAck(rfd, p);
+		}
+	}
+}
+
+//
+// winAckInput
+//
+// Description: Apply a cumulative ACK and SACK map to a peer's send window.
+//                Acknowledged slots are freed and the window slides.  A hole
+//                that RUP_DUPTHRESH later ACKs have reported frames beyond
+//                is retransmitted at once, and only the holes are resent.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rupPeer* p - The peer that sent the ACK.
+// Input: unsigned int cum - Every sequence below this has arrived.
+// Input: unsigned long long sack - Frames held beyond cum, bit 0 is cum+1.
+// Input: int wnd - The frames the peer can take beyond cum, -1 if the ACK
+//          did not say.
+// Input: int pure - 1 if the ACK came in its own frame, 0 if it rode on data.
+// Output: NA
+void winAckInput(int rfd, struct rupPeer* p, unsigned int cum, unsigned long long sack, int wnd, int pure)
+{
+	// Variable declarations
+	int i, acked, above, freed, spurious, expired;
+	unsigned int seq, highest;
+	long long now, rtt;
+	struct winSlot* slot;
+	const struct rupCongestion* cc;
+
+	// Variable assignments
+	now = rupNow();
+	rtt = -1;
+	highest = cum;
+	freed = 0;
+	spurious = 0;
+	expired = 0;
+	cc = &rupCCs[p->_sock->_cc];
+
+	// An ACK for data never sent is bogus
+	if((int)(cum - p->_sndPaced) > 0)
+	{
+		return;
+	}
+	p->_ackHeard = now;
+
+	// The receiver has moved past the frames given up on
+	if((p->_fwdPending) && ((int)(cum - p->_fwdSeq) >= 0))
+	{
+		p->_fwdPending = 0;
+	}
+
+	// The newest ACK tells how much more the receiver can take.  A data
+	//   frame is resent with the options it was first sealed with, so only
+	//   a pure ACK may update the window without moving cum forward
+	if((wnd >= 0) && (((int)(cum - p->_rwndAck) > 0) || ((pure) && (cum == p->_rwndAck))))
+	{
+		p->_rwnd = (wnd < RUP_MAXWINDOW) ? wnd : RUP_MAXWINDOW;
+		p->_rwndAck = cum;
+	}
+
+	// Nothing was ever sent to this peer
+	if(p->_snd == NULL)
+	{
+		return;
+	}
+
+	for(seq = p->_sndBase;seq != p->_sndPaced;++seq)
+	{
+		slot = &p->_snd[seq % RUP_MAXWINDOW];
+		if((!slot->_used) || (slot->_seq != seq))
+		{
+			continue;
+		}
+
+		i = (int)(seq - cum) - 1;
+		acked = ((int)(seq - cum) < 0) || ((i >= 0) && (i < 64) && ((sack >> i) & 1));
+		if(!acked)
+		{
+			continue;
+		}
+
+		// Karn's rule: an ACK for a retransmitted frame could belong to
+		//   any of its copies, so only first transmissions are timed.
+		//   The newest frame acknowledged gives the freshest sample.
+		if(slot->_retries == 0)
+		{
+			rtt = now - slot->_sent;
+		}
+
+		// An ACK for a frame a timeout marked lost, before or this soon
+		//   after it was sent again, cannot be for the new copy: the
+		//   original was only late
+		else if((p->_undoCwnd != 0) && ((slot->_lost) || (2 * (now - slot->_sent) < p->_srtt)))
+		{
+			spurious = 1;
+		}
+
+		// The receiver now holds the metadata this frame carried
+		if(slot->_metaVer == p->_sndMetaVer)
+		{
+			p->_sndMetaAcked = 1;
+		}
+		if((int)(seq - highest) > 0)
+		{
+			highest = seq;
+		}
+		p->_sock->_classes[slot->_cls]._acked++;
+		slot->_used = 0;
+		if(slot->_lost)
+		{
+			slot->_lost = 0;
+			p->_lost--;
+		}
+		else
+		{
+			p->_inFlight--;
+		}
+		freed++;
+	}
+
+	if(rtt >= 0)
+	{
+		rttSample(p, rtt);
+	}
+	winSlide(p, now);
+	if(spurious)
+	{
+		ccUndo(p);
+	}
+	ccRecovered(p);
+
+	// Retransmit a hole once RUP_DUPTHRESH later frames are known to have
+	//   arrived.  Frames are counted rather than ACKs, so a receiver that
+	//   answers a whole batch with one ACK still triggers it.  The hole that
+	//   starts a recovery goes out at once, later ones as the congestion
+	//   window lets them.
+	above = 0;
+	for(seq = highest;(int)(seq - p->_sndBase) >= 0;--seq)
+	{
+		slot = &p->_snd[seq % RUP_MAXWINDOW];
+		if((!slot->_used) || (slot->_seq != seq))
+		{
+			++above;
+		}
+		else if(above > slot->_dups)
+		{
+			// A partial frame out of tries is given up on instead
+			if((slot->_dups < RUP_DUPTHRESH) && (above >= RUP_DUPTHRESH) && (!slot->_lost) &&
+				(slot->_tries > 0) && (slot->_retries + 1 >= slot->_tries))
+			{
+				winExpire(p, slot);
+				expired = 1;
+				continue;
+			}
+			if((slot->_dups < RUP_DUPTHRESH) && (above >= RUP_DUPTHRESH) && (!slot->_lost))
+			{
+				slot->_retries++;
+				if(p->_inRecovery)
+				{
+					winLost(p, slot);
+				}
+				else
+				{
+					winSend(rfd, p, slot);
+				}
+				if(cc->_loss != NULL)
+				{
+					cc->_loss(p);
+				}
+			}
+			slot->_dups = above;
+		}
+	}
+
+	if((freed > 0) && (cc->_ack != NULL))
+	{
+		cc->_ack(p, freed, rtt, now);
+	}
+	if(expired)
+	{
+		winForward(rfd, p);
+	}
+
+	// The ACK made room in the congestion window
+	winPace(rfd, p, now);
+}
+
+//
+// winAckNew
+//
+// Description: Whether a cumulative ACK and SACK map acknowledge any frame
+//                of a peer's send window that winAckInput has not freed.
+//
+// Input: struct rupPeer* p - The peer that sent the ACK.
+// Input: unsigned int cum - Every sequence below this has arrived.
+// Input: unsigned long long sack - Frames held beyond cum, bit 0 is cum+1.
+// Output: int - Returns 1 if the ACK is new and 0 otherwise.
+int winAckNew(struct rupPeer* p, unsigned int cum, unsigned long long sack)
+{
+	// Variable declarations
+	int i;
+	unsigned int seq;
+	struct winSlot* slot;
+
+	if((p->_snd == NULL) || ((int)(cum - p->_sndPaced) > 0))
+	{
+		return 0;
+	}
+	for(seq = p->_sndBase;seq != p->_sndPaced;++seq)
+	{
+		slot = &p->_snd[seq % RUP_MAXWINDOW];
+		i = (int)(seq - cum) - 1;
+		if((slot->_used) && (slot->_seq == seq) && (((int)(seq - cum) < 0) || ((i >= 0) && (i < 64) && ((sack >> i) & 1))))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//
+// winDeliver
+//
+// Description: Decode a received frame onto the socket's ready queue where
+//                rup_read will pick it up, unless it was handed out early.
+//
+// Input: struct rupSock* s - The socket state.
+// Input: struct rupPeer* p - The peer that sent the frame.
+// Input: struct winSlot* slot - The receive slot holding the frame.
+// Output: NA
+void winDeliver(struct rupSock* s, struct rupPeer* p, struct winSlot* slot)
+{
+	// Variable declarations
+	struct rupStream* st;
+
+	// Variable assignments
+	st = &p->_streams[(slot->_stream >= 0) ? slot->_stream : 0];
+
+	// Everything before the frame is in, so its stream has caught up
+	//   with it whatever winStreams already handed out
+	if(slot->_stream < 0)
+	{
+		st->_rcvNext++;
+	}
+	else if((int)(slot->_strmSeq + 1 - st->_rcvNext) > 0)
+	{
+		st->_rcvNext = slot->_strmSeq + 1;
+	}
+
+	// Message fragments are reassembled rather than queued as pkts
+	if(slot->_early)
+	{
+		slot->_early = 0;
+	}
+	else if(getU16(slot->_frame + 2) & RUP_F_FRAG)
+	{
+		msgDeliver(s, p, slot->_frame, slot->_len);
+	}
+	else
+	{
+		readyPush(s, p, slot->_frame, slot->_len);
+	}
+	slot->_used = 0;
+}
+
+//
+// readyPush
+//
+// Description: Decode a data frame onto the socket's ready queue.
+//
+// Input: struct rupSock* s - The socket state.
+// Input: struct rupPeer* p - The peer that sent the frame.
+// Input: unsigned char* frame - The data frame.
+// Input: int len - The frame byte count.
+// Output: NA
+void readyPush(struct rupSock* s, struct rupPeer* p, unsigned char* frame, int len)
+{
+	// Variable declarations
+	struct rupReady* r;
+
+	// Variable assignments
+	r = readyAlloc(s);
+
+	r->_len = sizeof(struct pkt);
+	r->_from = p->_addr;
+	decodePkt(p, frame, len, &r->_pkt);
+	r->_next = NULL;
+
+	if(s->_readyTail != NULL)
+	{
+		s->_readyTail->_next = r;
+	}
+	else
+	{
+		s->_readyHead = r;
+	}
+	s->_readyTail = r;
+	s->_readyLen++;
+	s->_rcvUsed++;
+	s->_classes[frameClass(getU16(frame + 2))]._delivered++;
+}
+
+//
+// winHandOut
+//
+// Description: Hand a frame holding a whole pkt, or a message of one
+//                fragment, to the application without waiting for the
+//                frames before it.
+//
+// Input: struct rupSock* s - The socket state.
+// Input: struct rupPeer* p - The peer that sent the frame.
+// Input: unsigned char* frame - The data frame.
+// Input: int len - The frame byte count.
+// Input: int early - Nonzero if frames before it are still missing.
+// Output: NA
+void winHandOut(struct rupSock* s, struct rupPeer* p, unsigned char* frame, int len, int early)
+{
+	// Variable declarations
+	struct rupOpts o;
+	struct rupMsg* m;
+
+	if(!(getU16(frame + 2) & RUP_F_FRAG))
+	{
+		readyPush(s, p, frame, len);
+	}
+	else
+	{
+		if((!frameOptions(frame, len, &o)) || (o._msgOff != 0) || ((unsigned int)o._paylen != o._msgTotal))
+		{
+			return;
+		}
+
+		// The message in reassembly, if any, is left alone
+		m = msgAlloc(s, o._msgTotal);
+		m->_id = o._msgId;
+		m->_stream = o._stream;
+		m->_from = p->_addr;
+		msgGrow(m, o._paylen);
+		memcpy((char*)m->_buf, (char*)o._payload, o._paylen);
+		m->_got = o._paylen;
+		msgQueue(s, m);
+		s->_classes[frameClass(o._flags)]._delivered++;
+	}
+	if(early)
+	{
+		s->_classes[frameClass(getU16(frame + 2))]._early++;
+	}
+}
+
+//
+// popReady
+//
+// Description: Hand the oldest in order pkt on the ready queue to the caller.
+//
+// Input: struct rupSock* s - The socket state.
+// Input: void* buf - A pointer to the buffer receiving the pkt.
+// Input: int cc - The byte count/size of buf.
+// Input: struct sockaddr_in* from - Filled in with the sender's address.
+// Output: int - Returns 1 if a pkt was handed out and 0 if the queue is empty.
+int popReady(struct rupSock* s, void* buf, int cc, struct sockaddr_in* from)
+{
+	// Variable declarations
+	struct rupReady* r;
+
+	// Variable assignments
+	r = s->_readyHead;
+
+	if(r == NULL)
+	{
+		return 0;
+	}
+
+	s->_readyHead = r->_next;
+	if(s->_readyHead == NULL)
+	{
+		s->_readyTail = NULL;
+	}
+	s->_readyLen--;
+	s->_rcvUsed--;
+
+	memset((char*)buf,0,cc);
+	memcpy((char*)buf, (char*)&r->_pkt, (cc < r->_len) ? cc : r->_len);
+	if(from != NULL)
+	{
+		*from = r->_from;
+	}
+	readyRelease(s, r);
+	rcvUpdate(s);
+	return 1;
+}
+
+//
+// readyAlloc
+//
+// Description: Take a ready queue entry from the socket's pool, or from the
+//                heap while the pool is still filling.
+//
+// Input: struct rupSock* s - The socket state.
+// Output: struct rupReady* - The entry.
+struct rupReady* readyAlloc(struct rupSock* s)
+{
+	// Variable declarations
+	struct rupReady* r;
+
+	// Variable assignments
+	r = s->_readyFree;
+
+	if(r != NULL)
+	{
+		s->_readyFree = r->_next;
+		s->_readyFreeLen--;
+		rupAllocs._reuses++;
+		return r;
+	}
+
+	rupAllocs._allocs++;
+	return new struct rupReady;
+}
+
+//
+// readyRelease
+//
+// Description: Return a ready queue entry to the socket's pool, keeping at
+//                most RUP_READYPOOL of them.
+//
+// Input: struct rupSock* s - The socket state.
+// Input: struct rupReady* r - The entry.
+// Output: NA
+void readyRelease(struct rupSock* s, struct rupReady* r)
+{
+	if(s->_readyFreeLen >= RUP_READYPOOL)
+	{
+		delete r;
+		rupAllocs._frees++;
+		return;
+	}
+	r->_next = s->_readyFree;
+	s->_readyFree = r;
+	s->_readyFreeLen++;
+}
+
+//
+// msgDeliver
+//
+// Description: Add an in order fragment to the message being reassembled
+//                for its peer and stream, and queue the message for
+//                rup_readmsg once every byte is in.  Fragments of a message
+//                arrive in order so each one continues where the last one
+//                stopped.
+//
+// Input: struct rupSock* s - The socket state.
+// Input: struct rupPeer* p - The peer the fragment came from.
+// Input: unsigned char* frame - The fragment frame.
+// Input: int len - The frame byte count.
+// Output: NA
+void msgDeliver(struct rupSock* s, struct rupPeer* p, unsigned char* frame, int len)
+{
+	// Variable declarations
+	struct rupOpts o;
+	struct rupMsg* m;
+	struct rupStream* st;
+
+	if((!frameOptions(frame, len, &o)) || (o._msgTotal > RUP_MAXMSG) || (o._msgOff + o._paylen > o._msgTotal))
+	{
+		return;
+	}
+
+	// Variable assignments
+	st = &p->_streams[o._stream];
+
+	// The first fragment starts a message, dropping any the sender gave
+	//   up on part way through
+	if(o._msgOff == 0)
+	{
+		if(st->_asm != NULL)
+		{
+			msgRelease(s, st->_asm);
+		}
+		st->_asm = msgAlloc(s, o._msgTotal);
+		st->_asm->_id = o._msgId;
+		st->_asm->_stream = o._stream;
+		st->_asm->_from = p->_addr;
+	}
+
+	m = st->_asm;
+
+	if((m == NULL) || (m->_id != o._msgId) || ((int)o._msgOff != m->_got))
+	{
+		return;
+	}
+
+	msgGrow(m, m->_got + o._paylen);
+	memcpy((char*)m->_buf + m->_got, (char*)o._payload, o._paylen);
+	m->_got += o._paylen;
+
+	if(m->_got == m->_len)
+	{
+		st->_asm = NULL;
+		msgQueue(s, m);
+		s->_classes[frameClass(o._flags)]._delivered++;
+	}
+}
+
+//
+// msgQueue
+//
+// Description: Queue a complete message for rup_readmsg.
+//
+// Input: struct rupSock* s - The socket state.
+// Input: struct rupMsg* m - The message.
+// Output: NA
+void msgQueue(struct rupSock* s, struct rupMsg* m)
+{
+	m->_next = NULL;
+	if(s->_msgTail != NULL)
+	{
+		s->_msgTail->_next = m;
+	}
+	else
+	{
+		s->_msgHead = m;
+	}
+	s->_msgTail = m;
+	s->_msgLen++;
+	s->_rcvUsed += (m->_len > RUP_FRAGSIZE) ? (m->_len + RUP_FRAGSIZE - 1) / RUP_FRAGSIZE : 1;
+}
+
+//
+// msgAlloc
+//
+// Description: Take a reassembly buffer from the socket's pool.  It holds
+//                at least one fragment, msgGrow makes room for the rest as
+//                they arrive, so a first fragment claiming a large message
+//                costs no more memory than it carries.
+//
+// Input: struct rupSock* s - The socket state.
+// Input: int len - The message byte count.
+// Output: struct rupMsg* - The empty message.
+struct rupMsg* msgAlloc(struct rupSock* s, int len)
+{
+	// Variable declarations
+	struct rupMsg* m;
+
+	// Variable assignments
+	m = s->_msgFree;
+
+	if(m != NULL)
+	{
+		s->_msgFree = m->_next;
+		s->_msgFreeLen--;
+		rupAllocs._reuses++;
+	}
+	else
+	{
+		m = new struct rupMsg;
+		memset((char*)m,0,sizeof(struct rupMsg));
+		rupAllocs._allocs++;
+	}
+
+	if(m->_buf == NULL)
+	{
+		m->_cap = RUP_FRAGSIZE;
+		m->_buf = new unsigned char[m->_cap];
+		rupAllocs._allocs++;
+	}
+	m->_len = len;
+	m->_got = 0;
+	m->_next = NULL;
+	return m;
+}
+
+//
+// msgGrow
+//
+// Description: Make room in a message's buffer for len bytes, doubling it
+//                up to the message size and keeping the bytes already in.
+//
+// Input: struct rupMsg* m - The message.
+// Input: int len - The byte count the buffer must hold.
+// Output: NA
+void msgGrow(struct rupMsg* m, int len)
+{
+	// Variable declarations
+	int cap;
+	unsigned char* buf;
+
+	if(m->_cap >= len)
+	{
+		return;
+	}
+
+	// Variable assignments
+	cap = m->_cap;
+
+	while(cap < len)
+	{
+		cap *= 2;
+	}
+	cap = (cap < m->_len) ? cap : m->_len;
+	buf = new unsigned char[cap];
+	memcpy((char*)buf, (char*)m->_buf, m->_got);
+	delete [] m->_buf;
+	m->_buf = buf;
+	m->_cap = cap;
+	rupAllocs._allocs++;
+	rupAllocs._frees++;
+}
+
+//
+// msgRelease
+//
+// Description: Return a message's buffer to the socket's pool, keeping at
+//                most RUP_MSGPOOL of them.  A buffer grown past RUP_MSGKEEP
+//                for one large message is freed instead, so a burst of
+//                large messages does not stay pinned in the pool.
+//
+// Input: struct rupSock* s - The socket state.
+// Input: struct rupMsg* m - The message.
+// Output: NA
+void msgRelease(struct rupSock* s, struct rupMsg* m)
+{
+	if((s->_msgFreeLen >= RUP_MSGPOOL) || (m->_cap > RUP_MSGKEEP))
+	{
+		delete [] m->_buf;
+		delete m;
+		rupAllocs._frees += 2;
+		return;
+	}
+	m->_next = s->_msgFree;
+	s->_msgFree = m;
+	s->_msgFreeLen++;
+}
+
+//
+// popMsg
+//
+// Description: Hand out the oldest complete message, of one stream or of
+//                any.
+//
+// Input: struct rupSock* s - The socket state.
+// Input: int* stream - The stream wanted, NULL or RUP_ANYSTREAM for any,
+//          set to the message's stream.
+// Input: struct rupCursor* c - The caller's iovecs, filled with as much of
+//          the message as they hold.
+// Input: struct sockaddr_in* from - Set to the sender's address if not NULL.
+// Output: int len - The message byte count, or -1 if none is waiting.
+int popMsg(struct rupSock* s, int* stream, struct rupCursor* c, struct sockaddr_in* from)
+{
+	// Variable declarations
+	int len;
+	struct rupMsg* m;
+	struct rupMsg* prev;
+
+	// Variable assignments
+	m = s->_msgHead;
+	prev = NULL;
+
+	if((stream != NULL) && (*stream != RUP_ANYSTREAM))
+	{
+		while((m != NULL) && (m->_stream != *stream))
+		{
+			prev = m;
+			m = m->_next;
+		}
+	}
+	if(m == NULL)
+	{
+		return -1;
+	}
+
+	if(prev != NULL)
+	{
+		prev->_next = m->_next;
+	}
+	else
+	{
+		s->_msgHead = m->_next;
+	}
+	if(s->_msgTail == m)
+	{
+		s->_msgTail = prev;
+	}
+	s->_msgLen--;
+	s->_rcvUsed -= (m->_len > RUP_FRAGSIZE) ? (m->_len + RUP_FRAGSIZE - 1) / RUP_FRAGSIZE : 1;
+
+	len = m->_len;
+	iovScatter(c, m->_buf, len);
+	if(from != NULL)
+	{
+		*from = m->_from;
+	}
+	if(stream != NULL)
+	{
+		*stream = m->_stream;
+	}
+	msgRelease(s, m);
+	rcvUpdate(s);
+	return len;
+}
+
+//
+// rcvWindow
+//
+// Description: The frames the socket can still take for the application,
+//                advertised to every peer in its ACKs.
+//
+// Input: struct rupSock* s - The socket state.
+// Output: int - The window, 0 to RUP_MAXWINDOW.
+int rcvWindow(struct rupSock* s)
+{
+	// Variable declarations
+	int wnd;
+
+	// Variable assignments
+	wnd = s->_rcvBuf - s->_rcvUsed;
+
+	if(wnd < 0)
+	{
+		return 0;
+	}
+	return (wnd < RUP_MAXWINDOW) ? wnd : RUP_MAXWINDOW;
+}
+
+//
+// rcvUpdate
+//
+// Description: Reopen the window of every peer last offered a small one
+//                once the application has read enough to at least double
+//                it, so a stalled sender need not wait for its probe.
+//                Nothing is sent until a quarter of the largest window, or
+//                half the buffer, is free, so the reopening is worth a frame.
+//
+// Input: struct rupSock* s - The socket state.
+// Output: NA
+void rcvUpdate(struct rupSock* s)
+{
+	// Variable declarations
+	int wnd, least, sent;
+	struct rupPeer* p;
+
+	if(!s->_wndLow)
+	{
+		return;
+	}
+
+	// Variable assignments
+	wnd = rcvWindow(s);
+	least = (s->_rcvBuf / 2 < RUP_MAXWINDOW / 4) ? s->_rcvBuf / 2 : RUP_MAXWINDOW / 4;
+	sent = 0;
+
+	if(wnd < ((least > 1) ? least : 1))
+	{
+		return;
+	}
+
+	s->_wndLow = 0;
+	for(p = s->_peers;p != NULL;p = p->_next)
+	{
+		if((!p->_rcvInit) || (p->_ackWnd >= RUP_MAXWINDOW))
+		{
+			continue;
+		}
+		if(wnd >= 2 * p->_ackWnd + 1)
+		{
+			winAck(s->_fd, p);
+			sent = 1;
+		}
+		else
+		{
+			s->_wndLow = 1;
+		}
+	}
+	if(sent)
+	{
+		txFlush(s->_fd, s);
+	}
+}
+
+//
+// winWrite
+//
+// Description: Encode a pkt into the peer's send window and send it.  Blocks
+//                only while the window is full.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rupSock* s - The socket state.
+// Input: void* buf - A pointer to the pkt being sent.
+// Input: int cc - The byte count/size of buf.
+// Input: struct sockaddr_in* to - The receiver's ip address and port number.
+// Output: int ret - Returns 1 on success and 0 on failure.
+int winWrite(int rfd, struct rupSock* s, void* buf, int cc, struct sockaddr_in* to)
+{
+	// Variable declarations
+	struct rupPeer* p;
+	struct winSlot* slot;
+	struct pkt outPkt;
+
+	if((cc <= 0) || (cc > (int)sizeof(struct pkt)))
+	{
+		return 0;
+	}
+
+	// Variable assignments
+	p = getPeer(s, to);
+
+	memset((char*)&outPkt,0,sizeof(struct pkt));
+	memcpy((char*)&outPkt, (char*)buf, cc);
+
+	slot = winReserve(rfd, s, p);
+	slot->_len = encodePkt(p, &outPkt, slot->_frame, &slot->_metaVer);
+	slot->_queued = rupNow();
+	winCommit(rfd, p, slot);
+	return 1;
+}
+
+//
+// winWriteOnce
+//
+// Description: Encode a pkt as an unreliable frame and queue it, without
+//                a window slot.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rupSock* s - The socket state.
+// Input: void* buf - A pointer to the pkt being sent.
+// Input: int cc - The byte count/size of buf.
+// Input: struct sockaddr_in* to - The receiver's ip address and port number.
+// Output: int ret - Returns 1 on success and 0 on failure.
+int winWriteOnce(int rfd, struct rupSock* s, void* buf, int cc, struct sockaddr_in* to)
+{
+	// Variable declarations
+	int metaVer;
+	struct rupPeer* p;
+	struct pkt outPkt;
+	unsigned char frame[RUP_MAXFRAME];
+
+	if((cc <= 0) || (cc > (int)sizeof(struct pkt)))
+	{
+		return 0;
+	}
+
+	// Variable assignments
+	p = getPeer(s, to);
+
+	memset((char*)&outPkt,0,sizeof(struct pkt));
+	memcpy((char*)&outPkt, (char*)buf, cc);
+
+	winDatagram(rfd, s, p, frame, encodePkt(p, &outPkt, frame, &metaVer));
+	return 1;
+}
+
+//
+// winDatagram
+//
+// Description: Queue an encoded unreliable frame.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rupSock* s - The socket state.
+// Input: struct rupPeer* p - The peer the frame goes to.
+// Input: unsigned char* frame - The sealed frame.
+// Input: int len - The frame byte count.
+// Output: NA
+void winDatagram(int rfd, struct rupSock* s, struct rupPeer* p, unsigned char* frame, int len)
+{
+	txQueue(rfd, s, frame, len, p, NULL);
+	s->_classes[RUP_DELIVER_UNRELIABLE]._sent++;
+	p->_active = 1;
+}
+
+//
+// winReserve
+//
+// Description: Wait for room in a peer's send window, servicing ACKs and
+//                retransmits, and return the slot the next frame goes in.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rupSock* s - The socket state.
+// Input: struct rupPeer* p - The peer the frame goes to.
+// Output: struct winSlot* - The slot to encode the frame into.
+struct winSlot* winReserve(int rfd, struct rupSock* s, struct rupPeer* p)
+{
+	while((int)(p->_sndNext - p->_sndBase) >= s->_window)
+	{
+		winService(rfd, s, -1);
+	}
+	if(p->_snd == NULL)
+	{
+		p->_snd = new struct winSlot[RUP_MAXWINDOW];
+		memset((char*)p->_snd,0,RUP_MAXWINDOW * sizeof(struct winSlot));
+		rupAllocs._allocs++;
+	}
+	p->_active = 1;
+	return &p->_snd[p->_sndNext % RUP_MAXWINDOW];
+}
+
+//
+// winCommit
+//
+// Description: Put the frame encoded into a reserved slot in flight.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rupPeer* p - The peer the frame goes to.
+// Input: struct winSlot* slot - The slot from winReserve.
+// Output: NA
+void winCommit(int rfd, struct rupPeer* p, struct winSlot* slot)
+{
+	// Variable declarations
+	long long now;
+
+	// Variable assignments
+	now = rupNow();
+
+	slot->_seq = p->_sndNext;
+	slot->_used = 1;
+	slot->_retries = 0;
+	slot->_dups = 0;
+	slot->_lost = 0;
+	slot->_cls = frameClass(getU16(slot->_frame + 2));
+	slot->_tries = 0;
+	slot->_expire = 0;
+	p->_sndNext++;
+
+	// A partial frame carries its limits with it, an unreliable message
+	//   too long for one frame gets one try
+	if(slot->_cls == RUP_DELIVER_PARTIAL)
+	{
+		slot->_tries = (p->_sock->_deliver == RUP_DELIVER_UNRELIABLE) ? 1 : p->_sock->_partTries;
+		if((p->_sock->_deliver == RUP_DELIVER_PARTIAL) && (p->_sock->_partBudget > 0))
+		{
+			slot->_expire = now + p->_sock->_partBudget;
+		}
+	}
+
+	winPace(rfd, p, now);
+}
+
+//
+// winLimit
+//
+// Description: The number of frames a peer may have outstanding: the
+//                socket's window, cut down to the peer's congestion window.
+//
+// Input: struct rupSock* s - The socket state.
+// Input: struct rupPeer* p - The peer.
+// Output: int - The limit, at least 1.
+int winLimit(struct rupSock* s, struct rupPeer* p)
+{
+	return (p->_cwnd < s->_window) ? p->_cwnd : s->_window;
+}
+
+//
+// winPace
+//
+// Description: Retransmit the frames marked lost, then send the committed
+//                frames that have not been on the wire yet, while fewer than
+//                the congestion window are in flight (sent and neither ACKed,
+//                SACKed nor lost, as in RFC 6675).  A pacing socket sends
+//                them one gap apart and leaves the rest for winTimers.  The
+//                ones the congestion window holds back go out as ACKs open it.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rupPeer* p - The peer the frames go to.
+// Input: long long now - The current time in microseconds.
+// Output: NA
+void winPace(int rfd, struct rupPeer* p, long long now)
+{
+	// Variable declarations
+	int expired;
+	unsigned int seq;
+	long long gap;
+	struct winSlot* slot;
+
+	// Variable assignments
+	seq = p->_sndBase;
+	expired = 0;
+
+	while(winReady(p))
+	{
+		if((p->_sock->_pacing) && (p->_paceNext > now))
+		{
+			break;
+		}
+		if(p->_lost > 0)
+		{
+			for(slot = &p->_snd[seq % RUP_MAXWINDOW];((!slot->_used) || (!slot->_lost)) && (seq - p->_sndBase < RUP_MAXWINDOW);slot = &p->_snd[seq % RUP_MAXWINDOW])
+			{
+				++seq;
+			}
+
+			// A count the window no longer backs would spin here, it
+			//   is resynced and the new frames get their turn
+			if(seq - p->_sndBase >= RUP_MAXWINDOW)
+			{
+				p->_lost = 0;
+				continue;
+			}
+			slot->_lost = 0;
+			p->_lost--;
+		}
+		else
+		{
+			slot = &p->_snd[p->_sndPaced % RUP_MAXWINDOW];
+
+			// A partial frame whose budget ran out while it waited for
+			//   the window is not worth sending
+			if((slot->_used) && (slot->_expire != 0) && (now >= slot->_expire))
+			{
+				winExpire(p, slot);
+				expired = 1;
+			}
+			p->_sndPaced++;
+			if(!slot->_used)
+			{
+				continue;
+			}
+
+			// The receiver drops a frame that probes its closed window,
+			//   so that transmission is not one of a partial frame's tries
+			if((slot->_tries > 0) && ((int)(slot->_seq - winEdge(p)) >= 0))
+			{
+				slot->_tries++;
+			}
+		}
+		p->_inFlight++;
+		winSend(rfd, p, slot);
+
+		// A sender that fell behind, or was idle, catches up with at
+		//   most RUP_PACE_QUANTUM frames back to back
+		if(p->_sock->_pacing)
+		{
+			gap = paceGap(p);
+			if(p->_paceNext < now - RUP_PACE_QUANTUM * gap)
+			{
+				p->_paceNext = now - RUP_PACE_QUANTUM * gap;
+			}
+			p->_paceNext += gap;
+		}
+	}
+	if(expired)
+	{
+		winForward(rfd, p);
+	}
+}
+
+//
+// winReady
+//
+// Description: Whether winPace has a frame it may send now, pacing aside:
+//                a lost frame, or a new one inside the receiver's window,
+//                while fewer than the congestion window are in flight.  A
+//                closed receiver window still lets one frame out when
+//                nothing is in flight, it probes the window and its RTO
+//                repeats the probe.
+//
+// Input: struct rupPeer* p - The peer.
+// Output: int - Returns 1 if a frame can go and 0 otherwise.
+int winReady(struct rupPeer* p)
+{
+	if(p->_inFlight >= winLimit(p->_sock, p))
+	{
+		return 0;
+	}
+	if(p->_lost > 0)
+	{
+		return 1;
+	}
+	if(p->_sndPaced == p->_sndNext)
+	{
+		return 0;
+	}
+	return (((int)(p->_sndPaced - winEdge(p)) < 0) || (p->_inFlight == 0)) ? 1 : 0;
+}
+
+//
+// winEdge
+//
+// Description: The first sequence beyond the receiver's window.  The window
+//                counts from the base, or from the receiver's last ACK
+//                while it has yet to hear of the frames given up on.
+//
+// Input: struct rupPeer* p - The peer.
+// Output: unsigned int - The sequence number.
+unsigned int winEdge(struct rupPeer* p)
+{
+	if((p->_fwdPending) && ((int)(p->_rwndAck - p->_sndBase) < 0))
+	{
+		return p->_rwndAck + p->_rwnd;
+	}
+	return p->_sndBase + p->_rwnd;
+}
+
+//
+// winLost
+//
+// Description: Take a frame out of flight until winPace has room to
+//                retransmit it.
+//
+// Input: struct rupPeer* p - The peer the frame belongs to.
+// Input: struct winSlot* slot - The slot holding the frame.
+// Output: NA
+void winLost(struct rupPeer* p, struct winSlot* slot)
+{
+	slot->_lost = 1;
+	p->_lost++;
+	p->_inFlight--;
+}
+
+//
+// winExpire
+//
+// Description: Give up on a partial frame.  Its slot is freed as if it had
+//                been acknowledged, and winForward then tells the receiver.
+//
+// Input: struct rupPeer* p - The peer the frame belongs to.
+// Input: struct winSlot* slot - The slot holding the frame.
+// Output: NA
+void winExpire(struct rupPeer* p, struct winSlot* slot)
+{
+	if(slot->_lost)
+	{
+		slot->_lost = 0;
+		p->_lost--;
+	}
+	else if((int)(slot->_seq - p->_sndPaced) < 0)
+	{
+		p->_inFlight--;
+	}
+	slot->_used = 0;
+	slot->_queued = 0;
+	p->_sock->_classes[slot->_cls]._expired++;
+	p->_fwdTries = 0;
+}
+
+//
+// winForward
+//
+// Description: Slide the send window past the frames given up on and send
+//                the receiver a FWD frame with the new base, so it stops
+//                waiting for them.  winTimers repeats the FWD every RTO
+//                until an ACK reaches the base.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rupPeer* p - The peer.
+// Output: NA
+void winForward(int rfd, struct rupPeer* p)
+{
+	// Variable declarations
+	unsigned char frame[RUP_HDRSIZE];
+
+	winSlide(p, rupNow());
+
+	// Frames given up on before they were sent are skipped by winPace too
+	if((int)(p->_sndBase - p->_sndPaced) > 0)
+	{
+		p->_sndPaced = p->_sndBase;
+	}
+
+	frameHeader(frame, RUP_T_FWD, p->_sock->_cksum << RUP_F_CKSUMSHIFT, p->_sndBase, 0, p->_peerCid);
+	frameSeal(frame, RUP_HDRSIZE);
+	txQueue(rfd, p->_sock, frame, RUP_HDRSIZE, p, NULL);
+	p->_fwdSeq = p->_sndBase;
+	p->_fwdSent = rupNow();
+	p->_fwdPending = 1;
+}
+
+//
+// winSlide
+//
+// Description: Move the send window's base past the frames acknowledged or
+//                given up on, timing each write whose last frame it passes.
+//
+// Input: struct rupPeer* p - The peer.
+// Input: long long now - The current time in microseconds.
+// Output: NA
+void winSlide(struct rupPeer* p, long long now)
+{
+	// Variable declarations
+	struct winSlot* slot;
+
+	while(p->_sndBase != p->_sndNext)
+	{
+		slot = &p->_snd[p->_sndBase % RUP_MAXWINDOW];
+		if(slot->_used)
+		{
+			break;
+		}
+		if(slot->_queued != 0)
+		{
+			histRecord(&p->_stats._complete, now - slot->_queued);
+		}
+		p->_sndBase++;
+	}
+}
+
+//
+// paceGap
+//
+// Description: Time between two paced frames, so the congestion window is
+//                spread over one smoothed RTT with some headroom.
+//
+// Input: struct rupPeer* p - The peer.
+// Output: long long gap - The gap in microseconds, 0 until the RTT is known.
+long long paceGap(struct rupPeer* p)
+{
+	// Variable declarations
+	int gain;
+
+	if(p->_samples == 0)
+	{
+		return 0;
+	}
+
+	// Variable assignments
+	gain = (p->_cwnd < p->_ssthresh) ? RUP_PACE_SS : RUP_PACE_CA;
+
+	return p->_srtt * 100 / ((long long)gain * winLimit(p->_sock, p));
+}
+
+//
+// ccInit
+//
+// Description: Start a peer's congestion state over with the socket's
+//                controller.
+//
+// Input: struct rupPeer* p - The peer.
+// Output: NA
+void ccInit(struct rupPeer* p)
+{
+	p->_cwndAcc = 0;
+	p->_undoCwnd = 0;
+	p->_inRecovery = 0;
+	p->_ccRound = p->_sndPaced;
+	p->_ccRttMin = 0;
+	rupCCs[p->_sock->_cc]._init(p);
+}
+
+//
+// ccNoneInit
+//
+// Description: No congestion control, only the socket's window applies.
+//
+// Input: struct rupPeer* p - The peer.
+// Output: NA
+void ccNoneInit(struct rupPeer* p)
+{
+	p->_cwnd = RUP_MAXWINDOW;
+	p->_ssthresh = RUP_MAXWINDOW;
+}
+
+//
+// renoInit
+//
+// Description: Start in slow start from RUP_INITCWND frames.
+//
+// Input: struct rupPeer* p - The peer.
+// Output: NA
+void renoInit(struct rupPeer* p)
+{
+	p->_cwnd = RUP_INITCWND;
+	p->_ssthresh = RUP_MAXWINDOW;
+}
+
+//
+// renoAck
+//
+// Description: NewReno growth (RFC 5681): one frame per frame acknowledged
+//                in slow start, one frame per window after it, nothing
+//                until the frames in flight at a loss are acknowledged.
+//
+// Input: struct rupPeer* p - The peer.
+// Input: int acked - Frames the ACK freed.
+// Input: long long rtt - The RTT the ACK measured, -1 if none.
+// Input: long long now - The current time in microseconds.
+// Output: NA
+void renoAck(struct rupPeer* p, int acked, long long rtt, long long now)
+{
+	// Growth does not depend on the RTT
+	(void)rtt;
+	(void)now;
+
+	if(!ccRecovered(p))
+	{
+		return;
+	}
+
+	if(p->_cwnd < p->_ssthresh)
+	{
+		p->_cwnd += acked;
+	}
+	else
+	{
+		p->_cwndAcc += acked;
+		while(p->_cwndAcc >= p->_cwnd)
+		{
+			p->_cwndAcc -= p->_cwnd;
+			p->_cwnd++;
+		}
+	}
+	if(p->_cwnd > RUP_MAXWINDOW)
+	{
+		p->_cwnd = RUP_MAXWINDOW;
+	}
+}
+
+//
+// renoLoss
+//
+// Description: Halve the window once per window of data that saw loss.
+//
+// Input: struct rupPeer* p - The peer.
+// Output: NA
+void renoLoss(struct rupPeer* p)
+{
+	// Variable declarations
+	int flight;
+
+	if(p->_inRecovery)
+	{
+		return;
+	}
+
+	// Variable assignments
+	flight = p->_inFlight;
+
+	p->_ssthresh = (flight / 2 > RUP_MINCWND) ? flight / 2 : RUP_MINCWND;
+	p->_cwnd = p->_ssthresh;
+	p->_cwndAcc = 0;
+	p->_undoCwnd = 0;
+	p->_inRecovery = 1;
+	p->_recover = p->_sndPaced;
+}
+
+//
+// renoTimeout
+//
+// Description: A retransmit timeout means the ACK clock was lost, start over
+//                from one frame in slow start.  The window before the first
+//                of a row of timeouts is kept for ccUndo.
+//
+// Input: struct rupPeer* p - The peer.
+// Output: NA
+void renoTimeout(struct rupPeer* p)
+{
+	// Variable declarations
+	int flight;
+
+	// Variable assignments
+	flight = p->_inFlight;
+
+	if(p->_undoCwnd == 0)
+	{
+		p->_undoCwnd = p->_cwnd;
+		p->_undoSsthresh = p->_ssthresh;
+	}
+	p->_ssthresh = (flight / 2 > RUP_MINCWND) ? flight / 2 : RUP_MINCWND;
+	p->_cwnd = 1;
+	p->_cwndAcc = 0;
+	p->_inRecovery = 0;
+}
+
+//
+// ccRecovered
+//
+// Description: Leave loss recovery once every frame that was in flight at
+//                the loss has been acknowledged.
+//
+// Input: struct rupPeer* p - The peer.
+// Output: int - Returns 1 when the window may grow and 0 in recovery.
+int ccRecovered(struct rupPeer* p)
+{
+	if((p->_inRecovery) && ((int)(p->_sndBase - p->_recover) >= 0))
+	{
+		p->_inRecovery = 0;
+	}
+	return p->_inRecovery ? 0 : 1;
+}
+
+//
+// ccUndo
+//
+// Description: Put back the window a timeout took away once the timeout
+//                turns out to have been spurious: the RTT rose past the
+//                RTO faster than the estimator followed, nothing was lost.
+//
+// Input: struct rupPeer* p - The peer.
+// Output: NA
+void ccUndo(struct rupPeer* p)
+{
+	if(p->_cwnd < p->_undoCwnd)
+	{
+		p->_cwnd = p->_undoCwnd;
+	}
+	if(p->_ssthresh < p->_undoSsthresh)
+	{
+		p->_ssthresh = p->_undoSsthresh;
+	}
+	p->_cwndAcc = 0;
+	p->_undoCwnd = 0;
+}
+
+//
+// delayAck
+//
+// Description: Delay based growth in the manner of TCP Vegas.  Once per
+//                round trip the frames queued in the network are estimated
+//                from how far the round's smallest RTT sits above the path's
+//                smallest RTT.  The window doubles in slow start until a
+//                queue shows, then moves by one frame to keep between
+//                RUP_DELAY_ALPHA and RUP_DELAY_BETA frames queued.
+//
+// Input: struct rupPeer* p - The peer.
+// Input: int acked - Frames the ACK freed.
+// Input: long long rtt - The RTT the ACK measured, -1 if none.
+// Input: long long now - The current time in microseconds.
+// Output: NA
+void delayAck(struct rupPeer* p, int acked, long long rtt, long long now)
+{
+	// Variable declarations
+	long long queued;
+
+	// Growth does not depend on how much the ACK freed
+	(void)acked;
+
+	if(rtt >= 0)
+	{
+		rtt = (rtt > 0) ? rtt : 1;
+		if((p->_minRtt == 0) || (rtt <= p->_minRtt) || (now - p->_minRttAt > RUP_MINRTT_US))
+		{
+			p->_minRtt = rtt;
+			p->_minRttAt = now;
+		}
+		if((p->_ccRttMin == 0) || (rtt < p->_ccRttMin))
+		{
+			p->_ccRttMin = rtt;
+		}
+	}
+
+	if((!ccRecovered(p)) || ((int)(p->_sndBase - p->_ccRound) < 0) || (p->_ccRttMin == 0))
+	{
+		return;
+	}
+
+	// Variable assignments
+	queued = p->_cwnd * (p->_ccRttMin - p->_minRtt) / p->_ccRttMin;
+	p->_ccRound = p->_sndPaced;
+	p->_ccRttMin = 0;
+
+	if(p->_cwnd < p->_ssthresh)
+	{
+		if(queued > 1)
+		{
+			p->_ssthresh = p->_cwnd;
+		}
+		else
+		{
+			p->_cwnd *= 2;
+		}
+	}
+	else if(queued < RUP_DELAY_ALPHA)
+	{
+		p->_cwnd++;
+	}
+	else if(queued > RUP_DELAY_BETA)
+	{
+		p->_cwnd--;
+	}
+
+	if(p->_cwnd > RUP_MAXWINDOW)
+	{
+		p->_cwnd = RUP_MAXWINDOW;
+	}
+	else if(p->_cwnd < RUP_MINCWND)
+	{
+		p->_cwnd = RUP_MINCWND;
+	}
+}
+
+//
+// delayLoss
+//
+// Description: A delay based sender already keeps queues short, so a loss
+//                is more likely noise than overflow and costs a quarter of
+//                the window once per window.
+//
+// Input: struct rupPeer* p - The peer.
+// Output: NA
+void delayLoss(struct rupPeer* p)
+{
+	if(p->_inRecovery)
+	{
+		return;
+	}
+
+	p->_cwnd = (p->_cwnd * 3 / 4 > RUP_MINCWND) ? p->_cwnd * 3 / 4 : RUP_MINCWND;
+	p->_ssthresh = p->_cwnd;
+	p->_cwndAcc = 0;
+	p->_undoCwnd = 0;
+	p->_inRecovery = 1;
+	p->_recover = p->_sndPaced;
+}
+
+//
+// winInput
+//
+// Description: Process one incoming datagram for the window engine.  ACKs
+//                free send slots, data frames are acknowledged, buffered when
+//                out of order, and moved to the ready queue in order.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: unsigned char* in - The datagram that was received.
+// Input: int len - The byte count of the datagram.
+// Input: struct sockaddr_in* from - The sender's ip address and port number.
+// Output: int - Returns 1 if the datagram was a valid frame and 0 otherwise.
+int winInput(int rfd, unsigned char* in, int len, struct sockaddr_in* from)
+{
+	// Variable declarations
+	int d, type, flags, filled, wnd;
+	unsigned int seq, base;
+	unsigned long long sack;
+	long long* drop;
+	struct rupOpts o;
+	struct rupSock* s;
+	struct rupPeer* p;
+	struct winSlot* slot;
+
+	// Variable assignments
+	s = getSock(rfd);
+	drop = NULL;
+
+	// Frames from another version, truncated, damaged or unknown frames
+	//   are dropped and left for the sender to retransmit.  No peer is
+	//   looked up for them, they are counted on the socket.
+	if((len < RUP_HDRSIZE) || (in[0] != RUP_VERSION) || ((int)getU16(in + 8) > len - RUP_HDRSIZE) ||
+		(((getU16(in + 2) & RUP_F_CKSUMMASK) >> RUP_F_CKSUMSHIFT) > RUP_CKSUM_CRC32C))
+	{
+		drop = &s->_stats._foreign;
+	}
+	else if(getU32(in + 10) != frameChecksum(in, len))
+	{
+		drop = &s->_stats._badChecksum;
+	}
+	else if((in[1] < RUP_T_DATA) || (in[1] > RUP_T_WELCOME) ||
+		((in[1] == RUP_T_DATA) && ((!(getU16(in + 2) & RUP_F_BASE)) || (!frameOptions(in, len, &o)))))
+	{
+		drop = &s->_stats._foreign;
+	}
+	if(drop != NULL)
+	{
+		(*drop)++;
+		s->_stats._received++;
+		s->_stats._receivedBytes += len;
+		return 0;
+	}
+
+	type = in[1];
+	flags = getU16(in + 2);
+	seq = getU32(in + 4);
+	sack = 0;
+	wnd = -1;
+	if(type == RUP_T_ACK)
+	{
+		d = RUP_HDRSIZE;
+		if((flags & RUP_F_SACK) && (len >= d + 8))
+		{
+			sack = (((unsigned long long)getU32(in + d)) << 32) | getU32(in + d + 4);
+			d += 8;
+		}
+		if((flags & RUP_F_WND) && (len >= d + 2))
+		{
+			wnd = getU16(in + d);
+		}
+	}
+	p = peerOf(rfd, s, in, from);
+
+	// An answer from an address this socket has no peer for, one it
+	//   forgot or never wrote to, is not worth keeping state for, nor is
+	//   a new address once every peer the socket may keep is busy
+	if(p == NULL)
+	{
+		s->_stats._foreign++;
+		s->_stats._received++;
+		s->_stats._receivedBytes += len;
+		return 0;
+	}
+	p->_stats._received++;
+	p->_stats._receivedBytes += len;
+	p->_active = 1;
+	p->_abandoned = 0;
+
+	// A connection whose frames now come from another address, a client
+	//   behind a NAT that rebound, is moved there before anything is sent
+	//   back, but only by a frame that moves it forward
+	if(((p->_addr.sin_addr.s_addr != from->sin_addr.s_addr) || (p->_addr.sin_port != from->sin_port)) &&
+		(peerFresh(p, type, flags, seq, sack, &o)))
+	{
+		peerMove(s, p, from);
+	}
+
+	if(type == RUP_T_ACK)
+	{
+		winAckInput(rfd, p, seq, sack, wnd, 1);
+		return 1;
+	}
+
+	if(type == RUP_T_FWD)
+	{
+		winForwardInput(rfd, s, p, seq);
+		return 1;
+	}
+
+	if((type == RUP_T_HELLO) || (type == RUP_T_WELCOME))
+	{
+		helloInput(rfd, p, type, in, len);
+		return 1;
+	}
+
+	base = o._base;
+
+	// An unreliable frame stands outside the window, it is handed out at
+	//   once unless the application is already behind
+	if(flags & RUP_F_UNREL)
+	{
+		if(rcvWindow(s) > 0)
+		{
+			winHandOut(s, p, in, len, 0);
+		}
+		return 1;
+	}
+
+	// Data flowing back to us may carry the ACK for our own frames
+	if(flags & RUP_F_ACK)
+	{
+		winAckInput(rfd, p, o._ack, o._sack, o._wnd, 0);
+	}
+
+	// A new sender, or one that restarted at a far away sequence number,
+	//   defines where its stream begins.  Late duplicates carry an old
+	//   base but are never that far behind.
+	if((!p->_rcvInit) || ((int)(seq - p->_rcvNext) > RUP_RESYNC) || ((int)(p->_rcvNext - seq) > RUP_RESYNC))
+	{
+		winRestart(p, base);
+	}
+	winAdvance(s, p, base);
+
+	d = (int)(seq - p->_rcvNext);
+
+	// Beyond the receive buffer, drop without an ACK
+	if(d >= RUP_MAXWINDOW)
+	{
+		return 1;
+	}
+
+	// Beyond the window offered, which is how a sender probes a closed
+	//   one: drop it and tell the sender where the window stands
+	if((d >= 0) && ((int)(seq - p->_rcvEdge) >= 0))
+	{
+		if(s->_rxBatch)
+		{
+			p->_ackPending = 1;
+			p->_ackDue = 0;
+		}
+		else
+		{
+			winAck(rfd, p);
+		}
+		return 1;
+	}
+
+	// Buffer new frames, duplicates of delivered frames only need the ACK.
+	//   An unordered pkt, or message of one fragment, that arrives ahead
+	//   of a gap is handed out now and only holds its place in the window.
+	if((d < 0) || (p->_rcv[seq % RUP_MAXWINDOW]._used))
+	{
+		p->_stats._duplicates++;
+	}
+	else
+	{
+		slot = &p->_rcv[seq % RUP_MAXWINDOW];
+		memcpy((char*)slot->_frame, (char*)in, len);
+		slot->_len = len;
+		slot->_seq = seq;
+		slot->_used = 1;
+		slot->_early = 0;
+		slot->_stream = (flags & RUP_F_STRM) ? o._stream : -1;
+		slot->_strmSeq = o._strmSeq;
+		if(flags & RUP_F_STRM)
+		{
+			p->_rcvStreams = 1;
+		}
+		if((d > 0) && (flags & RUP_F_UNORD) && ((!(flags & RUP_F_FRAG)) || ((o._msgOff == 0) && ((unsigned int)o._paylen == o._msgTotal))))
+		{
+			winHandOut(s, p, in, len, 1);
+			slot->_early = 1;
+		}
+	}
+
+	// Deliver whatever is now in order, on the connection and then on
+	//   each stream
+	filled = winInOrder(s, p);
+	if(p->_rcvStreams)
+	{
+		winStreams(s, p);
+	}
+
+	// One ACK covers everything received so far.  In order frames may wait
+	//   for the next reply to carry it, anything that shows loss is
+	//   answered at once so the sender can repair it quickly.
+	++p->_ackPending;
+	if((s->_ackDelay == 0) || (d != 0) || (filled > 1) || (p->_ackPending >= s->_ackEvery))
+	{
+		// Inside a receive batch the ACK waits for the last frame of the
+		//   batch so the whole batch costs one ACK per peer
+		if(s->_rxBatch)
+		{
+			p->_ackDue = 0;
+		}
+		else
+		{
+			winAck(rfd, p);
+		}
+	}
+	else if(p->_ackPending == 1)
+	{
+		p->_ackDue = rupNow() + s->_ackDelay;
+	}
+	return 1;
+}
+
+//
+// winForwardInput
+//
+// Description: Skip the frames a sender gave up on: deliver the ones held
+//                below its new base, then what is in order after it, and
+//                acknowledge the new position.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rupSock* s - The socket state.
+// Input: struct rupPeer* p - The peer that sent the FWD.
+// Input: unsigned int base - The sender's new base.
+// Output: NA
+void winForwardInput(int rfd, struct rupSock* s, struct rupPeer* p, unsigned int base)
+{
+	if((!p->_rcvInit) || ((int)(base - p->_rcvNext) > RUP_RESYNC) || ((int)(p->_rcvNext - base) > RUP_RESYNC))
+	{
+		winRestart(p, base);
+	}
+	winAdvance(s, p, base);
+	winInOrder(s, p);
+	if(p->_rcvStreams)
+	{
+		winStreams(s, p);
+	}
+
+	if(s->_rxBatch)
+	{
+		p->_ackPending = 1;
+		p->_ackDue = 0;
+	}
+	else
+	{
+		winAck(rfd, p);
+	}
+}
+
+//
+// winRestart
+//
+// Description: Start a peer's receive window over at a sender's base.
+//
+// Input: struct rupPeer* p - The peer.
+// Input: unsigned int base - The first sequence expected.
+// Output: NA
+void winRestart(struct rupPeer* p, unsigned int base)
+{
+	// Variable declarations
+	int i;
+
+	if(p->_rcv == NULL)
+	{
+		p->_rcv = new struct winSlot[RUP_MAXWINDOW];
+		memset((char*)p->_rcv,0,RUP_MAXWINDOW * sizeof(struct winSlot));
+		rupAllocs._allocs++;
+	}
+	for(i = 0;i < RUP_MAXWINDOW;++i)
+	{
+		p->_rcv[i]._used = 0;
+	}
+	for(i = 0;i < RUP_MAXSTREAMS;++i)
+	{
+		p->_streams[i]._rcvNext = 0;
+	}
+	p->_rcvNext = base;
+	p->_rcvEdge = base + RUP_MAXWINDOW;
+	p->_rcvInit = 1;
+}
+
+//
+// winAdvance
+//
+// Description: Move the receive window up to a sender's base, which it has
+//                either had acknowledged or given up on, delivering the
+//                frames held below it.
+//
+// Input: struct rupSock* s - The socket state.
+// Input: struct rupPeer* p - The peer.
+// Input: unsigned int base - The sender's base.
+// Output: NA
+void winAdvance(struct rupSock* s, struct rupPeer* p, unsigned int base)
+{
+	// Variable declarations
+	struct winSlot* slot;
+
+	while((int)(base - p->_rcvNext) > 0)
+	{
+		slot = &p->_rcv[p->_rcvNext % RUP_MAXWINDOW];
+		if((slot->_used) && (slot->_seq == p->_rcvNext))
+		{
+			winDeliver(s, p, slot);
+		}
+		slot->_used = 0;
+		p->_rcvNext++;
+	}
+}
+
+//
+// winInOrder
+//
+// Description: Deliver the frames held from the cumulative sequence on.
+//
+// Input: struct rupSock* s - The socket state.
+// Input: struct rupPeer* p - The peer.
+// Output: int filled - The number of frames delivered.
+int winInOrder(struct rupSock* s, struct rupPeer* p)
+{
+	// Variable declarations
+	int filled;
+	struct winSlot* slot;
+
+	// Variable assignments
+	filled = 0;
+	slot = &p->_rcv[p->_rcvNext % RUP_MAXWINDOW];
+
+	while((slot->_used) && (slot->_seq == p->_rcvNext))
+	{
+		winDeliver(s, p, slot);
+		p->_rcvNext++;
+		++filled;
+		slot = &p->_rcv[p->_rcvNext % RUP_MAXWINDOW];
+	}
+	return filled;
+}
+
+//
+// winStreams
+//
+// Description: Hand out the frames held behind a gap in the window whose
+//                stream is not missing any of them.  A stream's frames
+//                take window sequences in the order of their stream
+//                sequences, so one pass up the window finds each in turn.
+//                They keep their place until the window moves past them.
+//
+// Input: struct rupSock* s - The socket state.
+// Input: struct rupPeer* p - The peer.
+// Output: NA
+void winStreams(struct rupSock* s, struct rupPeer* p)
+{
+	// Variable declarations
+	unsigned int seq;
+	struct winSlot* slot;
+	struct rupStream* st;
+
+	for(seq = p->_rcvNext + 1;seq != p->_rcvNext + RUP_MAXWINDOW;++seq)
+	{
+		slot = &p->_rcv[seq % RUP_MAXWINDOW];
+		if((!slot->_used) || (slot->_seq != seq) || (slot->_stream < 0))
+		{
+			continue;
+		}
+
+		st = &p->_streams[slot->_stream];
+		if(slot->_strmSeq != st->_rcvNext)
+		{
+			continue;
+		}
+
+		// An unordered frame may already be out
+		if(!slot->_early)
+		{
+			if(getU16(slot->_frame + 2) & RUP_F_FRAG)
+			{
+				msgDeliver(s, p, slot->_frame, slot->_len);
+			}
+			else
+			{
+				readyPush(s, p, slot->_frame, slot->_len);
+			}
+			slot->_early = 1;
+			s->_classes[frameClass(getU16(slot->_frame + 2))]._early++;
+		}
+		st->_rcvNext++;
+	}
+}
+
+//
+// winService
+//
+// Description: Wait for one datagram or the next retransmit deadline,
+//                whichever comes first, then retransmit expired frames.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rupSock* s - The socket state.
+// Input: long long maxwait - Longest wait in microseconds, -1 to wait until
+//          a datagram arrives when nothing is in flight.
+// Output: int - Returns 1 if a valid frame was processed and 0 otherwise.
+int winService(int rfd, struct rupSock* s, long long maxwait)
+{
+	// Variable declarations
+	int ret, selret;
+	long long wait;
+	struct timeval tval;
+	fd_set rfds;
+
+	// Variable assignments
+	ret = 0;
+
+	// Nothing queued may sit out the wait
+	txFlush(rfd, s);
+	wait = winDeadline(s, rupNow(), maxwait);
+
+#ifdef RUP_URING
+	if(s->_ring != NULL)
+	{
+		selret = ringWait(s->_ring, wait);
+	}
+	else
+#endif
+	{
+		tval.tv_sec = (long)(wait / 1000000);
+		tval.tv_usec = (long)(wait % 1000000);
+
+		// set socket for select call
+		FD_ZERO(&rfds); 
+		FD_SET(rfd,&rfds);
+
+		// Set timer for reading on the socket, nothing in flight means
+		//   there is no deadline to wake up for
+		selret = select(rfd+1,&rfds,NULL,NULL,(wait < 0) ? NULL : &tval);
+	}
+
+	if(selret > 0)
+	{
+		ret = (winRecv(rfd, s, 0) > 0) ? 1 : 0;
+	}
+
+	winTimers(rfd, s);
+	txFlush(rfd, s);
+	return ret;
+}
+
+//
+// winDeadline
+//
+// Description: Shorten a wait so it ends at the socket's earliest
+//                retransmit, delayed ACK, handshake or partial frame
+//                deadline, or when its simulated link lets a frame go.
+//
+// Input: struct rupSock* s - The socket state.
+// Input: long long now - The current time in microseconds.
+// Input: long long wait - The wait in microseconds, -1 for no limit.
+// Output: long long wait - The shortened wait, -1 if there is no limit.
+long long winDeadline(struct rupSock* s, long long now, long long wait)
+{
+	// Variable declarations
+	int i;
+	long long due;
+	struct rupPeer* p;
+	struct winSlot* slot;
+
+	if(s->_sim != NULL)
+	{
+		wait = simDeadline(s->_sim, now, wait);
+	}
+
+	for(p = s->_peers;p != NULL;p = p->_next)
+	{
+		if(p->_ackPending)
+		{
+			due = p->_ackDue - now;
+			if((wait < 0) || (due < wait))
+			{
+				wait = (due > 0) ? due : 0;
+			}
+		}
+		if(p->_helloPending)
+		{
+			due = p->_helloSent + p->_rto - now;
+			if((wait < 0) || (due < wait))
+			{
+				wait = (due > 0) ? due : 0;
+			}
+		}
+		if(p->_fwdPending)
+		{
+			due = p->_fwdSent + p->_rto - now;
+			if((wait < 0) || (due < wait))
+			{
+				wait = (due > 0) ? due : 0;
+			}
+		}
+		if(p->_sndBase == p->_sndNext)
+		{
+			continue;
+		}
+
+		// Frames held back by pacing go out at the next gap
+		if(winReady(p))
+		{
+			due = p->_paceNext - now;
+			if((wait < 0) || (due < wait))
+			{
+				wait = (due > 0) ? due : 0;
+			}
+		}
+		for(i = 0;i < RUP_MAXWINDOW;++i)
+		{
+			slot = &p->_snd[i];
+			if((slot->_used) && (!slot->_lost) && ((int)(slot->_seq - p->_sndPaced) < 0))
+			{
+				due = slot->_sent + p->_rto - now;
+				if((wait < 0) || (due < wait))
+				{
+					wait = (due > 0) ? due : 0;
+				}
+			}
+			if((slot->_used) && (slot->_expire != 0))
+			{
+				due = slot->_expire - now;
+				if((wait < 0) || (due < wait))
+				{
+					wait = (due > 0) ? due : 0;
+				}
+			}
+		}
+	}
+	return wait;
+}
+
+//
+// winRecv
+//
+// Description: Read the datagrams queued on the socket, up to RUP_BATCH of
+//                them, and feed them to the window.  Data frames in the
+//                batch are acknowledged together once it has been read.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rupSock* s - The socket state.
+// Input: int dontwait - Nonzero to return at once when nothing is queued.
+// Output: int n - Returns the number of datagrams read, 0 if dontwait is
+//           set and none was queued.
+int winRecv(int rfd, struct rupSock* s, int dontwait)
+{
+	// Variable declarations
+	int i, n;
+#ifdef _WIN32_
+	int fromlen;
+	struct timeval tval;
+	fd_set rfds;
+#else
+	int nmsg, size, seg, off;
+	unsigned char* buf;
+	struct mmsghdr msgs[RUP_BATCH];
+	struct iovec iov[RUP_BATCH];
+	char ctl[RUP_BATCH][CMSG_SPACE(sizeof(int))];
+	struct cmsghdr* cm;
+#endif
+
+#ifdef _WIN32_
+	// Winsock has neither recvmmsg nor a per call non-blocking flag, poll
+	//   the socket and read one datagram
+	fromlen = sizeof(struct sockaddr_in);
+	if(dontwait)
+	{
+		tval.tv_sec = 0;
+		tval.tv_usec = 0;
+		FD_ZERO(&rfds);
+		FD_SET(rfd,&rfds);
+		if(select(rfd+1,&rfds,NULL,NULL,&tval) <= 0)
+		{
+			return 0;
+		}
+	}
+	if ((n=recvfrom(rfd, (char*)s->_rxFrame[0], RUP_MAXFRAME, 0, (struct sockaddr*)&s->_rxAddr[0], &fromlen)) < 0 )
+	{
+		printf("ERROR in winRecv().\n");
+		printf("Write error: errno %d\n",errno);
+		printf("reading datagram");
+		exit(0);
+	}
+	winInput(rfd, s->_rxFrame[0], n, &s->_rxAddr[0]);
+	n = 1;
+#else
+#ifdef RUP_URING
+	if(s->_ring != NULL)
+	{
+		return ringRecv(rfd, s, dontwait);
+	}
+#endif
+
+	// Coalesced reads need room for a whole run of datagrams
+	nmsg = (s->_offload & RUP_OFFLOAD_GRO) ? RUP_GROBATCH : RUP_BATCH;
+	if(s->_perPacket)
+	{
+		nmsg = 1;
+	}
+	size = (s->_offload & RUP_OFFLOAD_GRO) ? RUP_GROSIZE : RUP_MAXFRAME;
+
+	memset((char*)msgs,0,sizeof(msgs));
+	for(i = 0;i < nmsg;++i)
+	{
+		iov[i].iov_base = (s->_offload & RUP_OFFLOAD_GRO) ? s->_groBuf + i * RUP_GROSIZE : s->_rxFrame[i];
+		iov[i].iov_len = size;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &s->_rxAddr[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+		if(s->_offload & RUP_OFFLOAD_GRO)
+		{
+			msgs[i].msg_hdr.msg_control = ctl[i];
+			msgs[i].msg_hdr.msg_controllen = sizeof(ctl[i]);
+		}
+	}
+
+	// Block for the first datagram at most, then take what else is queued
+	if ((n=recvmmsg(rfd, msgs, nmsg, (dontwait) ? MSG_DONTWAIT : MSG_WAITFORONE, NULL)) < 0 )
+	{
+		if((dontwait) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+		{
+			return 0;
+		}
+		printf("ERROR in winRecv().\n");
+		printf("Write error: errno %d\n",errno);
+		printf("reading datagram");
+		exit(0);
+	}
+
+	s->_rxBatch = 1;
+	for(i = 0;i < n;++i)
+	{
+		buf = (unsigned char*)iov[i].iov_base;
+		seg = msgs[i].msg_len;
+
+		// A coalesced read holds datagrams of the size given by UDP_GRO,
+		//   the last one possibly shorter
+#ifdef UDP_GRO
+		if(s->_offload & RUP_OFFLOAD_GRO)
+		{
+			for(cm = CMSG_FIRSTHDR(&msgs[i].msg_hdr);cm != NULL;cm = CMSG_NXTHDR(&msgs[i].msg_hdr, cm))
+			{
+				if((cm->cmsg_level == SOL_UDP) && (cm->cmsg_type == UDP_GRO))
+				{
+					memcpy((char*)&seg, (char*)CMSG_DATA(cm), sizeof(int));
+				}
+			}
+		}
+#endif
+		if(seg <= 0)
+		{
+			continue;
+		}
+		for(off = 0;off < (int)msgs[i].msg_len;off += seg)
+		{
+			winInput(rfd, buf + off, ((int)msgs[i].msg_len - off < seg) ? (int)msgs[i].msg_len - off : seg, &s->_rxAddr[i]);
+		}
+	}
+	s->_rxBatch = 0;
+
+	// Send the ACKs the batch held back
+	winAckFlush(rfd, s, 0);
+#endif
+	return n;
+}
+
+//
+// txQueue
+//
+// Description: Queue a frame for the next txFlush, flushing first when the
+//                queue is full.  A data frame is sent straight from its send
+//                window slot, other frames are copied.  Those larger than an
+//                ACK wait in a buffer the socket allocates on the first one.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rupSock* s - The socket state.
+// Input: unsigned char* frame - The sealed frame.
+// Input: int len - The frame byte count.
+// Input: struct rupPeer* p - The peer the frame goes to.
+// Input: struct winSlot* slot - The slot holding the frame, NULL for an ACK,
+//          FWD, handshake or unreliable frame, which is copied.
+// Output: NA
+void txQueue(int rfd, struct rupSock* s, unsigned char* frame, int len, struct rupPeer* p, struct winSlot* slot)
+{
+	if(s->_txCount == RUP_BATCH)
+	{
+		txFlush(rfd, s);
+	}
+
+	if(slot != NULL)
+	{
+		s->_txFrame[s->_txCount] = slot->_frame;
+		s->_txSeq[s->_txCount] = slot->_seq;
+	}
+	else if(len <= RUP_ACKSIZE)
+	{
+		memcpy((char*)s->_txAck[s->_txCount], (char*)frame, len);
+		s->_txFrame[s->_txCount] = s->_txAck[s->_txCount];
+	}
+	else
+	{
+		if(s->_txDgram == NULL)
+		{
+			s->_txDgram = new unsigned char[RUP_BATCH][RUP_MAXFRAME];
+			rupAllocs._allocs++;
+		}
+		memcpy((char*)s->_txDgram[s->_txCount], (char*)frame, len);
+		s->_txFrame[s->_txCount] = s->_txDgram[s->_txCount];
+	}
+	s->_txSlot[s->_txCount] = slot;
+	s->_txLen[s->_txCount] = len;
+	s->_txAddr[s->_txCount] = p->_addr;
+	s->_txCount++;
+	p->_stats._sent++;
+	p->_stats._sentBytes += len;
+}
+
+//
+// txFlush
+//
+// Description: Send every queued frame, with as few system calls as the
+//                platform allows.  A socket with an impairment simulator
+//                hands them to the simulated link instead, and sends what
+//                it lets go.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rupSock* s - The socket state.
+// Output: NA
+void txFlush(int rfd, struct rupSock* s)
+{
+	// Variable declarations
+	int i, n;
+
+	// A frame whose slot was acknowledged and reused while it sat in the
+	//   queue no longer needs sending
+	for(i = 0, n = 0;i < s->_txCount;++i)
+	{
+		if((s->_txSlot[i] != NULL) && ((!s->_txSlot[i]->_used) || (s->_txSlot[i]->_seq != s->_txSeq[i])))
+		{
+			continue;
+		}
+		s->_txFrame[n] = s->_txFrame[i];
+		s->_txSlot[n] = s->_txSlot[i];
+		s->_txSeq[n] = s->_txSeq[i];
+		s->_txLen[n] = s->_txLen[i];
+		s->_txAddr[n] = s->_txAddr[i];
+		++n;
+	}
+	s->_txCount = n;
+
+	if(s->_sim != NULL)
+	{
+		simFlush(rfd, s);
+		return;
+	}
+	txSend(rfd, s);
+}
+
+//
+// txSend
+//
+// Description: Put the queued frames on the wire, with as few system calls
+//                as the platform allows.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rupSock* s - The socket state.
+// Output: NA
+void txSend(int rfd, struct rupSock* s)
+{
+	// Variable declarations
+	int i;
+#ifndef _WIN32_
+	int j, k, m, rc, sent, nmsg, seg, gso;
+	int first[RUP_BATCH];
+	struct mmsghdr msgs[RUP_BATCH];
+	struct iovec iov[RUP_BATCH];
+	char ctl[RUP_BATCH][CMSG_SPACE(sizeof(unsigned short))];
+	struct cmsghdr* cm;
+#endif
+
+	if(s->_txCount == 0)
+	{
+		return;
+	}
+
+#ifdef _WIN32_
+	for(i = 0;i < s->_txCount;++i)
+	{
+		if( sendto(rfd, (char*)s->_txFrame[i], s->_txLen[i], 0, (struct sockaddr*)&s->_txAddr[i], sizeof(struct sockaddr_in)) < 0 )
+		{
+			printf("ERROR in txSend() - sendto()");
+			exit(0);
+		}
+	}
+#else
+	i = 0;
+	while(i < s->_txCount)
+	{
+		gso = s->_offload & RUP_OFFLOAD_GSO;
+		nmsg = 0;
+		memset((char*)msgs,0,sizeof(msgs));
+
+		// One message per frame, or per run of frames to the same peer
+		//   that the kernel can cut back apart: all the size of the
+		//   first except a shorter last one
+		for(j = i;j < s->_txCount;j = k)
+		{
+			seg = s->_txLen[j];
+			k = j + 1;
+			while((gso) && (k < s->_txCount) && (s->_txLen[k] <= seg) &&
+				(s->_txAddr[k].sin_addr.s_addr == s->_txAddr[j].sin_addr.s_addr) && (s->_txAddr[k].sin_port == s->_txAddr[j].sin_port))
+			{
+				++k;
+				if(s->_txLen[k - 1] < seg)
+				{
+					break;
+				}
+			}
+
+			for(m = j;m < k;++m)
+			{
+				iov[m].iov_base = s->_txFrame[m];
+				iov[m].iov_len = s->_txLen[m];
+			}
+			msgs[nmsg].msg_hdr.msg_iov = &iov[j];
+			msgs[nmsg].msg_hdr.msg_iovlen = k - j;
+			msgs[nmsg].msg_hdr.msg_name = &s->_txAddr[j];
+			msgs[nmsg].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+#ifdef UDP_SEGMENT
+			if(k - j > 1)
+			{
+				msgs[nmsg].msg_hdr.msg_control = ctl[nmsg];
+				msgs[nmsg].msg_hdr.msg_controllen = sizeof(ctl[nmsg]);
+				cm = CMSG_FIRSTHDR(&msgs[nmsg].msg_hdr);
+				cm->cmsg_level = SOL_UDP;
+				cm->cmsg_type = UDP_SEGMENT;
+				cm->cmsg_len = CMSG_LEN(sizeof(unsigned short));
+				*(unsigned short*)CMSG_DATA(cm) = (unsigned short)seg;
+			}
+#endif
+			first[nmsg] = j;
+			++nmsg;
+		}
+
+		sent = 0;
+		while(sent < nmsg)
+		{
+#ifdef RUP_URING
+			rc = (s->_ring != NULL) ? ringSend(rfd, s->_ring, msgs + sent, (s->_perPacket) ? 1 : nmsg - sent) : sendmmsg(rfd, msgs + sent, (s->_perPacket) ? 1 : nmsg - sent, 0);
+#else
+			rc = sendmmsg(rfd, msgs + sent, (s->_perPacket) ? 1 : nmsg - sent, 0);
+#endif
+			if(rc < 0)
+			{
+				if(errno == EINTR)
+				{
+					continue;
+				}
+
+				// The route cannot segment after all, send the rest of
+				//   the queue one datagram per frame from now on
+				if((gso) && ((errno == EIO) || (errno == EINVAL)))
+				{
+					s->_offload &= ~RUP_OFFLOAD_GSO;
+					break;
+				}
+				printf("ERROR in txSend() - sendmmsg()");
+				exit(0);
+			}
+			sent += rc;
+		}
+		i = (sent < nmsg) ? first[sent] : s->_txCount;
+	}
+#endif
+	s->_txCount = 0;
+}
+
+//
+// simFlush
+//
+// Description: Pass the queued frames through the socket's simulated link,
+//                then send every frame the link lets go, the frames a
+//                reordered one waited for ahead of it.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rupSock* s - The socket state.
+// Output: NA
+void simFlush(int rfd, struct rupSock* s)
+{
+	// Variable declarations
+	int i, j, n, released;
+	long long now;
+	struct rupSim* m;
+	struct simFrame* f;
+
+	// Variable assignments
+	m = s->_sim;
+	now = rupNow();
+
+	for(i = 0;i < s->_txCount;++i)
+	{
+		simOffer(m, s->_txFrame[i], s->_txLen[i], &s->_txAddr[i], now);
+	}
+	s->_txCount = 0;
+
+	// A reordered frame that becomes free goes out on the next pass
+	do
+	{
+		released = 0;
+		for(i = 0;(i < m->_count) && (s->_txCount < RUP_BATCH);++i)
+		{
+			f = &m->_held[i];
+			if((f->_len == 0) || ((now < f->_due) && ((f->_holdFor > 0) || (now < f->_ready))))
+			{
+				continue;
+			}
+			for(j = 0;j < i;++j)
+			{
+				if((m->_held[j]._len > 0) && (m->_held[j]._holdFor > 0))
+				{
+					m->_held[j]._holdFor--;
+				}
+			}
+			s->_txFrame[s->_txCount] = f->_frame;
+			s->_txLen[s->_txCount] = f->_len;
+			s->_txAddr[s->_txCount] = f->_addr;
+			s->_txSlot[s->_txCount] = NULL;
+			s->_txCount++;
+			f->_len = -f->_len;
+			++released;
+		}
+		txSend(rfd, s);
+
+		// Drop the sent frames, keeping the rest in the order they came
+		for(i = 0, n = 0;i < m->_count;++i)
+		{
+			if(m->_held[i]._len < 0)
+			{
+				continue;
+			}
+			if(n != i)
+			{
+				m->_held[n] = m->_held[i];
+			}
+			++n;
+		}
+		m->_count = n;
+	} while(released > 0);
+	m->_info._held = m->_count;
+}
+
+//
+// simOffer
+//
+// Description: Put one frame on the simulated link.  It may be lost, alone
+//                or in a burst, or damaged, duplicated, held back behind
+//                later frames, delayed, or queued behind the frames the
+//                link's rate has not yet let through.
+//
+// Input: struct rupSim* m - The simulator.
+// Input: unsigned char* frame - The sealed frame.
+// Input: int len - The frame byte count.
+// Input: struct sockaddr_in* to - The frame's destination.
+// Input: long long now - The current time in microseconds.
+// Output: NA
+void simOffer(struct rupSim* m, unsigned char* frame, int len, struct sockaddr_in* to, long long now)
+{
+	// Variable declarations
+	int i, copies, holdFor, bit;
+	long long ready;
+	unsigned char copy[RUP_MAXFRAME];
+	double p;
+
+	// Variable assignments
+	m->_info._frames++;
+	copies = 1;
+	holdFor = 0;
+
+	// Gilbert-Elliott loss: every frame is lost in the bad state, which is
+	//   entered so the long run loss is _loss percent and left after
+	//   _burst frames on average
+	if(m->_cfg._burst > 1)
+	{
+		p = m->_cfg._loss / 100;
+		if((!m->_bad) && (p < 1) && (simChance(m, 100 * p / (m->_cfg._burst * (1 - p)))))
+		{
+			m->_bad = 1;
+		}
+		if((m->_bad) || (p >= 1))
+		{
+			if(simChance(m, 100 / m->_cfg._burst))
+			{
+				m->_bad = 0;
+			}
+			m->_info._lost++;
+			return;
+		}
+	}
+	else if(simChance(m, m->_cfg._loss))
+	{
+		m->_info._lost++;
+		return;
+	}
+
+	memcpy((char*)copy, (char*)frame, len);
+	if(simChance(m, m->_cfg._corrupt))
+	{
+		bit = (int)(simRand(m) % (unsigned long long)(len * 8));
+		copy[bit / 8] ^= (unsigned char)(1 << (bit % 8));
+		m->_info._corrupted++;
+	}
+	if(simChance(m, m->_cfg._dup))
+	{
+		copies = 2;
+		m->_info._duplicated++;
+	}
+	if((m->_cfg._reorderDepth > 0) && (simChance(m, m->_cfg._reorder)))
+	{
+		holdFor = 1 + (int)(simRand(m) % (unsigned long long)m->_cfg._reorderDepth);
+		m->_info._reordered++;
+	}
+
+	for(i = 0;i < copies;++i)
+	{
+		// A full queue drops at the tail, as a router would
+		if(m->_count == m->_cap)
+		{
+			m->_info._overflow++;
+			return;
+		}
+
+		// The link sends one frame after another at its rate
+		ready = now;
+		if(m->_cfg._rate > 0)
+		{
+			ready = (m->_linkFree > now) ? m->_linkFree : now;
+			ready += (long long)len * 1000000 / m->_cfg._rate;
+			m->_linkFree = ready;
+		}
+		ready += m->_cfg._delay_us;
+		if(m->_cfg._jitter_us > 0)
+		{
+			ready += (long long)(simRand(m) % (unsigned long long)(m->_cfg._jitter_us + 1));
+		}
+		simHold(m, copy, len, to, ready, (i == 0) ? holdFor : 0);
+	}
+}
+
+//
+// simHold
+//
+// Description: Add a frame to the end of the simulated link's queue.
+//
+// Input: struct rupSim* m - The simulator.
+// Input: unsigned char* frame - The frame.
+// Input: int len - The frame byte count.
+// Input: struct sockaddr_in* to - The frame's destination.
+// Input: long long ready - When the link lets it go, in microseconds.
+// Input: int holdFor - Later frames that must go first, 0 for none.
+// Output: NA
+void simHold(struct rupSim* m, unsigned char* frame, int len, struct sockaddr_in* to, long long ready, int holdFor)
 {
 	// Variable declarations
-	int rc, pktSent, selret, pktID, inChecksum;
-	unsigned int fromlen;
-	char* tns;
-	char* fns;
-	struct pkt* outPktSentAck;
-	struct pkt inPktSentAck;
-	struct sockaddr_in from;
-	struct timeval tval;
-	fd_set rfds;
+	struct simFrame* f;
 
 	// Variable assignments
-	pktSent = 0;
-	selret = 0;
-	pktID = ((struct pkt*)buf)->_id;
-	fromlen = sizeof(struct sockaddr_in);
+	f = &m->_held[m->_count++];
+
+	f->_ready = ready;
+	f->_due = (holdFor > 0) ? ready + RUP_SIMHOLD_US : ready;
+	f->_holdFor = holdFor;
+	f->_len = len;
+	f->_addr = *to;
+	memcpy((char*)f->_frame, (char*)frame, len);
+}
+
+//
+// simDeadline
+//
+// Description: Shorten a wait so it ends when the simulated link next lets
+//                a frame go.
+//
+// Input: struct rupSim* m - The simulator.
+// Input: long long now - The current time in microseconds.
+// Input: long long wait - The wait in microseconds, -1 for no limit.
+// Output: long long wait - The shortened wait, -1 if there is no limit.
+long long simDeadline(struct rupSim* m, long long now, long long wait)
+{
+	// Variable declarations
+	int i;
+	long long due;
 
-	memset((char*)&inPktSentAck,0,sizeof(struct pkt));
+	for(i = 0;i < m->_count;++i)
+	{
+		due = ((m->_held[i]._holdFor > 0) ? m->_held[i]._due : m->_held[i]._ready) - now;
+		if((wait < 0) || (due < wait))
+		{
+			wait = (due > 0) ? due : 0;
+		}
+	}
+	return wait;
+}
 
-	// getting the to address into a variable
-	tns = inet_ntoa(to->sin_addr);
+//
+// simRand
+//
+// Description: Next number of the simulator's generator (splitmix64), so a
+//                seed replays the same impairments.
+//
+// Input: struct rupSim* m - The simulator.
+// Output: unsigned long long - 64 random bits.
+unsigned long long simRand(struct rupSim* m)
+{
+	// Variable declarations
+	unsigned long long z;
 
-	char command[1] = "";
-	char buffer[1] =  "";
-	// Creating ACK pkt
-	outPktSentAck = createPkt(((struct pkt*)buf)->_id,&command[0], &((struct pkt*)buf)->_client, ((struct pkt*)buf)->_client_name,((struct pkt*)buf)->_client_password,&buffer[0],ACK);
+	// Variable assignments
+	z = (m->_rng += 0x9E3779B97F4A7C15ULL);
 
-	// assign checksum to checksum pkt
-	outPktSentAck->_checksum = performChecksum(outPktSentAck);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
 
-	while(pktSent != 1)
+//
+// simChance
+//
+// Description: Draw whether an event with the given odds happens.
+//
+// Input: struct rupSim* m - The simulator.
+// Input: double pct - The odds in percent.
+// Output: int - Returns 1 if it happens and 0 otherwise.
+int simChance(struct rupSim* m, double pct)
+{
+	if(pct <= 0)
 	{
-		// Send a pkt to reader
-		if( sendto(rfd, (char*)outPktSentAck, cc, 0, (struct sockaddr*)to, fromlen) < 0 ) {
-			printf("ERROR in pktSentSuccessfully_FromSender() - sendto()");
-			exit(0);
-		}
+		return 0;
+	}
+	return ((double)(simRand(m) >> 11) * (100.0 / 9007199254740992.0) < pct) ? 1 : 0;
+}
 
-		tval.tv_sec = 0;
-		tval.tv_usec = 100000;
+//
+// simClose
+//
+// Description: Send every frame the simulated link still holds and remove
+//                the simulator from a socket.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rupSock* s - The socket state.
+// Output: NA
+void simClose(int rfd, struct rupSock* s)
+{
+	// Variable declarations
+	int i;
+	struct rupSim* m;
 
-		// set socket for select call
-		FD_ZERO(&rfds); 
-		FD_SET(rfd,&rfds);
+	// Variable assignments
+	m = s->_sim;
 
-		// Set timer for reading on the socket
-		selret = select(rfd+1,&rfds,NULL,NULL,&tval);
+	if(m == NULL)
+	{
+		return;
+	}
 
-		if(selret != 0)
-		{
-			// Wait for pktSentAck response
-#ifdef _WIN32_
-			if ((rc=recvfrom(rfd, (char*)&inPktSentAck, sizeof(struct pkt), 0, (struct sockaddr*)(&from), (int*)&fromlen)) < 0 )
-#else
-			if ((rc=recvfrom(rfd, &inPktSentAck, sizeof(struct pkt), 0, (struct sockaddr*)(&from), &fromlen)) < 0 )
-#endif
-			{
-				printf("ERROR in pktSentSuccessfully_FromSender().\n");
-				printf("Write error: errno %d\n",errno);
-				printf("reading datagram");
-				exit(0);
-			}
+	txFlush(rfd, s);
+	for(i = 0;i < m->_count;++i)
+	{
+		m->_held[i]._ready = 0;
+		m->_held[i]._due = 0;
+	}
+	simFlush(rfd, s);
 
-			// assign checksum to checksum pkt
-			inChecksum = performChecksum(((struct pkt*)(&inPktSentAck)));
+	s->_sim = NULL;
+	delete [] m->_held;
+	delete m;
+	rupAllocs._frees += 2;
+}
 
-			// getting the from address into a variable
-			fns = inet_ntoa(from.sin_addr);
+#ifdef RUP_URING
+//
+// ringOpen
+//
+// Description: Set up an io_uring for a socket and register its provided
+//                receive buffers.  Needs the features of Linux 6.0.  The
+//                multishot receive is posted once the socket has an
+//                address, one posted before never completes.
+//
+// Input: NA
+// Output: struct rupRing* - The ring, NULL if the kernel cannot provide it.
+struct rupRing* ringOpen()
+{
+	// Variable declarations
+	int i;
+	unsigned int need;
+	struct rupRing* r;
+	struct io_uring_params params;
+	struct io_uring_buf_reg reg;
+	struct io_uring_probe* probe;
+	unsigned char* map;
+	unsigned char ops[sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op)];
 
-			// Check pkt for ACK
-			if((inPktSentAck._ackvar == ACK)&&(pktID == inPktSentAck._id)&&(from.sin_port == to->sin_port)&&(!(strcmp(fns,tns))))
-			{
-				pktSent = 1;
-			}
-			else
+	// Variable assignments
+	need = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_SUBMIT_STABLE | IORING_FEAT_EXT_ARG | IORING_FEAT_CQE_SKIP;
+	r = new struct rupRing;
+	memset((char*)r,0,sizeof(struct rupRing));
+	rupAllocs._allocs++;
+	r->_ringMap = MAP_FAILED;
+	r->_sqes = (struct io_uring_sqe*)MAP_FAILED;
+	r->_bufRing = (struct io_uring_buf_ring*)MAP_FAILED;
+
+	memset((char*)&params,0,sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = RUP_URINGCQ;
+	r->_fd = (int)syscall(__NR_io_uring_setup, RUP_URINGSQ, &params);
+	if((r->_fd < 0) || ((params.features & need) != need))
+	{
+		ringClose(r);
+		return NULL;
+	}
+
+	// Multishot recvmsg cannot be probed for, it came with SEND_ZC
+	memset((char*)ops,0,sizeof(ops));
+	probe = (struct io_uring_probe*)ops;
+	if((syscall(__NR_io_uring_register, r->_fd, IORING_REGISTER_PROBE, probe, 256) < 0) || (probe->last_op < IORING_OP_SEND_ZC))
+	{
+		ringClose(r);
+		return NULL;
+	}
+
+	// One mapping holds both queues' indexes, the sqes get their own
+	r->_ringLen = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	if(params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe) > r->_ringLen)
+	{
+		r->_ringLen = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	}
+	r->_sqeLen = params.sq_entries * sizeof(struct io_uring_sqe);
+	r->_ringMap = mmap(NULL, r->_ringLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->_fd, IORING_OFF_SQ_RING);
+	r->_sqes = (struct io_uring_sqe*)mmap(NULL, r->_sqeLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->_fd, IORING_OFF_SQES);
+	if((r->_ringMap == MAP_FAILED) || (r->_sqes == (struct io_uring_sqe*)MAP_FAILED))
+	{
+		ringClose(r);
+		return NULL;
+	}
+	map = (unsigned char*)r->_ringMap;
+	r->_sqTail = (unsigned int*)(map + params.sq_off.tail);
+	r->_sqMask = *(unsigned int*)(map + params.sq_off.ring_mask);
+	r->_sqArray = (unsigned int*)(map + params.sq_off.array);
+	r->_cqHead = (unsigned int*)(map + params.cq_off.head);
+	r->_cqTail = (unsigned int*)(map + params.cq_off.tail);
+	r->_cqMask = *(unsigned int*)(map + params.cq_off.ring_mask);
+	r->_cqes = (struct io_uring_cqe*)(map + params.cq_off.cqes);
+
+	// The buffer ring must be page aligned, the buffers it lists need not
+	r->_bufRing = (struct io_uring_buf_ring*)mmap(NULL, RUP_URINGBUFS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(r->_bufRing == (struct io_uring_buf_ring*)MAP_FAILED)
+	{
+		ringClose(r);
+		return NULL;
+	}
+	r->_bufs = new unsigned char[RUP_URINGBUFS * RUP_URINGBUFSIZE];
+	rupAllocs._allocs++;
+	memset((char*)&reg,0,sizeof(reg));
+	reg.ring_addr = (unsigned long long)r->_bufRing;
+	reg.ring_entries = RUP_URINGBUFS;
+	reg.bgid = 0;
+	if(syscall(__NR_io_uring_register, r->_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+	{
+		ringClose(r);
+		return NULL;
+	}
+	for(i = 0;i < RUP_URINGBUFS;++i)
+	{
+		ringRecycle(r, i);
+	}
+	r->_rxMsg.msg_namelen = sizeof(struct sockaddr_in);
+	return r;
+}
+
+//
+// ringClose
+//
+// Description: Tear down a ring.  The posted receive is cancelled first,
+//                a ring left to cancel it while closing holds the socket,
+//                and with it the port, a moment past rup_close.
+//
+// Input: struct rupRing* r - The ring.
+// Output: NA
+void ringClose(struct rupRing* r)
+{
+	// Variable declarations
+	struct io_uring_sync_cancel_reg cancel;
+
+	if(r->_armed)
+	{
+		memset((char*)&cancel,0,sizeof(cancel));
+		cancel.addr = RUP_URING_RECV;
+		cancel.flags = IORING_ASYNC_CANCEL_ALL;
+		cancel.timeout.tv_sec = -1;
+		cancel.timeout.tv_nsec = -1;
+		syscall(__NR_io_uring_register, r->_fd, IORING_REGISTER_SYNC_CANCEL, &cancel, 1);
+	}
+	if(r->_bufRing != (struct io_uring_buf_ring*)MAP_FAILED)
+	{
+		munmap(r->_bufRing, RUP_URINGBUFS * sizeof(struct io_uring_buf));
+	}
+	if(r->_sqes != (struct io_uring_sqe*)MAP_FAILED)
+	{
+		munmap(r->_sqes, r->_sqeLen);
+	}
+	if(r->_ringMap != MAP_FAILED)
+	{
+		munmap(r->_ringMap, r->_ringLen);
+	}
+	if(r->_fd >= 0)
+	{
+		close(r->_fd);
+	}
+	if(r->_bufs != NULL)
+	{
+		delete [] r->_bufs;
+		rupAllocs._frees++;
+	}
+	delete r;
+	rupAllocs._frees++;
+}
+
+//
+// ringSqe
+//
+// Description: Take the next free submission queue entry, cleared.  The
+//                entry goes to the kernel with the next ringEnter.
+//
+// Input: struct rupRing* r - The ring.
+// Output: struct io_uring_sqe* - The entry.
+struct io_uring_sqe* ringSqe(struct rupRing* r)
+{
+	// Variable declarations
+	unsigned int tail;
+	struct io_uring_sqe* sqe;
+
+	// Only sends of one txFlush and the receive are ever queued, a full
+	//   queue is submitted first anyway
+	if(r->_sqLocal - r->_sqSubmitted > r->_sqMask)
+	{
+		ringEnter(r, 0, -1);
+	}
+
+	// Variable assignments
+	tail = r->_sqLocal++;
+
+	sqe = &r->_sqes[tail & r->_sqMask];
+	memset((char*)sqe,0,sizeof(struct io_uring_sqe));
+	r->_sqArray[tail & r->_sqMask] = tail & r->_sqMask;
+	return sqe;
+}
+
+//
+// ringEnter
+//
+// Description: Submit the queued entries and optionally wait for one
+//                completion, for at most wait microseconds.
+//
+// Input: struct rupRing* r - The ring.
+// Input: int getevents - Nonzero to wait for a completion.
+// Input: long long wait - Longest wait in microseconds, -1 for no limit.
+// Output: int - Returns 0, or -1 if the wait timed out or was interrupted.
+int ringEnter(struct rupRing* r, int getevents, long long wait)
+{
+	// Variable declarations
+	int rc;
+	unsigned int flags;
+	struct timespec ts;
+	struct io_uring_getevents_arg arg;
+
+	// Variable assignments
+	flags = IORING_ENTER_EXT_ARG | ((getevents) ? IORING_ENTER_GETEVENTS : 0);
+	memset((char*)&arg,0,sizeof(arg));
+	arg.sigmask_sz = _NSIG / 8;
+	if(wait >= 0)
+	{
+		ts.tv_sec = (time_t)(wait / 1000000);
+		ts.tv_nsec = (long)(wait % 1000000) * 1000;
+		arg.ts = (unsigned long long)&ts;
+	}
+
+	__atomic_store_n(r->_sqTail, r->_sqLocal, __ATOMIC_RELEASE);
+	while(1)
+	{
+		rc = (int)syscall(__NR_io_uring_enter, r->_fd, r->_sqLocal - r->_sqSubmitted, (getevents) ? 1 : 0, flags, &arg, sizeof(arg));
+		if(rc >= 0)
+		{
+			r->_sqSubmitted += (unsigned int)rc;
+			if(r->_sqSubmitted == r->_sqLocal)
 			{
-				//printf("fs2-received someone else's pkt and disregarding it\n");
-				pktSent = 0;
+				return 0;
 			}
+			continue;
 		}
-		else
+		if((errno == ETIME) || (errno == EINTR))
+		{
+			return -1;
+		}
+
+		// Completions the kernel is still holding must be reaped first
+		if((errno == EBUSY) || (errno == EAGAIN))
 		{
-			//printf("No ack pkt received(pktSentSuccessfully_FromSender)...select returned %d\n",selret);
-			pktSent = 0;
+			flags |= IORING_ENTER_GETEVENTS;
+			continue;
 		}
+		printf("UDP Error: io_uring_enter() call in ringEnter\n");
+		exit(0);
 	}
-	delete outPktSentAck;
-	return pktSent;
 }
 
 //
-// stopConfirmation_FromSender
+// ringArm
 //
-// Description: Send a final ACK to notify the receiver that the sender
-//                is aware the data has been received.
-//               At this point the sender knows there is no need to
-//                keep sending ACK's or receiving ACK's.  The sender
-//                can timeout and leave function without getting a
-//                response back from receiver without the possiblity
-//                of the data pkt not being delivered.. 
+// Description: Queue the multishot receive.  It keeps completing into
+//                provided buffers until they run out.  The socket must be
+//                bound by the time the receive is issued.
 //
+// Input: struct rupRing* r - The ring.
 // Input: int rfd - A valid RUP file descriptor.
-// Input: void* buf - A pointer to the data being sent.
-// Input: int cc - The byte count/size of buf.
-// Input: struct sockaddr_in* to - A socket address structure containing
-//          ip address and port number of the local machine.
-// Output: int pktSent - Returns 1 on success and 0 on failure.
-int stopConfirmation_FromSender(int rfd, void* buf, int cc, struct sockaddr_in* to)
+// Output: NA
+void ringArm(struct rupRing* r, int rfd)
 {
 	// Variable declarations
-	int rc, numtimeouts, pktSent, selret, pktID, inChecksum;
-	unsigned int fromlen;
-	char* tns;
-	char* fns;
-	struct pkt* outPktSentAck;
-	struct pkt inPktSentAck;
-	struct sockaddr_in from;
-	struct timeval tval;
-	fd_set rfds;
+	struct io_uring_sqe* sqe;
 
 	// Variable assignments
-	numtimeouts = 0;
-	pktSent = 0;
-	selret = 0;
-	pktID = ((struct pkt*)buf)->_id;
-	fromlen = sizeof(struct sockaddr_in);
+	sqe = ringSqe(r);
+
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = rfd;
+	sqe->addr = (unsigned long long)&r->_rxMsg;
+	sqe->len = 1;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = 0;
+	sqe->user_data = RUP_URING_RECV;
+	r->_armed = 1;
+	r->_bound = 1;
+}
+
+//
+// ringRecycle
+//
+// Description: Hand a provided buffer back to the kernel.  The ring is
+//                indexed by hand, C++ lays out its flexible bufs member
+//                one empty struct further in than the kernel does.
+//
+// Input: struct rupRing* r - The ring.
+// Input: int bid - The buffer id.
+// Output: NA
+void ringRecycle(struct rupRing* r, int bid)
+{
+	// Variable declarations
+	struct io_uring_buf* b;
+
+	// Variable assignments
+	b = (struct io_uring_buf*)r->_bufRing + (r->_bufTail & (RUP_URINGBUFS - 1));
+
+	b->addr = (unsigned long long)(r->_bufs + bid * RUP_URINGBUFSIZE);
+	b->len = RUP_URINGBUFSIZE;
+	b->bid = (unsigned short)bid;
+	r->_bufTail++;
+	__atomic_store_n(&r->_bufRing->tail, r->_bufTail, __ATOMIC_RELEASE);
+}
 
-	memset((char*)&inPktSentAck,0,sizeof(struct pkt));
+//
+// ringSend
+//
+// Description: Send messages the way sendmmsg does, as one submission.
+//                Each send is issued without blocking while it is
+//                submitted, so the frames are free again on return, and
+//                only failures post completions.  Sends that found the
+//                socket buffer full are retried once it drains.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rupRing* r - The ring.
+// Input: struct mmsghdr* msgs - The messages.
+// Input: int nmsg - The message count.
+// Output: int - Returns the messages sent before the first that failed,
+//           or -1 with errno set if the first failed.
+int ringSend(int rfd, struct rupRing* r, struct mmsghdr* msgs, int nmsg)
+{
+	// Variable declarations
+	int i, idx, ret;
+	unsigned int head, tail;
+	struct io_uring_sqe* sqe;
+	struct io_uring_cqe* cqe;
+	struct pollfd pfd;
 
-	// getting the to address into a variable
-	tns = inet_ntoa(to->sin_addr);
+	// Variable assignments
+	ret = nmsg;
+	r->_gen++;
 
-	char command[1] = "";
-	char buffer[1] = "";
-	// Creating ACK pkt
-	outPktSentAck = createPkt(((struct pkt*)buf)->_id,&command[0], &((struct pkt*)buf)->_client, ((struct pkt*)buf)->_client_name,((struct pkt*)buf)->_client_password,&buffer[0],FINALACK);
+	for(i = 0;i < nmsg;++i)
+	{
+		sqe = ringSqe(r);
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->fd = rfd;
+		sqe->addr = (unsigned long long)&msgs[i].msg_hdr;
+		sqe->len = 1;
+		sqe->msg_flags = MSG_DONTWAIT;
+		sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+		sqe->user_data = ((unsigned long long)r->_gen << 32) | ((unsigned long long)i << 8) | RUP_URING_SEND;
+	}
 
-	// assign checksum to checksum pkt
-	outPktSentAck->_checksum = performChecksum(outPktSentAck);
+	// The first send binds a socket rup_bind never saw, the receive
+	//   queued behind it is issued after it
+	if(!r->_bound)
+	{
+		ringArm(r, rfd);
+	}
+	ringEnter(r, 0, -1);
 
-	for(numtimeouts = 0; numtimeouts < 3 && (pktSent != 1);numtimeouts++)
+	// Failures of this submission are already posted.  They are left in
+	//   the queue for ringRecv to pass over.
+	tail = __atomic_load_n(r->_cqTail, __ATOMIC_ACQUIRE);
+	for(head = *r->_cqHead;head != tail;++head)
 	{
-		// Send a pkt to reader
-		if( sendto(rfd, (char*)outPktSentAck, cc, 0, (struct sockaddr*)to, fromlen) < 0 )
+		cqe = &r->_cqes[head & r->_cqMask];
+		if(((cqe->user_data & 0xFF) != RUP_URING_SEND) || ((unsigned int)(cqe->user_data >> 32) != r->_gen))
 		{
-			printf("ERROR in stopConfirmation_FromSender() - sendto()");
-			exit(0);
+			continue;
+		}
+		idx = (int)((cqe->user_data >> 8) & 0xFFFFFF);
+		if(cqe->res == -EAGAIN)
+		{
+			pfd.fd = rfd;
+			pfd.events = POLLOUT;
+			while((sendmsg(rfd, &msgs[idx].msg_hdr, 0) < 0) && ((errno == EAGAIN) || (errno == EINTR)))
+			{
+				poll(&pfd, 1, -1);
+			}
+		}
+		else if(idx < ret)
+		{
+			ret = idx;
+			errno = -cqe->res;
 		}
+	}
+	return (ret == 0) ? -1 : ret;
+}
 
-		tval.tv_sec = 0;
-		tval.tv_usec = 100000;
+//
+// ringWait
+//
+// Description: Wait for completions, for at most wait microseconds.
+//
+// Input: struct rupRing* r - The ring.
+// Input: long long wait - Longest wait in microseconds, -1 for no limit.
+// Output: int - Returns 1 if completions are waiting and 0 otherwise.
+int ringWait(struct rupRing* r, long long wait)
+{
+	if(*r->_cqHead == __atomic_load_n(r->_cqTail, __ATOMIC_ACQUIRE))
+	{
+		ringEnter(r, 1, wait);
+	}
+	return (*r->_cqHead != __atomic_load_n(r->_cqTail, __ATOMIC_ACQUIRE)) ? 1 : 0;
+}
 
-		// set socket for select call
-		FD_ZERO(&rfds); 
-		FD_SET(rfd,&rfds);
+//
+// ringRecv
+//
+// Description: Feed the datagrams the multishot receive has completed to
+//                the window, as winRecv does for the classic backend, and
+//                hand their buffers back.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rupSock* s - The socket state.
+// Input: int dontwait - Nonzero to return at once when nothing is queued.
+// Output: int n - Returns the number of datagrams read, 0 if dontwait is
+//           set and none was queued.
+int ringRecv(int rfd, struct rupSock* s, int dontwait)
+{
+	// Variable declarations
+	int n, res, bid, len;
+	unsigned int head, flags;
+	unsigned long long tag;
+	struct rupRing* r;
+	struct io_uring_cqe* cqe;
+	struct io_uring_recvmsg_out* out;
+	unsigned char* buf;
+
+	// Variable assignments
+	n = 0;
+	r = s->_ring;
 
-		// Set timer for reading on the socket
-		selret = select(rfd+1,&rfds,NULL,NULL,&tval);
+	if(!dontwait)
+	{
+		while(!ringWait(r, -1))
+		{
+		}
+	}
 
-		if(selret != 0)
+	s->_rxBatch = 1;
+	while((head = *r->_cqHead) != __atomic_load_n(r->_cqTail, __ATOMIC_ACQUIRE))
+	{
+		// Copy the completion out so its slot is free while the frame
+		//   is handled, the frame stays put until its buffer goes back
+		cqe = &r->_cqes[head & r->_cqMask];
+		tag = cqe->user_data;
+		res = cqe->res;
+		flags = cqe->flags;
+		__atomic_store_n(r->_cqHead, head + 1, __ATOMIC_RELEASE);
+
+		// Sends were dealt with by ringSend
+		if((tag & 0xFF) != RUP_URING_RECV)
 		{
-			// Wait for pktSentAck response 
-#ifdef _WIN32_
-			rc = recvfrom(rfd, (char*)&inPktSentAck, sizeof(struct pkt), 0, (struct sockaddr*)(&from), (int*)&fromlen);
-			if (rc < 0 )
-#else
-			if ((rc=recvfrom(rfd, &inPktSentAck, sizeof(struct pkt), 0, (struct sockaddr*)(&from), &fromlen)) < 0 )
+			continue;
+		}
+		if(!(flags & IORING_CQE_F_MORE))
+		{
+			r->_armed = 0;
+		}
+		if(res < 0)
+		{
+			// Out of buffers ends the receive until some go back
+			if(res == -ENOBUFS)
+			{
+				continue;
+			}
+			printf("ERROR in ringRecv().\n");
+			printf("Read error: errno %d\n",-res);
+			printf("reading datagram");
+			exit(0);
+		}
+
+		bid = (int)(flags >> IORING_CQE_BUFFER_SHIFT);
+		buf = r->_bufs + bid * RUP_URINGBUFSIZE;
+		out = (struct io_uring_recvmsg_out*)buf;
+		len = (out->payloadlen < RUP_MAXFRAME) ? (int)out->payloadlen : RUP_MAXFRAME;
+		winInput(rfd, buf + sizeof(struct io_uring_recvmsg_out) + r->_rxMsg.msg_namelen, len,
+			(struct sockaddr_in*)(buf + sizeof(struct io_uring_recvmsg_out)));
+		ringRecycle(r, bid);
+		++n;
+	}
+	s->_rxBatch = 0;
+
+	if((!r->_armed) && (r->_bound))
+	{
+		ringArm(r, rfd);
+		ringEnter(r, 0, -1);
+	}
+
+	// Send the ACKs the batch held back
+	winAckFlush(rfd, s, 0);
+	return n;
+}
 #endif
+
+//
+// winTimers
+//
+// Description: Send the delayed ACKs that are due and retransmit every
+//                frame whose timer has expired.  Partial frames out of
+//                tries or time are given up on instead.
+//
+// Input: int rfd - A valid RUP file descriptor.
+// Input: struct rupSock* s - The socket state.
+// Output: NA
+void winTimers(int rfd, struct rupSock* s)
+{
+	// Variable declarations
+	int i, expired, gaveUp;
+	long long now;
+	struct rupPeer* p;
+	struct winSlot* slot;
+
+	// Forget the peers that have gone quiet.  Frames still queued may
+	//   point into a peer's window, so they go out first.
+	now = rupNow();
+	if(now >= s->_reapAt)
+	{
+		txFlush(rfd, s);
+		peerReap(s, now);
+		s->_reapAt = now + RUP_PEERREAP_US;
+	}
+
+	// Send the ACKs no reply has picked up in time
+	winAckFlush(rfd, s, 0);
+
+	// Mark every pkt whose timer has expired lost, then send what the
+	//   congestion window and pacing allow
+	for(p = s->_peers;p != NULL;p = p->_next)
+	{
+		expired = 0;
+		gaveUp = 0;
+
+		// Repeat the HELLO until the WELCOME comes back
+		if((p->_helloPending) && (now - p->_helloSent >= p->_rto))
+		{
+			if(++p->_helloTries > RUP_MAXRETRIES)
+			{
+				p->_helloPending = 0;
+			}
+			else
+			{
+				helloSend(rfd, p, RUP_T_HELLO, p->_token, p->_tokenLen);
+				p->_stats._retransmits[RUP_PRIM_CONNECT]++;
+			}
+		}
+
+		// Repeat the FWD until the receiver acknowledges past it
+		if((p->_fwdPending) && (now - p->_fwdSent >= p->_rto))
+		{
+			if(++p->_fwdTries > RUP_MAXRETRIES)
+			{
+				p->_fwdPending = 0;
+			}
+			else
+			{
+				winForward(rfd, p);
+				p->_stats._retransmits[RUP_PRIM_FORWARD]++;
+			}
+		}
+		if(p->_sndBase == p->_sndNext)
+		{
+			continue;
+		}
+		for(i = 0;i < RUP_MAXWINDOW;++i)
+		{
+			slot = &p->_snd[i];
+			if((slot->_used) && (slot->_expire != 0) && (now >= slot->_expire))
 			{
-				//printf("recvfrom error\n");
-				//printf("rc = %d\n", rc);
-				//printf("ERROR in stopConfirmation_FromSender().\n");
-				//printf("Write error: errno %d\n",errno);
-				//printf("reading datagram");
-				//exit(0);
-				return 0;
+				winExpire(p, slot);
+				gaveUp = 1;
+				continue;
 			}
+			if((slot->_used) && (!slot->_lost) && ((int)(slot->_seq - p->_sndPaced) < 0) && (now - slot->_sent >= p->_rto))
+			{
+				if((slot->_tries > 0) && (slot->_retries + 1 >= slot->_tries))
+				{
+					winExpire(p, slot);
+					gaveUp = 1;
+					continue;
+				}
 
-			// assign checksum to checksum pkt
-			inChecksum = performChecksum(((struct pkt*)(&inPktSentAck)));
+				// A receiver that keeps offering a closed window is alive,
+				//   one whose ACKs stopped is not
+				if((slot->_retries >= RUP_MAXRETRIES) && ((p->_rwnd > 0) || (now - p->_ackHeard >= RUP_MAXRETRIES * RUP_MAXRTO_US)))
+				{
+					winAbort(p);
+					expired = 0;
+					gaveUp = 0;
+					break;
+				}
+				slot->_retries++;
+				slot->_dups = 0;
+				expired = 1;
+				winLost(p, slot);
+			}
+		}
 
-			// getting the from address into a variable
-			fns = inet_ntoa(from.sin_addr);
+		if(gaveUp)
+		{
+			winForward(rfd, p);
+		}
 
-			// Check pkt for ACK
-			if((inPktSentAck._ackvar == FINALACK)&&(pktID == inPktSentAck._id)&&(from.sin_port == to->sin_port)&&(!(strcmp(fns,tns))))
-			{
-				pktSent = 1;
-			}
-			else
+		// Back the timer off once per timeout, it stays backed off until
+		//   a pkt that was sent only once is acknowledged
+		if(expired)
+		{
+			p->_stats._timeouts++;
+			p->_rto = (p->_rto * 2 < RUP_MAXRTO_US) ? p->_rto * 2 : RUP_MAXRTO_US;
+			if((rupCCs[s->_cc]._timeout != NULL) && (p->_rwnd > 0))
 			{
-				//printf("fs3-received someone else's pkt and disregarding it\n");
-				pktSent = 0;
+				rupCCs[s->_cc]._timeout(p);
 			}
 		}
-		else
-		{
-			//printf("No ack pkt received(stopConfirmation_FromSender)...select returned %d\n",selret);
-			numtimeouts++;
-			pktSent = 0;
-		}
-	}
-	if(numtimeouts > 1)
-	{
-		//printf("stopConfirmation_FromSender has timedout...GOOD!\n");
-		pktSent = 0;
+		winPace(rfd, p, now);
 	}
-
-	delete outPktSentAck;
-	return pktSent;
 }
 
 //
-// receiveDataPkt_FromReceiver
+// rttSample
 //
-// Description: Wait on a port until data is received.
+// Description: Feed one round trip measurement into the peer's smoothed
+//                RTT estimator and recompute its retransmit timeout
+//                (RFC 6298).
 //
-// Input: int rfd - A valid RUP file descriptor.
-// Input: void* buf - A pointer to the data being sent.
-// Input: int cc - The byte count/size of buf.
-// Input: struct sockaddr_in* from - A socket address structure containing
-//          the remote ip address and port number.
-// Output: int ret - Returns 1 on success and 0 on failure.
-int receiveDataPkt_FromReceiver(int rfd, void* buf, int cc, struct sockaddr_in* from)
+// Input: struct rupPeer* p - The peer the measurement belongs to.
+// Input: long long rtt - The measured round trip time in microseconds.
+// Output: NA
+void rttSample(struct rupPeer* p, long long rtt)
 {
 	// Variable declarations
-	int rc, ret, inChecksum;
-	unsigned int fromlen;
-
-	// Variable assignments
-	ret = 0;
-	fromlen = sizeof(struct sockaddr_in);
+	long long err;
 
-	memset((char*)buf,0,sizeof(struct pkt));
+	if(rtt < 1)
+	{
+		rtt = 1;
+	}
 
-	while(ret != 1)
+	if(p->_samples == 0)
 	{
-#ifdef _WIN32_
-		if ((rc=recvfrom(rfd, (char*)buf, cc, 0, (struct sockaddr*)from, (int*)&fromlen)) < 0 )
-#else
-		if ((rc=recvfrom(rfd, buf, cc, 0, (struct sockaddr*)from, &fromlen)) < 0 )
-#endif
-		{
-			printf("receiveDataPkt_FromReceiver() - recvfrom() error: errno %d\n",errno);
-			printf("reading datagram");
-			exit(0);
-		}
+		p->_srtt = rtt;
+		p->_rttvar = rtt / 2;
+	}
+	else
+	{
+		err = (p->_srtt > rtt) ? p->_srtt - rtt : rtt - p->_srtt;
+		p->_rttvar = (3 * p->_rttvar + err) / 4;
+		p->_srtt = (7 * p->_srtt + rtt) / 8;
+	}
+	p->_samples++;
+	rtoUpdate(p);
+	histRecord(&p->_stats._rtt, rtt);
+}
 
-		// assign checksum to checksum pkt
-		inChecksum = performChecksum( ((struct pkt*)buf) );
+//
+// rttSeed
+//
+// Description: Start a peer's RTT estimator from an earlier connection's
+//                estimate, as if it were its first sample.
+//
+// Input: struct rupPeer* p - The peer.
+// Input: long long srtt - The smoothed RTT in microseconds.
+// Input: long long rttvar - The RTT variance in microseconds.
+// Output: NA
+void rttSeed(struct rupPeer* p, long long srtt, long long rttvar)
+{
+	p->_srtt = srtt;
+	p->_rttvar = rttvar;
+	p->_samples = 1;
+	rtoUpdate(p);
+}
 
-		if( (((struct pkt*)buf)->_ackvar != FINALACK) &&  (((struct pkt*)buf)->_ackvar != ACK) && (inChecksum == ((struct pkt*)buf)->_checksum) )
-		{
-			ret = 1;
-		}
-		else
-		{
-			ret = 0;
-			//printf("ERROR: either final pkt received(X) , ack pkt received(Z), or Bad checksum!\n");
-		}
+//
+// rtoUpdate
+//
+// Description: Recompute a peer's retransmit timeout from its estimator.
+//
+// Input: struct rupPeer* p - The peer.
+// Output: NA
+void rtoUpdate(struct rupPeer* p)
+{
+	// The variance of a steady path decays to almost nothing, then a queue
+	//   building faster than the estimator follows fires the timer with
+	//   nothing lost.  Allow at least one more SRTT of queueing.
+	p->_rto = p->_srtt + ((4 * p->_rttvar > p->_srtt) ? 4 * p->_rttvar : p->_srtt);
+	if(p->_rto < RUP_MINRTO_US)
+	{
+		p->_rto = RUP_MINRTO_US;
+	}
+	else if(p->_rto > RUP_MAXRTO_US)
+	{
+		p->_rto = RUP_MAXRTO_US;
 	}
-	return ret;
 }
 
+//
+// histRecord
+//
+// Description: Add one time to a histogram.  This runs for every RTT
+//                sample and completed write, so it is a few shifts and
+//                adds on counters only the socket's thread touches.
+//
+// Input: struct rup_histogram* h - The histogram.
+// Input: long long v - The time in microseconds.
+// Output: NA
+void histRecord(struct rup_histogram* h, long long v)
+{
+	v = (v < 0) ? 0 : v;
+	if((h->_count == 0) || (v < h->_min))
+	{
+		h->_min = v;
+	}
+	if(v > h->_max)
+	{
+		h->_max = v;
+	}
+	h->_count++;
+	h->_sum += v;
+	h->_buckets[histIndex(v)]++;
+}
 
-// ACK_FromReceiver
 //
-// Description: An ACK is sent to notify the sender that the receiver
-//                has received the data pkt successfully.
+// histIndex
 //
-// Input: int rfd - A valid RUP file descriptor.
-// Input: void* buf - A pointer to the data being sent.
-// Input: int cc - The byte count/size of buf.
-// Input: struct sockaddr_in* to - A socket address structure containing
-//          the remote ip address and port number.
-// Output: int pktSent - Returns 1 on success and 0 on failure.
-int ACK_FromReceiver(int rfd, void* buf, int cc, struct sockaddr_in* to)
+// Description: The bucket of a time: its top bit picks the power of two
+//                and the 4 bits below it the sixteenth within it.
+//
+// Input: long long v - The time in microseconds, not negative.
+// Output: int - The bucket, below RUP_HISTBUCKETS.
+int histIndex(long long v)
 {
 	// Variable declarations
-	int rc, numtimeouts, pktSent, selret, pktID, inChecksum;
-	unsigned int fromlen;
-	char* tns;
-	char* fns;
-	struct pkt* outPktSentAck;
-	struct pkt inPktSentAck;
-	struct sockaddr_in from;
-	struct timeval tval;
-	fd_set rfds;
-
-	// Variable assignments
-	numtimeouts = 0;
-	pktSent = 0;
-	selret = 0;
-	pktID = ((struct pkt*)buf)->_id;
-	fromlen = sizeof(struct sockaddr_in);
+	int top, shift;
 
-	memset((char*)&inPktSentAck,0,sizeof(struct pkt));
+	if(v >= (1LL << 36))
+	{
+		return RUP_HISTBUCKETS - 1;
+	}
+	if(v < 32)
+	{
+		return (int)v;
+	}
 
-	// getting the to address into a variable
-	tns = inet_ntoa(to->sin_addr);
+	// Variable assignments
+#ifdef __GNUC__
+	top = 63 - __builtin_clzll((unsigned long long)v);
+#else
+	for(top = 5;(v >> (top + 1)) != 0;++top)
+	{
+	}
+#endif
+	shift = top - 4;
 
-	char command[1] = "";
-	char buffer[1] = "";
-	// Creating ACK pkt
-	outPktSentAck = createPkt(((struct pkt*)buf)->_id,&command[0], &((struct pkt*)buf)->_client, ((struct pkt*)buf)->_client_name,((struct pkt*)buf)->_client_password,&buffer[0],ACK);
+	return shift * 16 + (int)(v >> shift);
+}
 
-	// assign checksum to checksum pkt
-	outPktSentAck->_checksum = performChecksum(outPktSentAck);
+//
+// histTop
+//
+// Description: The largest time a histogram bucket holds.
+//
+// Input: int idx - The bucket.
+// Output: long long - The time in microseconds.
+long long histTop(int idx)
+{
+	// Variable declarations
+	int shift;
 
-	while(pktSent != 1)
+	if(idx < 32)
 	{
-		// Send a pkt to reader
-		if( sendto(rfd, (char*)outPktSentAck, cc, 0, (struct sockaddr*)to, fromlen) < 0 )
-		{
-			printf("ERROR in ACK_FromReceiver() - sendto()");
-			exit(0);
-		}
-
-		tval.tv_sec = 0;
-		tval.tv_usec = 100000;
-		// set socket for select call
-		FD_ZERO(&rfds); 
-		FD_SET(rfd,&rfds);
+		return idx;
+	}
 
-		// Set timer for reading on the socket
-		selret = select(rfd+1,&rfds,NULL,NULL,&tval);
+	// Variable assignments
+	shift = idx / 16 - 1;
 
-		if(selret != 0)
-		{
+	return ((((long long)(idx % 16 + 16)) + 1) << shift) - 1;
+}
 
-			// Wait for pktSentAck response 
-#ifdef _WIN32_
-			if ((rc=recvfrom(rfd, (char*)&inPktSentAck, sizeof(struct pkt), 0, ((struct sockaddr*)(&from)), (int*)&fromlen)) < 0 )
-#else
-			if ((rc=recvfrom(rfd, &inPktSentAck, sizeof(struct pkt), 0, ((struct sockaddr*)(&from)), &fromlen)) < 0 )
-#endif
-			{
-				printf("ERROR in ACK_FromReceiver().\n");
-				printf("Write error: errno %d\n",errno);
-				printf("reading datagram");
-				exit(0);
-			}
+//
+// statsAdd
+//
+// Description: Add one set of counters and histograms to another.
+//
+// Input: struct rup_stats* to - The counters added to.
+// Input: struct rup_stats* from - The counters to add.
+// Output: NA
+void statsAdd(struct rup_stats* to, struct rup_stats* from)
+{
+	// Variable declarations
+	int i;
 
-			// assign checksum to checksum pkt
-			inChecksum = performChecksum(((struct pkt*)(&inPktSentAck)));
+	to->_sent += from->_sent;
+	to->_sentBytes += from->_sentBytes;
+	to->_received += from->_received;
+	to->_receivedBytes += from->_receivedBytes;
+	for(i = 0;i < RUP_PRIMS;++i)
+	{
+		to->_retransmits[i] += from->_retransmits[i];
+	}
+	to->_duplicates += from->_duplicates;
+	to->_foreign += from->_foreign;
+	to->_badChecksum += from->_badChecksum;
+	to->_timeouts += from->_timeouts;
+	to->_failures += from->_failures;
+	histAdd(&to->_rtt, &from->_rtt);
+	histAdd(&to->_complete, &from->_complete);
+}
 
-			// getting the from address into a variable
-			fns = inet_ntoa(from.sin_addr);
+//
+// histAdd
+//
+// Description: Add the times of one histogram to another.
+//
+// Input: struct rup_histogram* to - The histogram added to.
+// Input: struct rup_histogram* from - The histogram to add.
+// Output: NA
+void histAdd(struct rup_histogram* to, struct rup_histogram* from)
+{
+	// Variable declarations
+	int i;
 
-			// Check pkt for ACK
-			if( (inPktSentAck._ackvar == ACK)	&&
-				(pktID == inPktSentAck._id)		&&
-				(from.sin_port == to->sin_port) &&
-				(!(strcmp(fns,tns))) )
-			{
-				pktSent = 1;
-			}
-			else
-			{
-				//printf("fr2-received someone else's pkt and disregarding it #%d\n",numtimeouts);
-				pktSent = 0;
-				if(numtimeouts > 2)
-				{
-					numtimeouts = 0;
-					return 0;
-					//receiveDataPkt_FromReceiver(rfd, buf, cc, to);
-				}
-				else
-				{
-					numtimeouts++;
-				}
-			}
-		}
-		else
-		{
-			//printf("No ack pkt received(ACK_FromReceiver)...select returned %d\n",selret);
-			pktSent = 0;
-		}
+	if(from->_count == 0)
+	{
+		return;
+	}
+	if((to->_count == 0) || (from->_min < to->_min))
+	{
+		to->_min = from->_min;
+	}
+	if(from->_max > to->_max)
+	{
+		to->_max = from->_max;
+	}
+	to->_count += from->_count;
+	to->_sum += from->_sum;
+	for(i = 0;i < RUP_HISTBUCKETS;++i)
+	{
+		to->_buckets[i] += from->_buckets[i];
 	}
-	delete outPktSentAck;
-	return pktSent;
 }
 
 //
-// stopConfirmation_FromReceiver
+// winLinger
 //
-// Description: An ACK is sent to notify the sender to stop sending ACK's
-//                When a final ACK is received, the function will finish,
-//                or it will simply timeout becuase it knows the sender has
-//                already confirmed the data has been sent successfully.
+// Description: Keep answering retransmitted data pkts for a short while
+//                after the last ACK went out, the way TCP's TIME_WAIT
+//                does.  Returns at once when nothing was acknowledged recently.
 //
 // Input: int rfd - A valid RUP file descriptor.
-// Input: void* buf - A pointer to the data being sent.
-// Input: int cc - The byte count/size of buf.
-// Input: struct sockaddr_in* to - A socket address structure containing
-//          the remote ip address and port number.
-// Output: int pktSent - Returns 1 on success and 0 on failure.
-int stopConfirmation_FromReceiver(int rfd, void* buf, int cc, struct sockaddr_in* to)
+// Input: struct rupSock* s - The socket state.
+// Output: NA
+void winLinger(int rfd, struct rupSock* s)
 {
-
 	// Variable declarations
-	int rc, numtimeouts, pktSent, selret, pktID, inChecksum;
-	unsigned int fromlen;
-	char* tns;
-	char* fns;
-	struct pkt* outPktSentAck;
-	struct pkt inPktSentAck;
-	struct sockaddr_in from;
-	struct timeval tval;
-	fd_set rfds;
+	long long until, now;
 
 	// Variable assignments
-	numtimeouts = 0;
-	pktSent = 0;
-	selret = 0;
-	pktID = ((struct pkt*)buf)->_id;
-	fromlen = sizeof(struct sockaddr_in);
+	now = rupNow();
 
-	memset((char*)&inPktSentAck,0,sizeof(struct pkt));
+	winAckFlush(rfd, s, 1);
 
-	// getting the to address into a variable
-	tns = inet_ntoa(to->sin_addr);
+	// A retransmit answered while lingering moves the peer's last ACK and
+	//   so extends the linger
+	do
+	{
+		until = winLingerEnd(s);
+		if(now < until)
+		{
+			winService(rfd, s, until - now);
+			now = rupNow();
+		}
+	} while(now < until);
+}
 
-	char command[1] = "";
-	char buffer[1] = "";
-	// Creating ACK pkt
-	outPktSentAck = createPkt(((struct pkt*)buf)->_id,&command[0], &((struct pkt*)buf)->_client, ((struct pkt*)buf)->_client_name,((struct pkt*)buf)->_client_password,&buffer[0],ACK);
+//
+// winLingerEnd
+//
+// Description: Find when the socket may stop lingering, which is a few RTOs
+//                after the last ACK it sent any peer.
+//
+// Input: struct rupSock* s - The socket state.
+// Output: long long until - The time in microseconds, 0 if no ACK was sent.
+long long winLingerEnd(struct rupSock* s)
+{
+	// Variable declarations
+	long long until, span;
+	struct rupPeer* p;
 
-	// assign checksum to checksum pkt
-	outPktSentAck->_checksum = performChecksum(outPktSentAck);
+	// Variable assignments
+	until = 0;
 
-	for(numtimeouts = 0;numtimeouts < 3 && (pktSent != 1); numtimeouts++)
+	for(p = s->_peers;p != NULL;p = p->_next)
 	{
-		// Send a pkt to reader
-		if( sendto(rfd, (char*)outPktSentAck, cc, 0, (struct sockaddr*)to, fromlen) < 0 )
+		span = winLingerSpan(p);
+		if((p->_lastAck != 0) && (p->_lastAck + span > until))
 		{
-			printf("ERROR in stopConfirmation_FromReceiver() - sendto()");
-			exit(0);
+			until = p->_lastAck + span;
 		}
+	}
+	return until;
+}
 
-		tval.tv_sec = 0;
-		tval.tv_usec = 100000;
-
-		// set socket for select call
-		FD_ZERO(&rfds); 
-		FD_SET(rfd,&rfds);
-
-		// Set timer for reading on the socket
-		selret = select(rfd+1,&rfds,NULL,NULL,&tval);
+//
+// winLingerSpan
+//
+// Description: How long after its last ACK a peer's retransmits are still
+//                answered: a few of its RTOs, but never less than
+//                RUP_LINGER_MIN_US.
+//
+// Input: struct rupPeer* p - The peer.
+// Output: long long span - The time in microseconds.
+long long winLingerSpan(struct rupPeer* p)
+{
+	// Variable declarations
+	long long span;
 
-		if(selret != 0)
-		{
-			// Wait for pktSentAck response 
-#ifdef _WIN32_
-			if ((rc=recvfrom(rfd, (char*)&inPktSentAck, sizeof(struct pkt), 0, (struct sockaddr*)(&from), (int*)&fromlen)) < 0 )
-#else
-			if ((rc=recvfrom(rfd, &inPktSentAck, sizeof(struct pkt), 0, (struct sockaddr*)(&from), &fromlen)) < 0 )
-#endif
-			{
-				printf("ERROR in stopConfirmation_FromReceiver().\n");
-				printf("Write error: errno %d\n",errno);
-				printf("reading datagram");
-				exit(0);
-			}
+	// Variable assignments
+	span = RUP_LINGER_RTOS * p->_rto;
 
-			// assign checksum to checksum pkt
-			inChecksum = performChecksum(((struct pkt*)(&inPktSentAck)));
+	return (span > RUP_LINGER_MIN_US) ? span : RUP_LINGER_MIN_US;
+}
 
-			// getting the from address into a variable
-			fns = inet_ntoa(from.sin_addr);
+//
+// winAbort
+//
+// Description: Give up on everything in flight to a peer that has stopped
+//                answering, so nothing waits on it forever.
+//
+// Input: struct rupPeer* p - The peer.
+// Output: NA
+void winAbort(struct rupPeer* p)
+{
+	// Variable declarations
+	int i;
 
-			// Check pkt for ACK
-			if( (inPktSentAck._ackvar == FINALACK) &&(pktID == inPktSentAck._id)&&(from.sin_port == to->sin_port)&&(!(strcmp(fns,tns))))
-			{
-				pktSent = 1;
-			}
-			else
-			{
-				//printf("fr3-received someone else's pkt and disregarding it\n");
-				pktSent = 0;
-			}
-		}
-		else
-		{
-			//printf("No ack pkt received(stopConfirmation_FromReceiver)...select returned %d\n",selret);
-			numtimeouts++;
-			pktSent = 0;
-		}
+	for(i = 0;i < RUP_MAXWINDOW;++i)
+	{
+		p->_snd[i]._used = 0;
+		p->_snd[i]._lost = 0;
 	}
-	delete outPktSentAck;
-	return pktSent;
+	p->_sndBase = p->_sndNext;
+	p->_sndPaced = p->_sndNext;
+	p->_inFlight = 0;
+	p->_lost = 0;
+	p->_rto = RUP_INITRTO_US;
+	p->_fwdPending = 0;
+	p->_failed++;
+	p->_stats._failures++;
+	p->_sock->_failed++;
+
+	// Kept for a linger so a caller waiting on it sees it fail
+	p->_abandoned = 1;
+	p->_lastSeen = rupNow();
 }
 
 //
@@ -927,7 +8158,7 @@ struct pkt* createPkt(int cpId, char* cpCommand, struct sockaddr_in* cpClient, c
 	struct pkt* newPkt;
 
 	// Variable assignments
-	newPkt = new struct pkt;
+	newPkt = pktAlloc();
 
 	memset((char*)newPkt,0,sizeof(struct pkt));
 
@@ -958,7 +8189,7 @@ struct pkt* copyPkt(struct pkt* inPkt)
 	struct pkt* newPkt;
 
 	// Variable assignments
-	newPkt = new struct pkt;
+	newPkt = pktAlloc();
 
 	memset((char*)newPkt,0,sizeof(struct pkt));
 
@@ -974,3 +8205,77 @@ struct pkt* copyPkt(struct pkt* inPkt)
 	newPkt->_ackvar = inPkt->_ackvar;
 	return newPkt;
 }
+
+//
+// freePkt
+//
+// Description: Hand back a pkt from createPkt so the thread's next
+//               createPkt can reuse it.
+//
+// Input: struct pkt* p - The pkt, NULL is ignored.
+// Output: NA
+void freePkt(struct pkt* p)
+{
+	// Variable declarations
+	struct rupPktFree* f;
+
+	if(p == NULL)
+	{
+		return;
+	}
+
+	if(rupPktPoolLen >= RUP_PKTPOOL)
+	{
+		delete p;
+		rupAllocs._frees++;
+		return;
+	}
+
+	// Variable assignments
+	f = (struct rupPktFree*)p;
+
+	f->_next = rupPktPool;
+	rupPktPool = f;
+	rupPktPoolLen++;
+}
+
+//
+// pktAlloc
+//
+// Description: Take a pkt from the thread's pool, or from the heap when the
+//                pool is empty.
+//
+// Input: NA
+// Output: struct pkt* - The pkt, not cleared.
+struct pkt* pktAlloc()
+{
+	// Variable declarations
+	struct rupPktFree* f;
+
+	// Variable assignments
+	f = rupPktPool;
+
+	if(f != NULL)
+	{
+		rupPktPool = f->_next;
+		rupPktPoolLen--;
+		rupAllocs._reuses++;
+		return (struct pkt*)f;
+	}
+
+	rupAllocs._allocs++;
+	return new struct pkt;
+}
+
+//
+// rup_getallocs
+//
+// Description: Report the heap use of RUP calls made by the calling thread.
+//
+// Input: struct rup_allocinfo* info - Filled in with the counters.
+// Output: int - Returns 0 on success.
+int rup_getallocs(struct rup_allocinfo* info)
+{
+	*info = rupAllocs;
+	return 0;
+}